@@ -6,9 +6,27 @@
 
 #include "Python.h"
 #include "numpy/arrayobject.h"
+#include "compress_segmentation.h"
+#include "compresso.hpp"
+#include "compresso_transcode.h"
+#include "decompress_segmentation.h"
 #include "on_demand_object_mesh_generator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 #define MODULE_NAME "_neuroglancer"
 
+#if __APPLE__
+#include <libkern/OSByteOrder.h>
+#define htole32(x) OSSwapHostToLittleInt32(x)
+#elif defined(_WIN32)
+#define htole32(x) (x)
+#else
+#include <endian.h>
+#endif
+
 namespace neuroglancer {
 namespace pywrap_on_demand_object_mesh_generator {
 
@@ -32,21 +50,44 @@ static int tp_init(Obj* self, PyObject* args, PyObject* kwds) {
   float offset[3];
   meshing::SimplifyOptions simplify_options;
   int lock_boundary_vertices = simplify_options.lock_boundary_vertices;
+  int optimize_vertex_cache = simplify_options.optimize_vertex_cache;
+  long long max_faces = simplify_options.max_faces;
+  long long max_bytes = simplify_options.max_bytes;
   static const char* kw_list[] = {"data",
                                   "voxel_size",
                                   "offset",
                                   "max_quadrics_error",
                                   "max_normal_angle_deviation",
                                   "lock_boundary_vertices",
+                                  "optimize_vertex_cache",
+                                  "smoothing_iterations",
+                                  "smoothing_lambda",
+                                  "smoothing_mu",
+                                  "max_faces",
+                                  "max_bytes",
+                                  "adaptive_error_reference_extent",
+                                  "preview_cell_size",
                                   nullptr};
   if (!PyArg_ParseTupleAndKeywords(
-          args, kwds, "O(fff)(fff)|ddi:__init__", const_cast<char**>(kw_list), &array_argument,
-          voxel_size, voxel_size + 1, voxel_size + 2, offset, offset + 1, offset + 2,
-          &simplify_options.max_quadrics_error, &simplify_options.max_normal_angle_deviation,
-          &lock_boundary_vertices)) {
+          args, kwds, "O(fff)(fff)|ddiiiddLLdd:__init__", const_cast<char**>(kw_list),
+          &array_argument, voxel_size, voxel_size + 1, voxel_size + 2, offset, offset + 1,
+          offset + 2, &simplify_options.max_quadrics_error,
+          &simplify_options.max_normal_angle_deviation, &lock_boundary_vertices,
+          &optimize_vertex_cache, &simplify_options.smoothing_iterations,
+          &simplify_options.smoothing_lambda, &simplify_options.smoothing_mu, &max_faces,
+          &max_bytes, &simplify_options.adaptive_error_reference_extent,
+          &simplify_options.preview_cell_size)) {
+    return -1;
+  }
+  // Also rejects NaN.
+  if (!(simplify_options.preview_cell_size > 0)) {
+    PyErr_SetString(PyExc_ValueError, "preview_cell_size must be positive");
     return -1;
   }
   simplify_options.lock_boundary_vertices = static_cast<bool>(lock_boundary_vertices);
+  simplify_options.optimize_vertex_cache = static_cast<bool>(optimize_vertex_cache);
+  simplify_options.max_faces = static_cast<int64_t>(max_faces);
+  simplify_options.max_bytes = static_cast<int64_t>(max_bytes);
   PyArrayObject* array = reinterpret_cast<PyArrayObject*>(
       PyArray_CheckFromAny(array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
                            /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
@@ -116,34 +157,97 @@ static void tp_dealloc(PyObject* self) {
   Py_DECREF(tp);
 }
 
-static PyObject* get_mesh(Obj* self, PyObject* args) {
+static PyObject* get_mesh(Obj* self, PyObject* args, PyObject* kwds) {
   auto impl = self->impl;
   if (!impl) {
     PyErr_SetString(PyExc_ValueError, "Not initialized.");
     return nullptr;
   }
   uint64_t object_id;
-  if (!PyArg_ParseTuple(args, "K:get_mesh", &object_id)) {
+  int preview = 0;
+  static const char* kw_list[] = {"object_id", "preview", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "K|p:get_mesh", const_cast<char**>(kw_list),
+                                   &object_id, &preview)) {
     return nullptr;
   }
 
-  const std::string* encoded_mesh = nullptr;
+  std::shared_ptr<const std::string> encoded_mesh;
 
   Py_BEGIN_ALLOW_THREADS;
 
-  encoded_mesh = &self->impl.GetSimplifiedMesh(object_id);
+  if (preview) {
+    encoded_mesh = self->impl.GetPreviewMesh(object_id);
+  } else {
+    encoded_mesh = self->impl.GetSimplifiedMesh(object_id);
+  }
 
   Py_END_ALLOW_THREADS;
 
-  if (encoded_mesh->empty()) {
+  if (!encoded_mesh) {
     Py_RETURN_NONE;
   }
   return PyBytes_FromStringAndSize(encoded_mesh->data(), encoded_mesh->size());
 }
 
+static PyObject* get_mesh_fragments(Obj* self, PyObject* args) {
+  auto impl = self->impl;
+  if (!impl) {
+    PyErr_SetString(PyExc_ValueError, "Not initialized.");
+    return nullptr;
+  }
+  uint64_t object_id;
+  float fragment_size[3];
+  if (!PyArg_ParseTuple(args, "K(fff):get_mesh_fragments", &object_id, fragment_size,
+                        fragment_size + 1, fragment_size + 2)) {
+    return nullptr;
+  }
+  if (!(fragment_size[0] > 0 && fragment_size[1] > 0 && fragment_size[2] > 0)) {
+    PyErr_SetString(PyExc_ValueError, "fragment_size must be positive");
+    return nullptr;
+  }
+
+  std::vector<meshing::EncodedMeshFragment> fragments;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  fragments = self->impl.GetSimplifiedMeshFragments(object_id, fragment_size);
+
+  Py_END_ALLOW_THREADS;
+
+  if (fragments.empty()) {
+    Py_RETURN_NONE;
+  }
+  PyObject* result = PyList_New(fragments.size());
+  if (!result) return nullptr;
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    const auto& fragment = fragments[i];
+    PyObject* encoded_mesh =
+        PyBytes_FromStringAndSize(fragment.encoded_mesh.data(), fragment.encoded_mesh.size());
+    if (!encoded_mesh) {
+      Py_DECREF(result);
+      return nullptr;
+    }
+    // "N" steals the reference to encoded_mesh.
+    PyObject* item = Py_BuildValue(
+        "(fff)(fff)N", fragment.lower_bound[0], fragment.lower_bound[1], fragment.lower_bound[2],
+        fragment.upper_bound[0], fragment.upper_bound[1], fragment.upper_bound[2], encoded_mesh);
+    if (!item) {
+      Py_DECREF(result);
+      return nullptr;
+    }
+    PyList_SetItem(result, i, item);
+  }
+  return result;
+}
+
 static PyMethodDef methods[] = {
-    {"get_mesh", reinterpret_cast<PyCFunction>(&get_mesh), METH_VARARGS,
-     "Retrieve the encoded mesh for an object."},
+    {"get_mesh", reinterpret_cast<PyCFunction>(&get_mesh), METH_VARARGS | METH_KEYWORDS,
+     "Retrieve the encoded mesh for an object.  If preview=True, a coarse mesh that is much "
+     "faster to compute is returned instead, unless the full mesh is already available."},
+    {"get_mesh_fragments", reinterpret_cast<PyCFunction>(&get_mesh_fragments), METH_VARARGS,
+     "Retrieve the encoded mesh for an object split into fragments on a grid with the "
+     "specified cell size.  Returns a list of (lower_bound, upper_bound, encoded_mesh) tuples "
+     "in grid order."},
     {NULL} /* Sentinel */
 };
 
@@ -166,6 +270,809 @@ static void register_type(PyObject* module) {
 }
 }  // namespace pywrap_on_demand_object_mesh_generator
 
+namespace pywrap_compress_segmentation {
+
+// Input array and parameters of the compress_segmentation functions.
+struct CompressSegmentationInput {
+  PyArrayObject* array = nullptr;
+  npy_intp elsize;
+  ptrdiff_t volume_size[4] = {1, 1, 1, 1};
+  ptrdiff_t input_strides[4] = {0, 0, 0, 0};
+  ptrdiff_t block_size[3];
+
+  ~CompressSegmentationInput() { Py_XDECREF(array); }
+};
+
+// Converts `array_argument` and `block_size_arg`, and returns false with a
+// Python exception set on failure.
+static bool ConvertCompressSegmentationInput(PyObject* array_argument,
+                                             const Py_ssize_t block_size_arg[3],
+                                             CompressSegmentationInput* input) {
+  if (block_size_arg[0] <= 0 || block_size_arg[1] <= 0 || block_size_arg[2] <= 0) {
+    PyErr_SetString(PyExc_ValueError, "block_size must be positive");
+    return false;
+  }
+  std::copy(block_size_arg, block_size_arg + 3, input->block_size);
+  input->array = reinterpret_cast<PyArrayObject*>(
+      PyArray_CheckFromAny(array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/4,
+                           /*requirements=*/NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+                           /*context=*/nullptr));
+  if (!input->array) {
+    return false;
+  }
+  auto* descr = PyArray_DESCR(input->array);
+  npy_intp elsize;
+#ifdef NPY_2_0_API_VERSION
+  elsize = PyDataType_ELSIZE(descr);
+#else
+  elsize = descr->elsize;
+#endif
+  // Signed labels are rejected rather than reinterpreted as unsigned, since
+  // the mapping keys would then be ordered and validated inconsistently.
+  if (descr->kind != 'u' || (elsize != 1 && elsize != 2 && elsize != 4 && elsize != 8)) {
+    PyErr_SetString(PyExc_ValueError,
+                    "ndarray must have 8-, 16-, 32- or 64-bit unsigned integer type");
+    return false;
+  }
+  input->elsize = elsize;
+
+  // The array is indexed as [channel,] z, y, x.
+  const int ndim = PyArray_NDIM(input->array);
+  npy_intp* dims = PyArray_DIMS(input->array);
+  npy_intp* strides_in_bytes = PyArray_STRIDES(input->array);
+  for (int i = 0; i < ndim; ++i) {
+    input->volume_size[i] = dims[ndim - 1 - i];
+    input->input_strides[i] = strides_in_bytes[ndim - 1 - i] / elsize;
+  }
+  return true;
+}
+
+// Label mapping arrays, converted to the data type of the labels.
+struct CompressSegmentationMapping {
+  PyArrayObject* keys = nullptr;
+  PyArrayObject* values = nullptr;
+
+  ~CompressSegmentationMapping() {
+    Py_XDECREF(keys);
+    Py_XDECREF(values);
+  }
+};
+
+template <class Label>
+static bool IsStrictlyIncreasing(PyArrayObject* array) {
+  auto* data = static_cast<const Label*>(PyArray_DATA(array));
+  const npy_intp size = PyArray_SIZE(array);
+  for (npy_intp i = 1; i < size; ++i) {
+    if (data[i] <= data[i - 1]) return false;
+  }
+  return true;
+}
+
+// Converts the (keys, values) pair `mapping_argument` to the unsigned integer
+// type `descr` of size `elsize`, and returns false with a Python exception set
+// on failure.
+static bool ConvertCompressSegmentationMapping(PyObject* mapping_argument, PyArray_Descr* descr,
+                                               npy_intp elsize,
+                                               CompressSegmentationMapping* mapping) {
+  PyObject* keys_argument;
+  PyObject* values_argument;
+  if (!PyTuple_Check(mapping_argument) ||
+      !PyArg_ParseTuple(mapping_argument, "OO", &keys_argument, &values_argument)) {
+    PyErr_SetString(PyExc_TypeError, "mapping must be a (keys, values) tuple");
+    return false;
+  }
+  const int requirements =
+      NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED | NPY_ARRAY_FORCECAST;
+  // PyArray_FromAny steals a reference to the descriptor.
+  Py_INCREF(descr);
+  mapping->keys = reinterpret_cast<PyArrayObject*>(
+      PyArray_FromAny(keys_argument, descr, 1, 1, requirements, nullptr));
+  if (!mapping->keys) return false;
+  Py_INCREF(descr);
+  mapping->values = reinterpret_cast<PyArrayObject*>(
+      PyArray_FromAny(values_argument, descr, 1, 1, requirements, nullptr));
+  if (!mapping->values) return false;
+  if (PyArray_SIZE(mapping->keys) != PyArray_SIZE(mapping->values)) {
+    PyErr_SetString(PyExc_ValueError, "mapping keys and values must have the same length");
+    return false;
+  }
+  bool sorted = false;
+  switch (elsize) {
+    case 1:
+      sorted = IsStrictlyIncreasing<uint8_t>(mapping->keys);
+      break;
+    case 2:
+      sorted = IsStrictlyIncreasing<uint16_t>(mapping->keys);
+      break;
+    case 4:
+      sorted = IsStrictlyIncreasing<uint32_t>(mapping->keys);
+      break;
+    case 8:
+      sorted = IsStrictlyIncreasing<uint64_t>(mapping->keys);
+      break;
+  }
+  if (!sorted) {
+    PyErr_SetString(PyExc_ValueError, "mapping keys must be strictly increasing");
+    return false;
+  }
+  return true;
+}
+
+template <class Label>
+static bool CompressSegmentation(const CompressSegmentationInput& input,
+                                 const CompressSegmentationMapping& mapping,
+                                 const compress_segmentation::OutputAllocator& get_output,
+                                 size_t num_threads) {
+  auto* data = static_cast<const Label*>(PyArray_DATA(input.array));
+  if (!mapping.keys) {
+    return compress_segmentation::CompressChannels(data, input.input_strides, input.volume_size,
+                                                   input.block_size, get_output, num_threads);
+  }
+  compress_segmentation::LabelMapping<Label> label_mapping;
+  label_mapping.keys = static_cast<const Label*>(PyArray_DATA(mapping.keys));
+  label_mapping.values = static_cast<const Label*>(PyArray_DATA(mapping.values));
+  label_mapping.size = PyArray_SIZE(mapping.keys);
+  return compress_segmentation::CompressChannels(data, input.input_strides, input.volume_size,
+                                                 input.block_size, label_mapping, get_output,
+                                                 num_threads);
+}
+
+static PyObject* compress_segmentation(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* array_argument;
+  Py_ssize_t block_size_arg[3];
+  PyObject* out_argument = nullptr;
+  PyObject* mapping_argument = nullptr;
+  Py_ssize_t num_threads = 1;
+  static const char* kw_list[] = {"data", "block_size", "out", "mapping", "num_threads", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O(nnn)|OOn:compress_segmentation",
+                                   const_cast<char**>(kw_list), &array_argument, block_size_arg,
+                                   block_size_arg + 1, block_size_arg + 2, &out_argument,
+                                   &mapping_argument, &num_threads)) {
+    return nullptr;
+  }
+  if (num_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+    return nullptr;
+  }
+  CompressSegmentationInput input;
+  if (!ConvertCompressSegmentationInput(array_argument, block_size_arg, &input)) {
+    return nullptr;
+  }
+  CompressSegmentationMapping mapping;
+  if (mapping_argument && mapping_argument != Py_None &&
+      !ConvertCompressSegmentationMapping(mapping_argument, PyArray_DESCR(input.array),
+                                          input.elsize, &mapping)) {
+    return nullptr;
+  }
+
+  PyArrayObject* out_array = nullptr;
+  if (out_argument && out_argument != Py_None) {
+    // The limited API does not provide the buffer protocol, so the output
+    // buffer must be wrapped in a numpy array, e.g. with `numpy.frombuffer`.
+    if (!PyArray_Check(out_argument) ||
+        !PyArray_CHKFLAGS(reinterpret_cast<PyArrayObject*>(out_argument),
+                          NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_WRITEABLE)) {
+      PyErr_SetString(PyExc_ValueError, "out must be a writable C-contiguous ndarray");
+      return nullptr;
+    }
+    out_array = reinterpret_cast<PyArrayObject*>(out_argument);
+    if (reinterpret_cast<uintptr_t>(PyArray_DATA(out_array)) % alignof(uint32_t) != 0) {
+      PyErr_SetString(PyExc_ValueError, "out buffer must be 4-byte aligned");
+      return nullptr;
+    }
+  }
+  const bool have_out = (out_array != nullptr);
+  const size_t out_size = have_out ? PyArray_NBYTES(out_array) : 0;
+
+  // Output is written directly into `out_array` if specified, and otherwise
+  // into a newly allocated bytes object of the exact size.
+  PyObject* result_bytes = nullptr;
+  std::vector<uint32_t> unaligned_output;
+  uint32_t* output = nullptr;
+  size_t output_size = 0;
+  bool allocation_failed = false;
+
+  PyThreadState* thread_state = PyEval_SaveThread();
+
+  auto get_output = [&](size_t size) -> uint32_t* {
+    output_size = size;
+    if (have_out) {
+      if (size * sizeof(uint32_t) > out_size) return nullptr;
+      output = static_cast<uint32_t*>(PyArray_DATA(out_array));
+      return output;
+    }
+    PyEval_RestoreThread(thread_state);
+    result_bytes = PyBytes_FromStringAndSize(nullptr, size * sizeof(uint32_t));
+    thread_state = PyEval_SaveThread();
+    if (!result_bytes) {
+      allocation_failed = true;
+      return nullptr;
+    }
+    output = reinterpret_cast<uint32_t*>(PyBytes_AsString(result_bytes));
+    if (reinterpret_cast<uintptr_t>(output) % alignof(uint32_t) != 0) {
+      unaligned_output.resize(size);
+      return unaligned_output.data();
+    }
+    return output;
+  };
+
+  bool success = false;
+  switch (input.elsize) {
+    case 1:
+      success = CompressSegmentation<uint8_t>(input, mapping, get_output, num_threads);
+      break;
+    case 2:
+      success = CompressSegmentation<uint16_t>(input, mapping, get_output, num_threads);
+      break;
+    case 4:
+      success = CompressSegmentation<uint32_t>(input, mapping, get_output, num_threads);
+      break;
+    case 8:
+      success = CompressSegmentation<uint64_t>(input, mapping, get_output, num_threads);
+      break;
+  }
+
+  if (success) {
+    if (!unaligned_output.empty()) {
+      std::memcpy(output, unaligned_output.data(), output_size * sizeof(uint32_t));
+    }
+    // The encoded output is a sequence of 32-bit values.  We need to convert
+    // to little endian.
+    for (size_t i = 0; i < output_size; ++i) {
+      output[i] = htole32(output[i]);
+    }
+  }
+
+  PyEval_RestoreThread(thread_state);
+
+  if (have_out) {
+    if (!success) {
+      PyErr_Format(PyExc_ValueError, "out buffer of %zu bytes is too small, %zu bytes required",
+                   out_size, output_size * sizeof(uint32_t));
+      return nullptr;
+    }
+    return PyLong_FromSize_t(output_size * sizeof(uint32_t));
+  }
+  if (allocation_failed) {
+    return nullptr;
+  }
+  return result_bytes;
+}
+
+static PyObject* get_compressed_segmentation_max_size(PyObject* self, PyObject* args,
+                                                      PyObject* kwds) {
+  PyObject* array_argument;
+  Py_ssize_t block_size_arg[3];
+  static const char* kw_list[] = {"data", "block_size", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O(nnn):get_compressed_segmentation_max_size",
+                                   const_cast<char**>(kw_list), &array_argument, block_size_arg,
+                                   block_size_arg + 1, block_size_arg + 2)) {
+    return nullptr;
+  }
+  CompressSegmentationInput input;
+  if (!ConvertCompressSegmentationInput(array_argument, block_size_arg, &input)) {
+    return nullptr;
+  }
+  size_t max_size = 0;
+  switch (input.elsize) {
+    case 1:
+      max_size = compress_segmentation::GetCompressChannelsMaxSize<uint8_t>(input.volume_size,
+                                                                            input.block_size);
+      break;
+    case 2:
+      max_size = compress_segmentation::GetCompressChannelsMaxSize<uint16_t>(input.volume_size,
+                                                                             input.block_size);
+      break;
+    case 4:
+      max_size = compress_segmentation::GetCompressChannelsMaxSize<uint32_t>(input.volume_size,
+                                                                             input.block_size);
+      break;
+    case 8:
+      max_size = compress_segmentation::GetCompressChannelsMaxSize<uint64_t>(input.volume_size,
+                                                                             input.block_size);
+      break;
+  }
+  return PyLong_FromSize_t(max_size * sizeof(uint32_t));
+}
+
+// Encoded channel and parameters of the compressed_segmentation decoding
+// functions.
+struct DecompressSegmentationInput {
+  // Copy of the input, only if it is not 4-byte aligned.
+  std::vector<uint32_t> aligned_input;
+  const uint32_t* channel_input;
+  size_t channel_input_size;
+  ptrdiff_t volume_size[3];
+  ptrdiff_t block_size[3];
+};
+
+// Converts the output of compress_segmentation `bytes_argument` and the
+// parameters of channel `channel`, and returns false with a Python exception
+// set on failure.
+static bool ConvertDecompressSegmentationInput(PyObject* bytes_argument,
+                                               const Py_ssize_t volume_size_arg[3],
+                                               const Py_ssize_t block_size_arg[3],
+                                               Py_ssize_t channel,
+                                               DecompressSegmentationInput* input) {
+  for (int i = 0; i < 3; ++i) {
+    if (volume_size_arg[i] < 0 || block_size_arg[i] <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+                      "volume_size must be non-negative and block_size must be positive");
+      return false;
+    }
+    input->volume_size[i] = volume_size_arg[i];
+    input->block_size[i] = block_size_arg[i];
+  }
+  char* buffer;
+  Py_ssize_t num_bytes;
+  if (PyBytes_AsStringAndSize(bytes_argument, &buffer, &num_bytes) != 0) {
+    return false;
+  }
+  const size_t input_size = num_bytes / sizeof(uint32_t);
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(buffer);
+  if (reinterpret_cast<uintptr_t>(buffer) % alignof(uint32_t) != 0) {
+    input->aligned_input.resize(input_size);
+    std::memcpy(input->aligned_input.data(), buffer, input_size * sizeof(uint32_t));
+    words = input->aligned_input.data();
+  }
+  // The encoding starts with the offset of each channel.
+  if (channel < 0 || static_cast<size_t>(channel) >= input_size ||
+      words[channel] > input_size) {
+    PyErr_SetString(PyExc_ValueError, "invalid channel");
+    return false;
+  }
+  input->channel_input = words + words[channel];
+  input->channel_input_size = input_size - words[channel];
+  return true;
+}
+
+template <class Label>
+static bool DecompressSegmentation(const DecompressSegmentationInput& input,
+                                   const ptrdiff_t begin[3], const ptrdiff_t end[3],
+                                   const CompressSegmentationMapping& mapping, void* output) {
+  compress_segmentation::LabelMapping<Label> label_mapping;
+  if (mapping.keys) {
+    label_mapping.keys = static_cast<const Label*>(PyArray_DATA(mapping.keys));
+    label_mapping.values = static_cast<const Label*>(PyArray_DATA(mapping.values));
+    label_mapping.size = PyArray_SIZE(mapping.keys);
+  }
+  return compress_segmentation::DecompressSubvolume<Label>(
+      input.channel_input, input.channel_input_size, input.volume_size, input.block_size,
+      begin, end, static_cast<Label*>(output), mapping.keys ? &label_mapping : nullptr);
+}
+
+static PyObject* decompress_segmentation(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* bytes_argument;
+  Py_ssize_t volume_size_arg[3];
+  Py_ssize_t block_size_arg[3];
+  int uint64 = 0;
+  Py_ssize_t begin_arg[3] = {0, 0, 0};
+  Py_ssize_t end_arg[3] = {-1, -1, -1};
+  Py_ssize_t channel = 0;
+  PyObject* mapping_argument = nullptr;
+  static const char* kw_list[] = {"data",  "volume_size", "block_size", "uint64", "begin",
+                                  "end",   "channel",     "mapping",    nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O!(nnn)(nnn)|p(nnn)(nnn)nO:decompress_segmentation",
+          const_cast<char**>(kw_list), &PyBytes_Type, &bytes_argument, volume_size_arg,
+          volume_size_arg + 1, volume_size_arg + 2, block_size_arg, block_size_arg + 1,
+          block_size_arg + 2, &uint64, begin_arg, begin_arg + 1, begin_arg + 2, end_arg,
+          end_arg + 1, end_arg + 2, &channel, &mapping_argument)) {
+    return nullptr;
+  }
+  DecompressSegmentationInput input;
+  if (!ConvertDecompressSegmentationInput(bytes_argument, volume_size_arg, block_size_arg,
+                                          channel, &input)) {
+    return nullptr;
+  }
+  ptrdiff_t begin[3], end[3];
+  for (int i = 0; i < 3; ++i) {
+    begin[i] = begin_arg[i];
+    end[i] = end_arg[i] == -1 ? input.volume_size[i] : end_arg[i];
+    if (begin[i] < 0 || begin[i] > end[i] || end[i] > input.volume_size[i]) {
+      PyErr_SetString(PyExc_ValueError, "invalid subvolume bounds");
+      return nullptr;
+    }
+  }
+  PyArray_Descr* descr = PyArray_DescrFromType(uint64 ? NPY_UINT64 : NPY_UINT32);
+  CompressSegmentationMapping mapping;
+  const bool mapping_ok =
+      !mapping_argument || mapping_argument == Py_None ||
+      ConvertCompressSegmentationMapping(mapping_argument, descr, uint64 ? 8 : 4, &mapping);
+  Py_DECREF(descr);
+  if (!mapping_ok) {
+    return nullptr;
+  }
+  npy_intp dims[3] = {end[2] - begin[2], end[1] - begin[1], end[0] - begin[0]};
+  PyObject* result = PyArray_SimpleNew(3, dims, uint64 ? NPY_UINT64 : NPY_UINT32);
+  if (!result) {
+    return nullptr;
+  }
+  void* output = PyArray_DATA(reinterpret_cast<PyArrayObject*>(result));
+  bool ok;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  if (uint64) {
+    ok = DecompressSegmentation<uint64_t>(input, begin, end, mapping, output);
+  } else {
+    ok = DecompressSegmentation<uint32_t>(input, begin, end, mapping, output);
+  }
+
+  Py_END_ALLOW_THREADS;
+
+  if (!ok) {
+    Py_DECREF(result);
+    PyErr_SetString(PyExc_ValueError, "failed to decode compressed_segmentation data");
+    return nullptr;
+  }
+  return result;
+}
+
+template <class Label>
+static PyObject* GetUniqueValues(const DecompressSegmentationInput& input, int type_num) {
+  std::vector<Label> values;
+  bool ok;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  ok = compress_segmentation::GetUniqueValues<Label>(
+      input.channel_input, input.channel_input_size, input.volume_size, input.block_size,
+      &values);
+
+  Py_END_ALLOW_THREADS;
+
+  if (!ok) {
+    PyErr_SetString(PyExc_ValueError, "failed to decode compressed_segmentation data");
+    return nullptr;
+  }
+  npy_intp size = values.size();
+  PyObject* array = PyArray_SimpleNew(1, &size, type_num);
+  if (array) {
+    std::copy(values.begin(), values.end(),
+              static_cast<Label*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(array))));
+  }
+  return array;
+}
+
+static PyObject* get_compressed_segmentation_unique_values(PyObject* self, PyObject* args,
+                                                           PyObject* kwds) {
+  PyObject* bytes_argument;
+  Py_ssize_t volume_size_arg[3];
+  Py_ssize_t block_size_arg[3];
+  int uint64 = 0;
+  Py_ssize_t channel = 0;
+  static const char* kw_list[] = {"data", "volume_size", "block_size", "uint64", "channel",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(
+          args, kwds, "O!(nnn)(nnn)|pn:get_compressed_segmentation_unique_values",
+          const_cast<char**>(kw_list), &PyBytes_Type, &bytes_argument, volume_size_arg,
+          volume_size_arg + 1, volume_size_arg + 2, block_size_arg, block_size_arg + 1,
+          block_size_arg + 2, &uint64, &channel)) {
+    return nullptr;
+  }
+  DecompressSegmentationInput input;
+  if (!ConvertDecompressSegmentationInput(bytes_argument, volume_size_arg, block_size_arg,
+                                          channel, &input)) {
+    return nullptr;
+  }
+  if (uint64) {
+    return GetUniqueValues<uint64_t>(input, NPY_UINT64);
+  }
+  return GetUniqueValues<uint32_t>(input, NPY_UINT32);
+}
+
+}  // namespace pywrap_compress_segmentation
+
+namespace pywrap_compresso {
+
+static const char* CompressErrorMessage(int err) {
+  switch (err) {
+    case 1:
+      return "each dimension must be between 1 and 65535";
+    case 2:
+      return "steps must be between 1 and 255, with a product of at most 64";
+    case 3:
+      return "connectivity must be 4 or 6, and 4 if random_access_z_index is true";
+    case 4:
+      return "too many distinct boundary windows for the window size; use larger steps";
+    default:
+      return "unsupported data type";
+  }
+}
+
+static PyObject* compresso_compress(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* array_argument;
+  Py_ssize_t steps[3] = {8, 8, 1};
+  int connectivity = 4;
+  int random_access_z_index = 0;
+  static const char* kw_list[] = {"data", "steps", "connectivity", "random_access_z_index",
+                                  nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|(nnn)ip:compresso_compress",
+                                   const_cast<char**>(kw_list), &array_argument, steps,
+                                   steps + 1, steps + 2, &connectivity,
+                                   &random_access_z_index)) {
+    return nullptr;
+  }
+  if (steps[0] <= 0 || steps[1] <= 0 || steps[2] <= 0 || connectivity <= 0) {
+    PyErr_SetString(PyExc_ValueError, "steps and connectivity must be positive");
+    return nullptr;
+  }
+  PyArrayObject* array = reinterpret_cast<PyArrayObject*>(PyArray_CheckFromAny(
+      array_argument, /*dtype=*/nullptr, /*min_depth=*/3, /*max_depth=*/3,
+      /*requirements=*/NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED | NPY_ARRAY_NOTSWAPPED,
+      /*context=*/nullptr));
+  if (!array) {
+    return nullptr;
+  }
+  auto* descr = PyArray_DESCR(array);
+  npy_intp elsize;
+#ifdef NPY_2_0_API_VERSION
+  elsize = PyDataType_ELSIZE(descr);
+#else
+  elsize = descr->elsize;
+#endif
+  if ((descr->kind != 'i' && descr->kind != 'u') ||
+      (elsize != 1 && elsize != 2 && elsize != 4 && elsize != 8)) {
+    Py_DECREF(array);
+    PyErr_SetString(PyExc_ValueError, "ndarray must have 8-, 16-, 32- or 64-bit integer type");
+    return nullptr;
+  }
+
+  // The array is indexed as z, y, x.
+  npy_intp* dims = PyArray_DIMS(array);
+  const void* data = PyArray_DATA(array);
+  std::vector<unsigned char> encoded;
+  int err;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  err = compresso::compress(data, elsize, dims[2], dims[1], dims[0], steps[0], steps[1],
+                            steps[2], connectivity, random_access_z_index != 0, encoded);
+
+  Py_END_ALLOW_THREADS;
+
+  Py_DECREF(array);
+  if (err != 0) {
+    PyErr_SetString(PyExc_ValueError, CompressErrorMessage(err));
+    return nullptr;
+  }
+  return PyBytes_FromStringAndSize(reinterpret_cast<const char*>(encoded.data()),
+                                   encoded.size());
+}
+
+static PyObject* compresso_decompress(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* bytes_argument;
+  Py_ssize_t z_start = 0;
+  Py_ssize_t z_end = -1;
+  Py_ssize_t num_threads = 1;
+  PyObject* mapping_argument = nullptr;
+  static const char* kw_list[] = {"data", "z_start", "z_end", "num_threads", "mapping", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|nnnO:compresso_decompress",
+                                   const_cast<char**>(kw_list), &PyBytes_Type, &bytes_argument,
+                                   &z_start, &z_end, &num_threads, &mapping_argument)) {
+    return nullptr;
+  }
+  if (num_threads < 1) {
+    PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+    return nullptr;
+  }
+  // The mapping is applied as uint64 whatever the label width.
+  pywrap_compress_segmentation::CompressSegmentationMapping mapping;
+  compresso::LabelMapping label_mapping;
+  if (mapping_argument && mapping_argument != Py_None) {
+    PyArray_Descr* descr = PyArray_DescrFromType(NPY_UINT64);
+    const bool ok = pywrap_compress_segmentation::ConvertCompressSegmentationMapping(
+        mapping_argument, descr, 8, &mapping);
+    Py_DECREF(descr);
+    if (!ok) {
+      return nullptr;
+    }
+    label_mapping =
+        compresso::LabelMapping(static_cast<const uint64_t*>(PyArray_DATA(mapping.keys)),
+                                static_cast<const uint64_t*>(PyArray_DATA(mapping.values)),
+                                PyArray_SIZE(mapping.keys));
+  }
+  char* buffer;
+  Py_ssize_t num_bytes;
+  if (PyBytes_AsStringAndSize(bytes_argument, &buffer, &num_bytes) != 0) {
+    return nullptr;
+  }
+  auto* data = reinterpret_cast<unsigned char*>(buffer);
+  if (static_cast<size_t>(num_bytes) < compresso::CompressoHeader::header_size ||
+      !compresso::CompressoHeader::valid_header(data)) {
+    PyErr_SetString(PyExc_ValueError, "invalid compresso header");
+    return nullptr;
+  }
+  const compresso::CompressoHeader header(data);
+  if (z_end == -1) {
+    z_end = header.sz;
+  }
+  if (z_start < 0 || z_start >= z_end || z_end > header.sz) {
+    PyErr_SetString(PyExc_ValueError, "invalid z range");
+    return nullptr;
+  }
+  int type_num;
+  switch (header.data_width) {
+    case 1:
+      type_num = NPY_UINT8;
+      break;
+    case 2:
+      type_num = NPY_UINT16;
+      break;
+    case 4:
+      type_num = NPY_UINT32;
+      break;
+    default:
+      type_num = NPY_UINT64;
+      break;
+  }
+  npy_intp dims[3] = {z_end - z_start, header.sy, header.sx};
+  PyObject* result = PyArray_SimpleNew(3, dims, type_num);
+  if (!result) {
+    return nullptr;
+  }
+  void* output = PyArray_DATA(reinterpret_cast<PyArrayObject*>(result));
+  int err;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  err = compresso::decompress_range<void, void>(data, num_bytes, z_start, z_end, output,
+                                                num_threads, label_mapping);
+
+  Py_END_ALLOW_THREADS;
+
+  if (err != 0) {
+    Py_DECREF(result);
+    PyErr_Format(PyExc_ValueError, "failed to decode compresso stream (error %d)", err);
+    return nullptr;
+  }
+  return result;
+}
+
+// Returns a new 1-d array of `type_num`, with the values of `values` converted to T.
+template <class T>
+static PyObject* NewArrayFromVector(int type_num, const std::vector<uint64_t>& values) {
+  npy_intp size = values.size();
+  PyObject* array = PyArray_SimpleNew(1, &size, type_num);
+  if (array) {
+    std::copy(values.begin(), values.end(),
+              static_cast<T*>(PyArray_DATA(reinterpret_cast<PyArrayObject*>(array))));
+  }
+  return array;
+}
+
+static PyObject* compresso_labels(PyObject* self, PyObject* args, PyObject* kwds) {
+  PyObject* bytes_argument;
+  int counts = 0;
+  static const char* kw_list[] = {"data", "counts", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|p:compresso_labels",
+                                   const_cast<char**>(kw_list), &PyBytes_Type, &bytes_argument,
+                                   &counts)) {
+    return nullptr;
+  }
+  char* buffer;
+  Py_ssize_t num_bytes;
+  if (PyBytes_AsStringAndSize(bytes_argument, &buffer, &num_bytes) != 0) {
+    return nullptr;
+  }
+  auto* data = reinterpret_cast<unsigned char*>(buffer);
+  std::vector<uint64_t> labels, label_counts;
+  int err;
+
+  Py_BEGIN_ALLOW_THREADS;
+
+  err = counts ? compresso::label_counts(data, num_bytes, labels, label_counts)
+               : compresso::labels(data, num_bytes, labels);
+
+  Py_END_ALLOW_THREADS;
+
+  if (err != 0) {
+    PyErr_Format(PyExc_ValueError, "failed to read compresso stream (error %d)", err);
+    return nullptr;
+  }
+  // Labels have the type of the stream.
+  PyObject* labels_array;
+  switch (compresso::CompressoHeader(data).data_width) {
+    case 1:
+      labels_array = NewArrayFromVector<uint8_t>(NPY_UINT8, labels);
+      break;
+    case 2:
+      labels_array = NewArrayFromVector<uint16_t>(NPY_UINT16, labels);
+      break;
+    case 4:
+      labels_array = NewArrayFromVector<uint32_t>(NPY_UINT32, labels);
+      break;
+    default:
+      labels_array = NewArrayFromVector<uint64_t>(NPY_UINT64, labels);
+      break;
+  }
+  if (!labels_array) {
+    return nullptr;
+  }
+  if (!counts) {
+    return labels_array;
+  }
+  PyObject* counts_array = NewArrayFromVector<uint64_t>(NPY_UINT64, label_counts);
+  if (!counts_array) {
+    Py_DECREF(labels_array);
+    return nullptr;
+  }
+  return Py_BuildValue("(NN)", labels_array, counts_array);
+}
+
+static PyObject* compresso_to_compressed_segmentation(PyObject* self, PyObject* args,
+                                                      PyObject* kwds) {
+  PyObject* bytes_argument;
+  Py_ssize_t block_size_arg[3];
+  static const char* kw_list[] = {"data", "block_size", nullptr};
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!(nnn):compresso_to_compressed_segmentation",
+                                   const_cast<char**>(kw_list), &PyBytes_Type, &bytes_argument,
+                                   block_size_arg, block_size_arg + 1, block_size_arg + 2)) {
+    return nullptr;
+  }
+  if (block_size_arg[0] <= 0 || block_size_arg[1] <= 0 || block_size_arg[2] <= 0) {
+    PyErr_SetString(PyExc_ValueError, "block_size must be positive");
+    return nullptr;
+  }
+  const ptrdiff_t block_size[3] = {block_size_arg[0], block_size_arg[1], block_size_arg[2]};
+  char* buffer;
+  Py_ssize_t num_bytes;
+  if (PyBytes_AsStringAndSize(bytes_argument, &buffer, &num_bytes) != 0) {
+    return nullptr;
+  }
+  auto* data = reinterpret_cast<unsigned char*>(buffer);
+
+  // The output is only allocated once all blocks have been encoded, and is
+  // written directly into a bytes object of the exact size.
+  PyObject* result_bytes = nullptr;
+  std::vector<uint32_t> unaligned_output;
+  uint32_t* output = nullptr;
+  size_t output_size = 0;
+  int err;
+
+  PyThreadState* thread_state = PyEval_SaveThread();
+
+  auto get_output = [&](size_t size) -> uint32_t* {
+    PyEval_RestoreThread(thread_state);
+    result_bytes = PyBytes_FromStringAndSize(nullptr, size * sizeof(uint32_t));
+    thread_state = PyEval_SaveThread();
+    if (!result_bytes) return nullptr;
+    output_size = size;
+    output = reinterpret_cast<uint32_t*>(PyBytes_AsString(result_bytes));
+    if (reinterpret_cast<uintptr_t>(output) % alignof(uint32_t) != 0) {
+      unaligned_output.resize(size);
+      return unaligned_output.data();
+    }
+    return output;
+  };
+
+  err = compresso_transcode::CompressoToCompressedSegmentation(data, num_bytes, block_size,
+                                                               get_output);
+  if (err == 0) {
+    if (!unaligned_output.empty()) {
+      std::memcpy(output, unaligned_output.data(), output_size * sizeof(uint32_t));
+    }
+    for (size_t i = 0; i < output_size; ++i) {
+      output[i] = htole32(output[i]);
+    }
+  }
+
+  PyEval_RestoreThread(thread_state);
+
+  if (err == compresso_transcode::kOutputAllocationFailed) {
+    return nullptr;
+  }
+  if (err != 0) {
+    Py_XDECREF(result_bytes);
+    PyErr_Format(PyExc_ValueError, "failed to decode compresso stream (error %d)", err);
+    return nullptr;
+  }
+  return result_bytes;
+}
+
+}  // namespace pywrap_compresso
+
 // The following Python2/3 compatibility code was derived from py3c.
 // Copyright (c) 2015, Red Hat, Inc. and/or its affiliates
 // Licensed under the MIT license.
@@ -193,6 +1100,68 @@ typedef struct PyModuleDef {
 
 MODULE_INIT_FUNC(_neuroglancer) {
   static PyMethodDef module_methods[] = {
+      {"compress_segmentation",
+       reinterpret_cast<PyCFunction>(&pywrap_compress_segmentation::compress_segmentation),
+       METH_VARARGS | METH_KEYWORDS,
+       "Encodes a 3-d (z, y, x) or 4-d (channel, z, y, x) integer array in the "
+       "compressed_segmentation format with the specified (x, y, z) block size.  8-, 16- and "
+       "32-bit values are encoded in the uint32 format, and 64-bit values in the uint64 format.  "
+       "If `out` is specified, the encoding is written to that writable C-contiguous ndarray, "
+       "which must be large enough, and the number of bytes written is returned; otherwise, it "
+       "is returned as bytes.  If `mapping` is specified as a (keys, values) pair of 1-d arrays, "
+       "with keys strictly increasing, each value equal to a key is encoded as the corresponding "
+       "value.  Blocks are encoded using up to num_threads threads."},
+      {"get_compressed_segmentation_max_size",
+       reinterpret_cast<PyCFunction>(
+           &pywrap_compress_segmentation::get_compressed_segmentation_max_size),
+       METH_VARARGS | METH_KEYWORDS,
+       "Returns an upper bound on the size in bytes of the output of compress_segmentation for "
+       "an array of the same shape and data type as `data`, computed without examining its "
+       "values."},
+      {"decompress_segmentation",
+       reinterpret_cast<PyCFunction>(&pywrap_compress_segmentation::decompress_segmentation),
+       METH_VARARGS | METH_KEYWORDS,
+       "Decodes the subvolume [begin, end), by default the whole volume, of one channel of the "
+       "output of compress_segmentation into a 3-d (z, y, x) array.  `volume_size`, "
+       "`block_size`, `begin` and `end` are in (x, y, z) order, and `uint64` selects the uint64 "
+       "format.  Only the blocks, and the rows within them, that intersect the subvolume are "
+       "decoded, so this is also suitable for reading a single voxel or slice.  If `mapping` "
+       "is specified as a (keys, values) pair of 1-d arrays, with keys strictly increasing, "
+       "each label equal to a key is decoded as the corresponding value."},
+      {"get_compressed_segmentation_unique_values",
+       reinterpret_cast<PyCFunction>(
+           &pywrap_compress_segmentation::get_compressed_segmentation_unique_values),
+       METH_VARARGS | METH_KEYWORDS,
+       "Returns the sorted distinct labels of one channel of the output of "
+       "compress_segmentation, read from its value tables without decoding the voxels."},
+      {"compresso_compress",
+       reinterpret_cast<PyCFunction>(&pywrap_compresso::compresso_compress),
+       METH_VARARGS | METH_KEYWORDS,
+       "Encodes a C-contiguous 3-d (z, y, x) integer array in the compresso format, using "
+       "boundary windows of the specified (x, y, z) `steps` and 4- or 6-connected components.  "
+       "If `random_access_z_index` is true, a per-slice index is appended (format version 1) "
+       "so that slices can be decoded independently; this requires 4-connectivity."},
+      {"compresso_decompress",
+       reinterpret_cast<PyCFunction>(&pywrap_compresso::compresso_decompress),
+       METH_VARARGS | METH_KEYWORDS,
+       "Decodes slices [z_start, z_end) of a compresso stream, by default all of them, into a "
+       "3-d (z, y, x) unsigned integer array.  Streams with a z index decode only the requested "
+       "slices.  4-connected streams are decoded using up to num_threads threads.  If `mapping` "
+       "is specified as a (keys, values) pair of 1-d arrays, with keys strictly increasing, "
+       "each label equal to a key is decoded as the corresponding value."},
+      {"compresso_labels", reinterpret_cast<PyCFunction>(&pywrap_compresso::compresso_labels),
+       METH_VARARGS | METH_KEYWORDS,
+       "Returns the sorted distinct labels of a compresso stream, read from its tables without "
+       "decoding it.  If `counts` is true, returns a (labels, counts) pair with the number of "
+       "voxels of each label, which requires decoding, but without allocating the volume."},
+      {"compresso_to_compressed_segmentation",
+       reinterpret_cast<PyCFunction>(&pywrap_compresso::compresso_to_compressed_segmentation),
+       METH_VARARGS | METH_KEYWORDS,
+       "Transcodes a compresso stream into the compressed_segmentation format with the "
+       "specified (x, y, z) block size, returned as bytes.  The result is the same as "
+       "compress_segmentation of the decoded volume, but slices of 4-connected streams are "
+       "decoded and encoded a slab of blocks at a time, without allocating the volume.  "
+       "6-connected streams are decoded in full."},
       {NULL} /* Sentinel */
   };
   static struct PyModuleDef moduledef = {PyModuleDef_HEAD_INIT, "_neuroglancer", /* m_name */
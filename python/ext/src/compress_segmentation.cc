@@ -17,11 +17,17 @@
 #include "compress_segmentation.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
 #include <unordered_map>
 
 namespace neuroglancer {
 namespace compress_segmentation {
 
+namespace {
+
 constexpr size_t kBlockHeaderSize = 2;
 
 void WriteBlockHeader(size_t encoded_value_base_offset,
@@ -32,79 +38,628 @@ void WriteBlockHeader(size_t encoded_value_base_offset,
 }
 
 template <class Label>
-void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
-                 const ptrdiff_t block_size[3], const ptrdiff_t actual_size[3],
-                 size_t base_offset, size_t* encoded_bits_output,
-                 size_t* table_offset_output, EncodedValueCache<Label>* cache,
-                 std::vector<uint32_t>* output_vec) {
-  if (actual_size[0] * actual_size[1] * actual_size[2] == 0) {
-    *encoded_bits_output = 0;
-    *table_offset_output = 0;
-    return;
+constexpr size_t NumWordsPerLabel() {
+  return (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+}
+
+// Maximum number of distinct values in a block for which the distinct values
+// are determined by linear search rather than by a hash table.  This covers
+// all blocks encoded with at most 4 bits, which in typical segmentations is
+// nearly all of them.
+constexpr size_t kMaxSmallTableSize = 16;
+
+// Scratch space for encoding a block, reused across blocks to avoid repeated
+// allocation.
+template <class Label>
+struct BlockEncodingScratch {
+  // Index into `table` for each position of the block (padded to
+  // block_size), with a multiple of 32 elements so that any number of bits
+  // per index fills whole 32-bit words.
+  std::vector<uint32_t> indices;
+
+  // Sorted distinct values of the block.
+  std::vector<Label> table;
+
+  // Only used for blocks with more than kMaxSmallTableSize distinct values.
+  std::unordered_map<Label, uint32_t> value_to_index;
+
+  // Only used when a LabelMapping is specified.
+  std::vector<Label> mapped_table;
+  std::vector<uint32_t> remap;
+};
+
+// Computes `scratch->table` and `scratch->indices` for a block with at most
+// kMaxSmallTableSize distinct values, using a single pass over the input.
+// Returns false, leaving `scratch` in an unspecified state, if the block has
+// more distinct values.
+template <class Label>
+bool ComputeSmallBlockEncoding(const Label* input,
+                               const ptrdiff_t input_strides[3],
+                               const ptrdiff_t block_size[3],
+                               const ptrdiff_t actual_size[3],
+                               BlockEncodingScratch<Label>* scratch) {
+  uint32_t* indices = scratch->indices.data();
+
+  // Distinct values in order of first occurrence.  Each position of the
+  // block is first assigned the index of its value in this array.
+  Label values[kMaxSmallTableSize];
+  values[0] = input[0];
+  size_t num_values = 1;
+  Label previous_value = input[0];
+  uint32_t previous_index = 0;
+  const ptrdiff_t x_stride = input_strides[0];
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      const Label* input_x = input + y * input_strides[1] + z * input_strides[2];
+      uint32_t* output = indices + block_size[0] * (y + block_size[1] * z);
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x, input_x += x_stride) {
+        const Label value = *input_x;
+        // If this value matches the previous value, we can skip the search.
+        if (value != previous_value) {
+          previous_value = value;
+          uint32_t index = 0;
+          while (index < num_values && values[index] != value) ++index;
+          if (index == num_values) {
+            if (num_values == kMaxSmallTableSize) return false;
+            values[num_values++] = value;
+          }
+          previous_index = index;
+        }
+        output[x] = previous_index;
+      }
+    }
   }
 
-  constexpr size_t num_32bit_words_per_label =
-      (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  auto& table = scratch->table;
+  table.assign(values, values + num_values);
+  if (num_values == 1) return true;
 
-  std::unordered_map<Label, uint32_t> seen_values;
-  std::vector<Label> seen_values_inv;
+  // Sort the table, and remap the indices accordingly.  Positions outside of
+  // actual_size are left as 0, i.e. the lowest value.
+  std::sort(table.begin(), table.end());
+  uint32_t remap[kMaxSmallTableSize];
+  for (size_t i = 0; i < num_values; ++i) {
+    remap[i] = static_cast<uint32_t>(
+        std::lower_bound(table.begin(), table.end(), values[i]) - table.begin());
+  }
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      uint32_t* output = indices + block_size[0] * (y + block_size[1] * z);
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x) {
+        output[x] = remap[output[x]];
+      }
+    }
+  }
+  return true;
+}
 
-  // First determine the distinct values.
+// Same as ComputeSmallBlockEncoding, but supports any number of distinct
+// values.
+template <class Label>
+void ComputeLargeBlockEncoding(const Label* input,
+                               const ptrdiff_t input_strides[3],
+                               const ptrdiff_t block_size[3],
+                               const ptrdiff_t actual_size[3],
+                               BlockEncodingScratch<Label>* scratch) {
+  auto& value_to_index = scratch->value_to_index;
+  auto& table = scratch->table;
+  value_to_index.clear();
+  table.clear();
 
   // Initialize previous_value such that it is guaranteed not to equal to the
   // first value.
   Label previous_value = input[0] + 1;
-  {
-    auto* input_z = input;
-    for (size_t z = 0; z < actual_size[2]; ++z) {
-      auto* input_y = input_z;
-      for (size_t y = 0; y < actual_size[1]; ++y) {
-        auto* input_x = input_y;
-        for (size_t x = 0; x < actual_size[0]; ++x) {
-          auto value = *input_x;
-          // If this value matches the previous value, we can skip the more
-          // expensive hash table lookup.
-          if (value != previous_value) {
-            previous_value = value;
-            if (seen_values.emplace(value, 0).second) {
-              seen_values_inv.push_back(value);
-            }
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      const Label* input_x = input + y * input_strides[1] + z * input_strides[2];
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x, input_x += input_strides[0]) {
+        const Label value = *input_x;
+        // If this value matches the previous value, we can skip the more
+        // expensive hash table lookup.
+        if (value != previous_value) {
+          previous_value = value;
+          if (value_to_index.emplace(value, 0).second) {
+            table.push_back(value);
           }
+        }
+      }
+    }
+  }
 
-          input_x += input_strides[0];
+  std::sort(table.begin(), table.end());
+  for (size_t i = 0; i < table.size(); ++i) {
+    value_to_index[table[i]] = static_cast<uint32_t>(i);
+  }
+
+  previous_value = input[0] + 1;
+  uint32_t previous_index = 0;
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      const Label* input_x = input + y * input_strides[1] + z * input_strides[2];
+      uint32_t* output =
+          scratch->indices.data() + block_size[0] * (y + block_size[1] * z);
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x, input_x += input_strides[0]) {
+        const Label value = *input_x;
+        if (value != previous_value) {
+          previous_value = value;
+          previous_index = value_to_index.at(value);
         }
-        input_y += input_strides[1];
+        output[x] = previous_index;
+      }
+    }
+  }
+}
+
+// Maps the table computed by ComputeSmallBlockEncoding or
+// ComputeLargeBlockEncoding through `mapping`.  Since distinct values may map
+// to the same value, the mapped table is deduplicated and sorted again, and
+// the indices are remapped accordingly.  The result is the same as if the
+// mapping had been applied to the input.
+template <class Label>
+void ApplyLabelMapping(const LabelMapping<Label>& mapping,
+                       const ptrdiff_t block_size[3],
+                       const ptrdiff_t actual_size[3],
+                       BlockEncodingScratch<Label>* scratch) {
+  auto& table = scratch->table;
+  auto& mapped_table = scratch->mapped_table;
+  const Label* keys_end = mapping.keys + mapping.size;
+  bool changed = false;
+  mapped_table.resize(table.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    const Label value = table[i];
+    const Label* it = std::lower_bound(mapping.keys, keys_end, value);
+    if (it != keys_end && *it == value) {
+      mapped_table[i] = mapping.values[it - mapping.keys];
+      changed = changed || mapped_table[i] != value;
+    } else {
+      mapped_table[i] = value;
+    }
+  }
+  if (!changed) return;
+
+  if (std::adjacent_find(mapped_table.begin(), mapped_table.end(),
+                         std::greater_equal<Label>()) == mapped_table.end()) {
+    // The mapping preserved the order of the table, so the indices are
+    // unchanged.
+    table.swap(mapped_table);
+    return;
+  }
+
+  auto& remap = scratch->remap;
+  table.assign(mapped_table.begin(), mapped_table.end());
+  std::sort(table.begin(), table.end());
+  table.erase(std::unique(table.begin(), table.end()), table.end());
+  remap.resize(mapped_table.size());
+  for (size_t i = 0; i < mapped_table.size(); ++i) {
+    remap[i] = static_cast<uint32_t>(
+        std::lower_bound(table.begin(), table.end(), mapped_table[i]) -
+        table.begin());
+  }
+  // Positions outside of actual_size are left as 0, i.e. the lowest value.
+  for (ptrdiff_t z = 0; z < actual_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < actual_size[1]; ++y) {
+      uint32_t* output =
+          scratch->indices.data() + block_size[0] * (y + block_size[1] * z);
+      for (ptrdiff_t x = 0; x < actual_size[0]; ++x) {
+        output[x] = remap[output[x]];
       }
-      input_z += input_strides[2];
     }
   }
+}
 
-  std::sort(seen_values_inv.begin(), seen_values_inv.end());
-  for (size_t i = 0; i < seen_values_inv.size(); ++i) {
-    seen_values[seen_values_inv[i]] = static_cast<uint32_t>(i);
+// Determines the sorted distinct values of a block, after applying `mapping`
+// if it is not null, which form its value table, and the index of each value
+// of the block within the table.  Returns the number of bits needed to encode
+// an index.
+template <class Label>
+size_t ComputeBlockEncoding(const Label* input,
+                            const ptrdiff_t input_strides[3],
+                            const ptrdiff_t block_size[3],
+                            const ptrdiff_t actual_size[3],
+                            const LabelMapping<Label>* mapping,
+                            BlockEncodingScratch<Label>* scratch) {
+  scratch->indices.assign(
+      (block_size[0] * block_size[1] * block_size[2] + 31) / 32 * 32, 0);
+  if (!ComputeSmallBlockEncoding(input, input_strides, block_size, actual_size,
+                                 scratch)) {
+    ComputeLargeBlockEncoding(input, input_strides, block_size, actual_size,
+                              scratch);
+  }
+  if (mapping && mapping->size != 0) {
+    ApplyLabelMapping(*mapping, block_size, actual_size, scratch);
   }
 
   // Determine number of bits with which to encode each index.
+  const size_t table_size = scratch->table.size();
   size_t encoded_bits = 0;
-  if (seen_values.size() != 1) {
+  if (table_size != 1) {
     encoded_bits = 1;
-    while ((1 << encoded_bits) < seen_values.size()) {
+    while ((size_t(1) << encoded_bits) < table_size) {
       encoded_bits *= 2;
     }
   }
+  return encoded_bits;
+}
+
+size_t GetEncodedValueSize(size_t encoded_bits, const ptrdiff_t block_size[3]) {
+  return (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) /
+         32;
+}
+
+// Packs the indices computed by ComputeBlockEncoding into `output`, which must
+// have GetEncodedValueSize(encoded_bits, block_size) elements.
+template <class Label>
+void WriteEncodedValues(const BlockEncodingScratch<Label>& scratch,
+                        const ptrdiff_t block_size[3], size_t encoded_bits,
+                        uint32_t* output) {
+  if (encoded_bits == 0) return;
+  const size_t indices_per_word = 32 / encoded_bits;
+  const size_t num_words = GetEncodedValueSize(encoded_bits, block_size);
+  const uint32_t* indices = scratch.indices.data();
+  for (size_t word_i = 0; word_i < num_words; ++word_i) {
+    uint32_t word = 0;
+    for (size_t i = 0; i < indices_per_word; ++i) {
+      word |= indices[i] << (i * encoded_bits);
+    }
+    output[word_i] = word;
+    indices += indices_per_word;
+  }
+}
+
+template <class Label>
+void WriteTable(const Label* table, size_t table_size, uint32_t* output) {
+  for (size_t i = 0; i < table_size; ++i) {
+    const Label value = table[i];
+    for (size_t word_i = 0; word_i < NumWordsPerLabel<Label>(); ++word_i) {
+      output[word_i] = static_cast<uint32_t>(value >> (32 * word_i));
+    }
+    output += NumWordsPerLabel<Label>();
+  }
+}
+
+// Set of distinct value tables, each associated with a uint32 value.
+//
+// This serves the same purpose as EncodedValueCache, but avoids allocating a
+// separate vector per table: the tables are stored contiguously in a single
+// arena, and are looked up by a 64-bit hash and length in an open-addressing
+// index, with memcmp used only to confirm a match.  The hash of each table is
+// retained so that it can be reused when inserting into another cache.
+template <class Label>
+class ValueTableCache {
+ public:
+  static uint64_t Hash(const Label* table, size_t table_size) {
+    uint64_t h = table_size * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < table_size; ++i) {
+      h = (h ^ static_cast<uint64_t>(table[i])) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+    }
+    // splitmix64 finalizer.
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+  }
+
+  // Inserts the table with the specified `hash` (as computed by `Hash`) and
+  // associated `value`, unless an equal table is already present.  Returns
+  // the value associated with the table, and whether it was inserted.
+  std::pair<uint32_t, bool> Insert(const Label* table, size_t table_size,
+                                   uint64_t hash, uint32_t value) {
+    if (2 * (entries_.size() + 1) > slots_.size()) {
+      Grow();
+    }
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot_i = hash & mask;; slot_i = (slot_i + 1) & mask) {
+      const uint32_t slot = slots_[slot_i];
+      if (slot == 0) {
+        slots_[slot_i] = static_cast<uint32_t>(entries_.size() + 1);
+        entries_.push_back(
+            {hash, arena_.size(), static_cast<uint32_t>(table_size), value});
+        arena_.insert(arena_.end(), table, table + table_size);
+        return {value, true};
+      }
+      auto const& entry = entries_[slot - 1];
+      if (entry.hash == hash && entry.size == table_size &&
+          std::memcmp(arena_.data() + entry.offset, table,
+                      table_size * sizeof(Label)) == 0) {
+        return {entry.value, false};
+      }
+    }
+  }
+
+  // Accessors for the tables, in order of insertion.
+  size_t size() const { return entries_.size(); }
+  const Label* table(size_t i) const {
+    return arena_.data() + entries_[i].offset;
+  }
+  size_t table_size(size_t i) const { return entries_[i].size; }
+  uint64_t hash(size_t i) const { return entries_[i].hash; }
+  uint32_t value(size_t i) const { return entries_[i].value; }
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    size_t offset;
+    uint32_t size;
+    uint32_t value;
+  };
+
+  void Grow() {
+    const size_t new_size = slots_.empty() ? 16 : 2 * slots_.size();
+    slots_.assign(new_size, 0);
+    const size_t mask = new_size - 1;
+    for (size_t entry_i = 0; entry_i < entries_.size(); ++entry_i) {
+      size_t slot_i = entries_[entry_i].hash & mask;
+      while (slots_[slot_i] != 0) slot_i = (slot_i + 1) & mask;
+      slots_[slot_i] = static_cast<uint32_t>(entry_i + 1);
+    }
+  }
+
+  std::vector<Label> arena_;
+  std::vector<Entry> entries_;
+  // 1 + index into `entries_`, or 0 if the slot is empty.
+  std::vector<uint32_t> slots_;
+};
+
+// Encoding of a row of blocks along the x dimension, computed independently
+// of all other rows.  Value tables are deduplicated within the row only;
+// deduplication across rows is done by `AssignBlockRowOffsets`, which must
+// visit the rows in order to produce the same output as a serial encoder.
+template <class Label>
+struct EncodedBlockRow {
+  // Concatenated encoded values of all blocks in the row.
+  std::vector<uint32_t> encoded_values;
+
+  // Per-block encoding bits, offset into `encoded_values` (with a final
+  // sentinel entry), and index of the table in `tables`.
+  std::vector<uint32_t> encoded_bits;
+  std::vector<size_t> encoded_value_offsets;
+  std::vector<uint32_t> table_indices;
+
+  // Distinct value tables in order of first use within the row, each
+  // associated with its index.
+  ValueTableCache<Label> tables;
+
+  // Computed by AssignBlockRowOffsets: the block headers of the row, and the
+  // output offset of each table first written by this row (or 0 if it was
+  // written by a previous row).
+  std::vector<uint32_t> block_headers;
+  std::vector<size_t> table_output_offsets;
+};
+
+template <class Label>
+void EncodeBlockRow(const Label* input, const ptrdiff_t input_strides[3],
+                    const ptrdiff_t volume_size[3],
+                    const ptrdiff_t block_size[3],
+                    const ptrdiff_t grid_size[3], ptrdiff_t block_y,
+                    ptrdiff_t block_z, const LabelMapping<Label>* mapping,
+                    EncodedBlockRow<Label>* row) {
+  BlockEncodingScratch<Label> scratch;
+  row->encoded_value_offsets.push_back(0);
+  for (ptrdiff_t block_x = 0; block_x < grid_size[0]; ++block_x) {
+    const ptrdiff_t block[3] = {block_x, block_y, block_z};
+    ptrdiff_t actual_size[3];
+    ptrdiff_t input_offset = 0;
+    for (size_t i = 0; i < 3; ++i) {
+      auto pos = block[i] * block_size[i];
+      actual_size[i] = std::min(block_size[i], volume_size[i] - pos);
+      input_offset += pos * input_strides[i];
+    }
+    const size_t encoded_bits =
+        ComputeBlockEncoding(input + input_offset, input_strides, block_size,
+                             actual_size, mapping, &scratch);
+    const size_t encoded_value_offset = row->encoded_values.size();
+    row->encoded_values.resize(encoded_value_offset +
+                               GetEncodedValueSize(encoded_bits, block_size));
+    WriteEncodedValues(scratch, block_size, encoded_bits,
+                       row->encoded_values.data() + encoded_value_offset);
+    row->encoded_bits.push_back(encoded_bits);
+    row->encoded_value_offsets.push_back(row->encoded_values.size());
+    auto const& table = scratch.table;
+    const auto hash =
+        ValueTableCache<Label>::Hash(table.data(), table.size());
+    row->table_indices.push_back(
+        row->tables
+            .Insert(table.data(), table.size(), hash,
+                    static_cast<uint32_t>(row->tables.size()))
+            .first);
+  }
+}
+
+// Assigns output offsets to the encoded values and tables of `row`, given the
+// current output size `*offset` (relative to the start of the channel), and
+// advances `*offset` past them.  `cache` holds the tables written by previous
+// rows of the same channel.
+template <class Label>
+void AssignBlockRowOffsets(EncodedBlockRow<Label>* row, size_t* offset,
+                           ValueTableCache<Label>* cache) {
+  const size_t num_blocks = row->encoded_bits.size();
+  const size_t num_tables = row->tables.size();
+  std::vector<size_t> table_offsets(num_tables, 0);
+  std::vector<bool> table_assigned(num_tables, false);
+  row->table_output_offsets.assign(num_tables, 0);
+  row->block_headers.resize(num_blocks * kBlockHeaderSize);
+  for (size_t block_i = 0; block_i < num_blocks; ++block_i) {
+    const size_t encoded_value_base_offset = *offset;
+    *offset += row->encoded_value_offsets[block_i + 1] -
+               row->encoded_value_offsets[block_i];
+    const uint32_t table_i = row->table_indices[block_i];
+    if (!table_assigned[table_i]) {
+      table_assigned[table_i] = true;
+      auto const& tables = row->tables;
+      auto result = cache->Insert(tables.table(table_i),
+                                  tables.table_size(table_i),
+                                  tables.hash(table_i), *offset);
+      if (result.second) {
+        row->table_output_offsets[table_i] = *offset;
+        *offset += tables.table_size(table_i) * NumWordsPerLabel<Label>();
+      }
+      table_offsets[table_i] = result.first;
+    }
+    WriteBlockHeader(encoded_value_base_offset, table_offsets[table_i],
+                     row->encoded_bits[block_i],
+                     &row->block_headers[block_i * kBlockHeaderSize]);
+  }
+}
+
+// Copies the encoded representation of `row` into the encoding of a channel
+// starting at `output`.
+template <class Label>
+void WriteBlockRow(const EncodedBlockRow<Label>& row, size_t row_index,
+                   size_t blocks_per_row, uint32_t* output) {
+  std::copy(row.block_headers.begin(), row.block_headers.end(),
+            output + row_index * blocks_per_row * kBlockHeaderSize);
+  for (size_t block_i = 0; block_i < blocks_per_row; ++block_i) {
+    std::copy(row.encoded_values.begin() + row.encoded_value_offsets[block_i],
+              row.encoded_values.begin() + row.encoded_value_offsets[block_i + 1],
+              output + row.block_headers[block_i * kBlockHeaderSize + 1]);
+  }
+  for (size_t table_i = 0; table_i < row.tables.size(); ++table_i) {
+    if (row.table_output_offsets[table_i] != 0) {
+      WriteTable(row.tables.table(table_i), row.tables.table_size(table_i),
+                 output + row.table_output_offsets[table_i]);
+    }
+  }
+}
+
+// Calls `fn(i)` for each i in [0, num_tasks), on up to `num_threads` threads
+// including the calling thread.  Tasks are handed out one at a time, since
+// their cost depends on the content of the blocks.
+template <class F>
+void RunParallel(size_t num_tasks, size_t num_threads, const F& fn) {
+  num_threads = std::min(num_threads, num_tasks);
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < num_tasks; ++i) fn(i);
+    return;
+  }
+  std::atomic<size_t> next_task(0);
+  auto run_tasks = [&] {
+    for (size_t i = next_task++; i < num_tasks; i = next_task++) fn(i);
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(run_tasks);
+  run_tasks();
+  for (auto& thread : threads) thread.join();
+}
+
+// Assigns output offsets to the encoded rows of blocks of `num_channels`
+// channels of `rows_per_channel` rows each, and copies them into the
+// buffer returned by `get_output`, starting at offset `base_offset`.  If
+// `write_channel_offsets` is true, the offset of each channel is stored at the
+// start of the buffer.  Returns false if `get_output` returns null.
+//
+// Offsets are assigned serially in the same order as a serial encoder, and
+// the rows are then copied into the output on up to `num_threads` threads.
+// The result is therefore identical to that of a serial encoder.
+template <class Label>
+bool WriteChannels(std::vector<EncodedBlockRow<Label>>* encoded_rows,
+                   size_t num_channels, size_t rows_per_channel,
+                   size_t blocks_per_row, size_t base_offset,
+                   bool write_channel_offsets, size_t num_threads,
+                   const OutputAllocator& get_output) {
+  auto& rows = *encoded_rows;
+  const size_t block_index_size =
+      kBlockHeaderSize * blocks_per_row * rows_per_channel;
+  std::vector<size_t> channel_base_offsets(num_channels);
+  size_t total_size = base_offset;
+  for (size_t channel_i = 0; channel_i < num_channels; ++channel_i) {
+    channel_base_offsets[channel_i] = total_size;
+    ValueTableCache<Label> cache;
+    size_t offset = block_index_size;
+    for (size_t channel_row_i = 0; channel_row_i < rows_per_channel;
+         ++channel_row_i) {
+      AssignBlockRowOffsets(&rows[channel_i * rows_per_channel + channel_row_i],
+                            &offset, &cache);
+    }
+    total_size += offset;
+  }
+
+  uint32_t* output_data = get_output(total_size);
+  if (!output_data) return false;
+  if (write_channel_offsets) {
+    std::copy(channel_base_offsets.begin(), channel_base_offsets.end(),
+              output_data);
+  }
+
+  RunParallel(rows.size(), num_threads, [&](size_t row_i) {
+    const size_t channel_i = row_i / rows_per_channel;
+    WriteBlockRow(rows[row_i], row_i % rows_per_channel, blocks_per_row,
+                  output_data + channel_base_offsets[channel_i]);
+    // Release memory as soon as possible.
+    std::vector<uint32_t>().swap(rows[row_i].encoded_values);
+  });
+  return true;
+}
+
+// Encodes `num_channels` channels, one after another, starting at offset
+// `base_offset` of the buffer returned by `get_output`.  If
+// `write_channel_offsets` is true, the offset of each channel is stored at the
+// start of the buffer.  If `mapping` is not null, it is applied to the input.
+// Returns false if `get_output` returns null.
+//
+// Rows of blocks of all channels are encoded on up to `num_threads` threads
+// into separate buffers, and then written by WriteChannels.  Since all rows
+// are buffered before the output is allocated at its exact size, peak memory
+// is about twice the size of the output; the std::vector overloads of
+// CompressChannel and CompressChannels instead append to the output directly.
+template <class Label>
+bool CompressChannelsImpl(const Label* input, const ptrdiff_t input_strides[4],
+                          const ptrdiff_t volume_size[3], size_t num_channels,
+                          const ptrdiff_t block_size[3], size_t base_offset,
+                          bool write_channel_offsets,
+                          const LabelMapping<Label>* mapping,
+                          size_t num_threads,
+                          const OutputAllocator& get_output) {
+  ptrdiff_t grid_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  const size_t rows_per_channel = grid_size[1] * grid_size[2];
+  std::vector<EncodedBlockRow<Label>> rows(num_channels * rows_per_channel);
+  RunParallel(rows.size(), num_threads, [&](size_t row_i) {
+    const size_t channel_i = row_i / rows_per_channel;
+    const size_t channel_row_i = row_i % rows_per_channel;
+    EncodeBlockRow(input + input_strides[3] * channel_i, input_strides,
+                   volume_size, block_size, grid_size,
+                   channel_row_i % grid_size[1], channel_row_i / grid_size[1],
+                   mapping, &rows[row_i]);
+  });
+  return WriteChannels(&rows, num_channels, rows_per_channel, grid_size[0],
+                       base_offset, write_channel_offsets, num_threads,
+                       get_output);
+}
+
+}  // namespace
+
+template <class Label>
+void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
+                 const ptrdiff_t block_size[3], const ptrdiff_t actual_size[3],
+                 size_t base_offset, size_t* encoded_bits_output,
+                 size_t* table_offset_output, EncodedValueCache<Label>* cache,
+                 std::vector<uint32_t>* output_vec) {
+  if (actual_size[0] * actual_size[1] * actual_size[2] == 0) {
+    *encoded_bits_output = 0;
+    *table_offset_output = 0;
+    return;
+  }
+
+  BlockEncodingScratch<Label> scratch;
+  const size_t encoded_bits =
+      ComputeBlockEncoding<Label>(input, input_strides, block_size, actual_size,
+                                  /*mapping=*/nullptr, &scratch);
+  auto const& table = scratch.table;
   *encoded_bits_output = encoded_bits;
   const size_t encoded_size_32bits =
-      (encoded_bits * block_size[0] * block_size[1] * block_size[2] + 31) / 32;
+      GetEncodedValueSize(encoded_bits, block_size);
 
   const size_t encoded_value_base_offset = output_vec->size();
   size_t elements_to_write = encoded_size_32bits;
 
   bool write_table;
   {
-    auto it = cache->find(seen_values_inv);
+    auto it = cache->find(table);
     if (it == cache->end()) {
       write_table = true;
-      elements_to_write += seen_values.size() * num_32bit_words_per_label;
+      elements_to_write += table.size() * NumWordsPerLabel<Label>();
       *table_offset_output =
           encoded_value_base_offset + encoded_size_32bits - base_offset;
     } else {
@@ -116,38 +671,12 @@ void EncodeBlock(const Label* input, const ptrdiff_t input_strides[3],
   output_vec->resize(encoded_value_base_offset + elements_to_write);
   uint32_t* output = output_vec->data() + encoded_value_base_offset;
   // Write encoded representation.
-  {
-    auto* input_z = input;
-    for (size_t z = 0; z < actual_size[2]; ++z) {
-      auto* input_y = input_z;
-      for (size_t y = 0; y < actual_size[1]; ++y) {
-        auto* input_x = input_y;
-        for (size_t x = 0; x < actual_size[0]; ++x) {
-          auto value = *input_x;
-          uint32_t index = seen_values.at(value);
-          size_t output_offset = x + block_size[0] * (y + block_size[1] * z);
-          output[output_offset * encoded_bits / 32] |=
-              (index << (output_offset * encoded_bits % 32));
-
-          input_x += input_strides[0];
-        }
-        input_y += input_strides[1];
-      }
-      input_z += input_strides[2];
-    }
-  }
+  WriteEncodedValues(scratch, block_size, encoded_bits, output);
 
   // Write table
   if (write_table) {
-    output =
-        output_vec->data() + encoded_value_base_offset + encoded_size_32bits;
-    for (auto value : seen_values_inv) {
-      for (int word_i = 0; word_i < num_32bit_words_per_label; ++word_i) {
-        output[word_i] = static_cast<uint32_t>(value >> (32 * word_i));
-      }
-      output += num_32bit_words_per_label;
-    }
-    cache->emplace(seen_values_inv, *table_offset_output);
+    WriteTable(table.data(), table.size(), output + encoded_size_32bits);
+    cache->emplace(table, *table_offset_output);
   }
 }
 
@@ -173,12 +702,10 @@ void CompressChannel(const Label* input, const ptrdiff_t input_strides[3],
             block[0] + grid_size[0] * (block[1] + grid_size[1] * block[2]);
         ptrdiff_t actual_size[3];
         ptrdiff_t input_offset = 0;
-        size_t num_values = 1;
         for (size_t i = 0; i < 3; ++i) {
           auto pos = block[i] * block_size[i];
           actual_size[i] = std::min(block_size[i], volume_size[i] - pos);
           input_offset += pos * input_strides[i];
-          num_values *= actual_size[i];
         }
         const size_t encoded_value_base_offset = output->size() - base_offset;
         size_t encoded_bits, table_offset;
@@ -199,13 +726,111 @@ void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
                       const ptrdiff_t block_size[3],
                       std::vector<uint32_t>* output) {
   output->resize(volume_size[3]);
-  for (size_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
     (*output)[channel_i] = output->size();
     CompressChannel(input + input_strides[3] * channel_i, input_strides,
                     volume_size, block_size, output);
   }
 }
 
+template <class Label>
+bool CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
+                      const ptrdiff_t volume_size[4],
+                      const ptrdiff_t block_size[3],
+                      const OutputAllocator& get_output, size_t num_threads) {
+  const size_t num_channels = volume_size[3];
+  return CompressChannelsImpl<Label>(
+      input, input_strides, volume_size, num_channels, block_size,
+      /*base_offset=*/num_channels, /*write_channel_offsets=*/true,
+      /*mapping=*/nullptr, num_threads, get_output);
+}
+
+template <class Label>
+bool CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
+                      const ptrdiff_t volume_size[4],
+                      const ptrdiff_t block_size[3],
+                      const LabelMapping<Label>& mapping,
+                      const OutputAllocator& get_output, size_t num_threads) {
+  const size_t num_channels = volume_size[3];
+  return CompressChannelsImpl(input, input_strides, volume_size, num_channels,
+                              block_size, /*base_offset=*/num_channels,
+                              /*write_channel_offsets=*/true, &mapping,
+                              num_threads, get_output);
+}
+
+template <class Label>
+bool CompressChannelSlabs(const ptrdiff_t volume_size[3],
+                          const ptrdiff_t block_size[3],
+                          const SlabReader<Label>& get_slab,
+                          const OutputAllocator& get_output,
+                          size_t num_threads) {
+  ptrdiff_t grid_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  const ptrdiff_t slab_strides[3] = {1, volume_size[0],
+                                     volume_size[0] * volume_size[1]};
+  std::vector<EncodedBlockRow<Label>> rows(grid_size[1] * grid_size[2]);
+  for (ptrdiff_t block_z = 0; block_z < grid_size[2]; ++block_z) {
+    const ptrdiff_t z_begin = block_z * block_size[2];
+    const ptrdiff_t z_end = std::min(z_begin + block_size[2], volume_size[2]);
+    const Label* slab = get_slab(z_begin, z_end);
+    if (!slab) return false;
+    // The slab is encoded as a volume of a single row of blocks in z.
+    const ptrdiff_t slab_size[3] = {volume_size[0], volume_size[1],
+                                    z_end - z_begin};
+    RunParallel(grid_size[1], num_threads, [&](size_t block_y) {
+      EncodeBlockRow<Label>(slab, slab_strides, slab_size, block_size,
+                            grid_size, block_y, /*block_z=*/0,
+                            /*mapping=*/nullptr,
+                            &rows[block_z * grid_size[1] + block_y]);
+    });
+  }
+  return WriteChannels(&rows, /*num_channels=*/1, rows.size(), grid_size[0],
+                       /*base_offset=*/1, /*write_channel_offsets=*/true,
+                       num_threads, get_output);
+}
+
+template <class Label>
+size_t GetCompressChannelsMaxSize(const ptrdiff_t volume_size[4],
+                                  const ptrdiff_t block_size[3]) {
+  // Number of distinct values of Label, or 0 if it is too large to matter.
+  const size_t num_labels =
+      sizeof(Label) < sizeof(uint32_t) ? size_t(1) << (8 * sizeof(Label)) : 0;
+  const size_t block_volume = block_size[0] * block_size[1] * block_size[2];
+  ptrdiff_t grid_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  size_t channel_size = 0;
+  ptrdiff_t block[3];
+  for (block[2] = 0; block[2] < grid_size[2]; ++block[2]) {
+    for (block[1] = 0; block[1] < grid_size[1]; ++block[1]) {
+      for (block[0] = 0; block[0] < grid_size[0]; ++block[0]) {
+        size_t max_distinct_values = 1;
+        for (size_t i = 0; i < 3; ++i) {
+          max_distinct_values *= std::min(
+              block_size[i], volume_size[i] - block[i] * block_size[i]);
+        }
+        if (num_labels) {
+          max_distinct_values = std::min(max_distinct_values, num_labels);
+        }
+        size_t encoded_bits = 0;
+        if (max_distinct_values > 1) {
+          encoded_bits = 1;
+          while ((size_t(1) << encoded_bits) < max_distinct_values) {
+            encoded_bits *= 2;
+          }
+        }
+        channel_size += kBlockHeaderSize +
+                        (encoded_bits * block_volume + 31) / 32 +
+                        max_distinct_values * NumWordsPerLabel<Label>();
+      }
+    }
+  }
+  return volume_size[3] * (1 + channel_size);
+}
+
 #define DO_INSTANTIATE(Label)                                        \
   template void EncodeBlock<Label>(                                  \
       const Label* input, const ptrdiff_t input_strides[3],          \
@@ -221,8 +846,25 @@ void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
       const Label* input, const ptrdiff_t input_strides[4],          \
       const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
       std::vector<uint32_t>* output);                                \
+  template bool CompressChannels<Label>(                             \
+      const Label* input, const ptrdiff_t input_strides[4],          \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      const OutputAllocator& get_output, size_t num_threads);        \
+  template bool CompressChannels<Label>(                             \
+      const Label* input, const ptrdiff_t input_strides[4],          \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3], \
+      const LabelMapping<Label>& mapping,                            \
+      const OutputAllocator& get_output, size_t num_threads);        \
+  template bool CompressChannelSlabs<Label>(                        \
+      const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3], \
+      const SlabReader<Label>& get_slab,                             \
+      const OutputAllocator& get_output, size_t num_threads);        \
+  template size_t GetCompressChannelsMaxSize<Label>(                 \
+      const ptrdiff_t volume_size[4], const ptrdiff_t block_size[3]); \
 /**/
 
+DO_INSTANTIATE(uint8_t)
+DO_INSTANTIATE(uint16_t)
 DO_INSTANTIATE(uint32_t)
 DO_INSTANTIATE(uint64_t)
 
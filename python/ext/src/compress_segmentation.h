@@ -17,7 +17,9 @@
 // Implements encoding into the compressed segmentation format described at
 // https://github.com/google/neuroglancer/tree/master/src/sliceview/compressed_segmentation.
 //
-// Only uint32 and uint64 volumes are supported.
+// uint8, uint16, uint32 and uint64 volumes are supported.  uint8 and uint16
+// values are widened to 32 bits in the value table, so that the output is in
+// the standard uint32 format.
 
 // Compress a 3-D label array by splitting in a grid of fixed-size blocks, and
 // encoding each block using a per-block table of label values.  The number of
@@ -65,6 +67,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "decompress_segmentation.h"
+
 namespace neuroglancer {
 namespace compress_segmentation {
 
@@ -167,6 +171,71 @@ void CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
                       const ptrdiff_t block_size[3],
                       std::vector<uint32_t>* output);
 
+// Called with the exact size of the encoded output, in 32-bit units.  Must
+// return a buffer of at least that size, or null to abort encoding.  The
+// buffer need not be initialized.
+using OutputAllocator = std::function<uint32_t*(size_t size)>;
+
+// Same as above, but encodes directly into a buffer obtained from
+// `get_output`, which is called exactly once, from the calling thread, after
+// the size of the output is known but before any output is written.  This
+// avoids copying the output when it must end up in a buffer not owned by a
+// std::vector, such as a Python bytes object.
+//
+// Rows of blocks are encoded on up to `num_threads` threads, including the
+// calling thread, and the output is the same for any number of threads.  The
+// encoded rows are buffered until the output is allocated, so peak memory is
+// about twice the size of the output.
+//
+// Returns false if `get_output` returned null.
+template <class Label>
+bool CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
+                      const ptrdiff_t volume_size[4],
+                      const ptrdiff_t block_size[3],
+                      const OutputAllocator& get_output,
+                      size_t num_threads = 1);
+
+// Same as above, but encodes the result of mapping each value of `input`
+// through `mapping`.  The mapping is applied only to the value table of each
+// block, rather than to each position, so this is nearly as fast as encoding
+// without a mapping, and avoids a separate pass and a temporary copy of the
+// volume.
+template <class Label>
+bool CompressChannels(const Label* input, const ptrdiff_t input_strides[4],
+                      const ptrdiff_t volume_size[4],
+                      const ptrdiff_t block_size[3],
+                      const LabelMapping<Label>& mapping,
+                      const OutputAllocator& get_output,
+                      size_t num_threads = 1);
+
+// Called with the bounds [z_begin, z_end) of a slab of consecutive z slices.
+// Must return the values of the slab, with x varying fastest, which need only
+// remain valid until the next call, or null to abort encoding.
+template <class Label>
+using SlabReader =
+    std::function<const Label*(ptrdiff_t z_begin, ptrdiff_t z_end)>;
+
+// Same as CompressChannels for a single channel, but obtains the input from
+// `get_slab` one slab of block_size[2] slices at a time, in increasing z.
+// Apart from the output, only one slab and the encoded blocks are held in
+// memory, which suits inputs that are themselves decoded incrementally.  The
+// output is identical to that of CompressChannels.
+//
+// Returns false if `get_slab` or `get_output` returned null.
+template <class Label>
+bool CompressChannelSlabs(const ptrdiff_t volume_size[3],
+                          const ptrdiff_t block_size[3],
+                          const SlabReader<Label>& get_slab,
+                          const OutputAllocator& get_output,
+                          size_t num_threads = 1);
+
+// Returns an upper bound, in 32-bit units, on the size of the output of
+// CompressChannels, computed without examining the input.  This is useful for
+// preallocating an output buffer.
+template <class Label>
+size_t GetCompressChannelsMaxSize(const ptrdiff_t volume_size[4],
+                                  const ptrdiff_t block_size[3]);
+
 }  // namespace compress_segmentation
 }  // namespace neuroglancer
 
@@ -16,6 +16,9 @@
 
 #include "compress_segmentation.h"
 
+#include <algorithm>
+#include <random>
+
 #include "gtest/gtest.h"
 
 namespace neuroglancer {
@@ -113,6 +116,31 @@ TEST(EncodeBlockTest, Basic2) {
   ASSERT_EQ(cache, (EncodedValueCache<uint64_t>{{{3, 4, 5}, 1}}));
 }
 
+// Test 8-bit encoding, which requires more distinct values than fit in the
+// small table used for blocks with at most 4-bit encoding.
+TEST(EncodeBlockTest, Basic8) {
+  std::vector<uint64_t> input;
+  for (uint64_t i = 0; i < 17; ++i) input.push_back(100 - i);
+  input.push_back(100);
+  const ptrdiff_t input_strides[3] = {1, 18, 18};
+  const ptrdiff_t block_size[3] = {18, 1, 1};
+  std::vector<uint32_t> output;
+  std::vector<uint32_t> expected{
+      0x0d0e0f10, 0x090a0b0c, 0x05060708, 0x01020304, 0x00001000};
+  for (uint32_t value = 84; value <= 100; ++value) {
+    expected.push_back(value);
+    expected.push_back(0);
+  }
+  size_t encoded_bits;
+  size_t table_offset;
+  EncodedValueCache<uint64_t> cache;
+  EncodeBlock(input.data(), input_strides, block_size, block_size, 0,
+              &encoded_bits, &table_offset, &cache, &output);
+  ASSERT_EQ(8, encoded_bits);
+  ASSERT_EQ(5, table_offset);
+  ASSERT_EQ(expected, output);
+}
+
 TEST(CompressChannelTest, Basic) {
   std::vector<uint64_t> input{4, 3, 5, 4, 1, 3, 3, 3};
   const ptrdiff_t input_strides[3] = {1, 2, 4};
@@ -224,6 +252,243 @@ TEST(CompressChannelTest, BasicCached32) {
   ASSERT_EQ(expected, output);
 }
 
+// Serial reference implementation of CompressChannels in terms of EncodeBlock.
+template <class Label>
+std::vector<uint32_t> ReferenceCompressChannels(const Label* input,
+                                                const ptrdiff_t input_strides[4],
+                                                const ptrdiff_t volume_size[4],
+                                                const ptrdiff_t block_size[3]) {
+  std::vector<uint32_t> output(volume_size[3]);
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t base_offset = output[channel_i] = output.size();
+    EncodedValueCache<Label> cache;
+    ptrdiff_t grid_size[3];
+    for (int i = 0; i < 3; ++i) {
+      grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    }
+    output.resize(base_offset + 2 * grid_size[0] * grid_size[1] * grid_size[2]);
+    size_t block_offset = 0;
+    for (ptrdiff_t bz = 0; bz < grid_size[2]; ++bz) {
+      for (ptrdiff_t by = 0; by < grid_size[1]; ++by) {
+        for (ptrdiff_t bx = 0; bx < grid_size[0]; ++bx, ++block_offset) {
+          const ptrdiff_t block[3] = {bx, by, bz};
+          ptrdiff_t actual_size[3];
+          ptrdiff_t input_offset = input_strides[3] * channel_i;
+          for (int i = 0; i < 3; ++i) {
+            actual_size[i] = std::min(block_size[i],
+                                      volume_size[i] - block[i] * block_size[i]);
+            input_offset += block[i] * block_size[i] * input_strides[i];
+          }
+          const size_t encoded_value_base_offset = output.size() - base_offset;
+          size_t encoded_bits, table_offset;
+          EncodeBlock(input + input_offset, input_strides, block_size,
+                      actual_size, base_offset, &encoded_bits, &table_offset,
+                      &cache, &output);
+          output[base_offset + 2 * block_offset] =
+              table_offset | (encoded_bits << 24);
+          output[base_offset + 2 * block_offset + 1] = encoded_value_base_offset;
+        }
+      }
+    }
+  }
+  return output;
+}
+
+TEST(CompressChannelsTest, MatchesSerialEncoding) {
+  std::mt19937 gen(0);
+  // Labels are drawn from a small set within runs of a few voxels, so that
+  // blocks have a variety of table sizes and many tables are shared.
+  std::uniform_int_distribution<uint64_t> label_dist(0, 5);
+  std::uniform_int_distribution<int> run_dist(1, 12);
+  const ptrdiff_t volume_size[4] = {37, 21, 13, 3};
+  const ptrdiff_t input_strides[4] = {1, 37, 37 * 21, 37 * 21 * 13};
+  std::vector<uint64_t> input(37 * 21 * 13 * 3);
+  for (size_t i = 0; i < input.size();) {
+    const uint64_t label = label_dist(gen) << 32 | label_dist(gen);
+    for (int run = run_dist(gen); run > 0 && i < input.size(); --run) {
+      input[i++] = label;
+    }
+  }
+  for (const auto& block_size : {std::vector<ptrdiff_t>{8, 8, 8},
+                                 std::vector<ptrdiff_t>{4, 3, 2},
+                                 std::vector<ptrdiff_t>{64, 64, 64}}) {
+    std::vector<uint32_t> output;
+    CompressChannels(input.data(), input_strides, volume_size,
+                     block_size.data(), &output);
+    ASSERT_EQ(ReferenceCompressChannels(input.data(), input_strides,
+                                        volume_size, block_size.data()),
+              output);
+
+    std::vector<uint32_t> input32(input.begin(), input.end());
+    CompressChannels(input32.data(), input_strides, volume_size,
+                     block_size.data(), &output);
+    ASSERT_EQ(ReferenceCompressChannels(input32.data(), input_strides,
+                                        volume_size, block_size.data()),
+              output);
+  }
+}
+
+// The buffered encoder used by the OutputAllocator overloads produces the same
+// output as the single-pass std::vector overload for any number of threads.
+TEST(CompressChannelsTest, ParallelMatchesSerial) {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 40);
+  std::uniform_int_distribution<int> run_dist(1, 20);
+  const ptrdiff_t volume_size[4] = {45, 29, 17, 2};
+  const ptrdiff_t input_strides[4] = {1, 45, 45 * 29, 45 * 29 * 17};
+  std::vector<uint64_t> input(45 * 29 * 17 * 2);
+  for (size_t i = 0; i < input.size();) {
+    const uint64_t label = label_dist(gen);
+    for (int run = run_dist(gen); run > 0 && i < input.size(); --run) {
+      input[i++] = label;
+    }
+  }
+  for (const auto& block_size : {std::vector<ptrdiff_t>{8, 8, 8},
+                                 std::vector<ptrdiff_t>{4, 3, 2}}) {
+    std::vector<uint32_t> expected;
+    CompressChannels(input.data(), input_strides, volume_size,
+                     block_size.data(), &expected);
+    for (size_t num_threads : {1, 2, 4, 7}) {
+      std::vector<uint32_t> output;
+      ASSERT_TRUE(CompressChannels(input.data(), input_strides, volume_size,
+                                   block_size.data(),
+                                   [&](size_t size) {
+                                     output.resize(size);
+                                     return output.data();
+                                   },
+                                   num_threads));
+      ASSERT_EQ(expected, output) << "num_threads=" << num_threads;
+    }
+  }
+}
+
+// uint8 and uint16 labels are widened to produce the uint32 format.
+TEST(CompressChannelsTest, NarrowLabels) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint32_t> label_dist(250, 260);
+  const ptrdiff_t volume_size[4] = {19, 11, 7, 2};
+  const ptrdiff_t input_strides[4] = {1, 19, 19 * 11, 19 * 11 * 7};
+  const ptrdiff_t block_size[3] = {8, 4, 2};
+  std::vector<uint32_t> input32(19 * 11 * 7 * 2);
+  for (auto& x : input32) x = label_dist(gen);
+  std::vector<uint32_t> expected;
+  CompressChannels(input32.data(), input_strides, volume_size, block_size,
+                   &expected);
+
+  std::vector<uint16_t> input16(input32.begin(), input32.end());
+  std::vector<uint32_t> output;
+  CompressChannels(input16.data(), input_strides, volume_size, block_size,
+                   &output);
+  ASSERT_EQ(expected, output);
+
+  // Restrict the values to the range of uint8.
+  for (auto& x : input32) x &= 0xff;
+  CompressChannels(input32.data(), input_strides, volume_size, block_size,
+                   &expected);
+  std::vector<uint8_t> input8(input32.begin(), input32.end());
+  CompressChannels(input8.data(), input_strides, volume_size, block_size,
+                   &output);
+  ASSERT_EQ(expected, output);
+}
+
+TEST(CompressChannelsTest, OutputAllocator) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 40);
+  const ptrdiff_t volume_size[4] = {19, 11, 7, 2};
+  const ptrdiff_t input_strides[4] = {1, 19, 19 * 11, 19 * 11 * 7};
+  const ptrdiff_t block_size[3] = {8, 4, 2};
+  std::vector<uint64_t> input(19 * 11 * 7 * 2);
+  for (auto& x : input) x = label_dist(gen);
+  std::vector<uint32_t> expected;
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &expected);
+
+  // Every element of the buffer must be written, and the size must be exact.
+  const size_t max_size =
+      GetCompressChannelsMaxSize<uint64_t>(volume_size, block_size);
+  ASSERT_GE(max_size, expected.size());
+  std::vector<uint32_t> buffer(max_size, 0xdeadbeef);
+  size_t requested_size = 0;
+  ASSERT_TRUE(CompressChannels(input.data(), input_strides, volume_size,
+                               block_size, [&](size_t size) {
+                                 requested_size = size;
+                                 return buffer.data();
+                               }));
+  ASSERT_EQ(expected.size(), requested_size);
+  buffer.resize(requested_size);
+  ASSERT_EQ(expected, buffer);
+
+  ASSERT_FALSE(CompressChannels(input.data(), input_strides, volume_size,
+                                block_size,
+                                [](size_t) -> uint32_t* { return nullptr; }));
+}
+
+// Encoding with a mapping is equivalent to encoding the mapped volume.
+TEST(CompressChannelsTest, LabelMapping) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 30);
+  std::uniform_int_distribution<int> run_dist(1, 12);
+  const ptrdiff_t volume_size[4] = {37, 21, 13, 2};
+  const ptrdiff_t input_strides[4] = {1, 37, 37 * 21, 37 * 21 * 13};
+  const ptrdiff_t block_size[3] = {8, 4, 2};
+  std::vector<uint64_t> input(37 * 21 * 13 * 2);
+  for (size_t i = 0; i < input.size();) {
+    const uint64_t label = label_dist(gen);
+    for (int run = run_dist(gen); run > 0 && i < input.size(); --run) {
+      input[i++] = label;
+    }
+  }
+
+  // Labels 0-9 are merged in pairs, which collapses table entries; 10-19 are
+  // shifted, which preserves the table order; 20-24 map to themselves;
+  // 25-30 are not mapped.
+  std::vector<uint64_t> keys, values;
+  for (uint64_t label = 0; label < 25; ++label) {
+    keys.push_back(label);
+    values.push_back(label < 10 ? 100 - label / 2
+                                : label < 20 ? label + 1000 : label);
+  }
+  std::vector<uint64_t> mapped_input(input);
+  for (auto& x : mapped_input) {
+    if (x < keys.size()) x = values[x];
+  }
+  std::vector<uint32_t> expected;
+  CompressChannels(mapped_input.data(), input_strides, volume_size, block_size,
+                   &expected);
+
+  LabelMapping<uint64_t> mapping;
+  mapping.keys = keys.data();
+  mapping.values = values.data();
+  mapping.size = keys.size();
+  std::vector<uint32_t> output;
+  ASSERT_TRUE(CompressChannels(input.data(), input_strides, volume_size,
+                               block_size, mapping, [&](size_t size) {
+                                 output.resize(size);
+                                 return output.data();
+                               }));
+  ASSERT_EQ(expected, output);
+}
+
+// The maximum size is attained when every voxel has a distinct value.
+TEST(CompressChannelsTest, MaxSize) {
+  const ptrdiff_t volume_size[4] = {9, 5, 3, 1};
+  const ptrdiff_t input_strides[4] = {1, 9, 9 * 5, 9 * 5 * 3};
+  const ptrdiff_t block_size[3] = {4, 4, 4};
+  std::vector<uint32_t> input(9 * 5 * 3);
+  for (size_t i = 0; i < input.size(); ++i) input[i] = i;
+  std::vector<uint32_t> output;
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &output);
+  ASSERT_EQ(output.size(),
+            GetCompressChannelsMaxSize<uint32_t>(volume_size, block_size));
+
+  std::vector<uint8_t> input8(input.begin(), input.end());
+  CompressChannels(input8.data(), input_strides, volume_size, block_size,
+                   &output);
+  ASSERT_EQ(output.size(),
+            GetCompressChannelsMaxSize<uint8_t>(volume_size, block_size));
+}
+
 }  // namespace
 }  // namespace compress_segmentation
 }  // namespace neuroglancer
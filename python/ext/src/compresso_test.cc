@@ -0,0 +1,256 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compresso.hpp"
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Blocky labels with some noise, so that components, boundaries and all of
+// the location codes occur.
+template <class Label>
+std::vector<Label> MakeLabels(size_t sx, size_t sy, size_t sz, uint64_t max_label,
+                              uint64_t label_scale) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, max_label);
+  std::uniform_int_distribution<int> noise_dist(0, 9);
+  std::vector<Label> labels(sx * sy * sz);
+  for (size_t z = 0; z < sz; ++z) {
+    for (size_t y = 0; y < sy; ++y) {
+      for (size_t x = 0; x < sx; ++x) {
+        uint64_t label = (x / 5 + 3 * (y / 4) + 7 * (z / 2)) % (max_label + 1);
+        if (noise_dist(gen) == 0) label = label_dist(gen);
+        labels[x + sx * (y + sy * z)] = static_cast<Label>(label * label_scale);
+      }
+    }
+  }
+  return labels;
+}
+
+template <class Label>
+void TestRoundTrip(size_t xstep, size_t ystep, size_t zstep, size_t connectivity,
+                   bool random_access_z_index) {
+  const size_t sx = 37, sy = 21, sz = 9;
+  for (uint64_t max_label : {0, 1, 20, 250}) {
+    // Labels near the maximum are stored with the escape code 6.
+    for (uint64_t label_scale :
+         {uint64_t(1), std::max<uint64_t>(1, std::numeric_limits<Label>::max() / 250)}) {
+      auto labels = MakeLabels<Label>(sx, sy, sz, max_label, label_scale);
+      std::vector<unsigned char> encoded;
+      ASSERT_EQ(0, compresso::compress(labels.data(), sizeof(Label), sx, sy, sz, xstep, ystep,
+                                       zstep, connectivity, random_access_z_index, encoded));
+      ASSERT_EQ(random_access_z_index, encoded[4]);
+      std::vector<Label> decoded(labels.size());
+      ASSERT_EQ(0, (compresso::decompress<void, void>(encoded.data(), encoded.size(),
+                                                      decoded.data())));
+      ASSERT_EQ(labels, decoded) << "steps=" << xstep << "," << ystep << "," << zstep
+                                 << " connectivity=" << connectivity
+                                 << " max_label=" << max_label;
+    }
+  }
+}
+
+TEST(CompressoTest, RoundTrip) {
+  for (bool random_access_z_index : {false, true}) {
+    TestRoundTrip<uint8_t>(4, 4, 1, 4, random_access_z_index);
+    TestRoundTrip<uint16_t>(4, 4, 1, 4, random_access_z_index);
+    TestRoundTrip<uint32_t>(8, 4, 1, 4, random_access_z_index);
+    TestRoundTrip<uint64_t>(8, 8, 1, 4, random_access_z_index);
+    TestRoundTrip<uint64_t>(3, 5, 2, 4, random_access_z_index);
+  }
+  TestRoundTrip<uint32_t>(4, 4, 2, 6, false);
+  TestRoundTrip<uint64_t>(8, 8, 1, 6, false);
+}
+
+TEST(CompressoTest, InvalidArguments) {
+  std::vector<uint32_t> labels(8);
+  std::vector<unsigned char> encoded;
+  EXPECT_EQ(1, compresso::compress(labels.data(), 4, 0, 2, 2, 8, 8, 1, 4, false, encoded));
+  EXPECT_EQ(2, compresso::compress(labels.data(), 4, 2, 2, 2, 16, 8, 1, 4, false, encoded));
+  EXPECT_EQ(3, compresso::compress(labels.data(), 4, 2, 2, 2, 8, 8, 1, 8, false, encoded));
+  EXPECT_EQ(3, compresso::compress(labels.data(), 4, 2, 2, 2, 8, 8, 1, 6, true, encoded));
+  EXPECT_EQ(13, compresso::compress(labels.data(), 3, 2, 2, 2, 8, 8, 1, 4, false, encoded));
+}
+
+// With 8-bit windows, at most 128 distinct windows can be indexed.
+TEST(CompressoTest, SmallWindows) {
+  const size_t sx = 64, sy = 64, sz = 2;
+  std::vector<uint32_t> labels(sx * sy * sz);
+  for (size_t i = 0; i < labels.size(); ++i) labels[i] = (i % sx) / 3 + (i / sx) % 3;
+  std::vector<unsigned char> encoded;
+  ASSERT_EQ(0, compresso::compress(labels.data(), 4, sx, sy, sz, 2, 2, 2, 4, false, encoded));
+  std::vector<uint32_t> decoded(labels.size());
+  ASSERT_EQ(0, (compresso::decompress<void, void>(encoded.data(), encoded.size(),
+                                                  decoded.data())));
+  ASSERT_EQ(labels, decoded);
+
+  std::mt19937 gen(0);
+  for (auto& x : labels) x = gen() % 2;
+  EXPECT_EQ(4, compresso::compress(labels.data(), 4, sx, sy, sz, 2, 4, 1, 4, false, encoded));
+}
+
+TEST(CompressoTest, DecompressRange) {
+  const size_t sx = 29, sy = 17, sz = 11, sxy = sx * sy;
+  auto labels = MakeLabels<uint64_t>(sx, sy, sz, 40, 1);
+  for (bool random_access_z_index : {false, true}) {
+    std::vector<unsigned char> encoded;
+    ASSERT_EQ(0, compresso::compress(labels.data(), 8, sx, sy, sz, 4, 4, 2, 4,
+                                     random_access_z_index, encoded));
+    for (size_t z_start = 0; z_start < sz; ++z_start) {
+      for (size_t z_end = z_start + 1; z_end <= sz; ++z_end) {
+        std::vector<uint64_t> decoded(sxy * (z_end - z_start));
+        ASSERT_EQ(0, (compresso::decompress_range<void, void>(encoded.data(), encoded.size(),
+                                                              z_start, z_end, decoded.data())));
+        ASSERT_TRUE(std::equal(decoded.begin(), decoded.end(), labels.begin() + sxy * z_start))
+            << z_start << ", " << z_end;
+      }
+    }
+    std::vector<uint64_t> decoded(sxy);
+    EXPECT_EQ(15, (compresso::decompress_range<void, void>(encoded.data(), encoded.size(), 3, 3,
+                                                           decoded.data())));
+    EXPECT_EQ(15, (compresso::decompress_range<void, void>(encoded.data(), encoded.size(), sz,
+                                                           sz + 1, decoded.data())));
+  }
+}
+
+TEST(CompressoTest, DecompressThreaded) {
+  const size_t sx = 29, sy = 17, sz = 23, sxy = sx * sy;
+  // Pairs of slices share labels, so location codes 4 and 5 link neighboring slices and
+  // restrict where the volume can be split between threads.
+  auto labels = MakeLabels<uint32_t>(sx, sy, sz, 40, 1);
+  for (bool random_access_z_index : {false, true}) {
+    std::vector<unsigned char> encoded;
+    ASSERT_EQ(0, compresso::compress(labels.data(), 4, sx, sy, sz, 4, 4, 1, 4,
+                                     random_access_z_index, encoded));
+    for (size_t num_threads : {2, 3, 8, 64}) {
+      for (size_t z_start : {size_t(0), size_t(5)}) {
+        for (size_t z_end : {size_t(12), sz}) {
+          std::vector<uint32_t> decoded(sxy * (z_end - z_start));
+          ASSERT_EQ(0, (compresso::decompress_range<void, void>(encoded.data(), encoded.size(),
+                                                                z_start, z_end, decoded.data(),
+                                                                num_threads)));
+          ASSERT_TRUE(std::equal(decoded.begin(), decoded.end(), labels.begin() + sxy * z_start))
+              << num_threads << ": " << z_start << ", " << z_end;
+        }
+      }
+    }
+  }
+}
+
+TEST(CompressoTest, DecompressMapped) {
+  const size_t sx = 29, sy = 17, sz = 11, sxy = sx * sy;
+  auto labels = MakeLabels<uint32_t>(sx, sy, sz, 250, 0xffffffffu / 250);
+  // Labels of boundary voxels are stored in the locations, and the maximum
+  // label requires the escape code 6.
+  for (size_t i = 0; i < labels.size(); i += 37) labels[i] = 0xffffffffu;
+  std::vector<uint64_t> keys, values;
+  for (uint64_t label = 0; label <= 250; label += 3) {
+    keys.push_back(label * (0xffffffffu / 250));
+    values.push_back(label % 2);
+  }
+  keys.push_back(0xffffffffu);
+  values.push_back(3);
+  // Keys wider than the labels are never matched.
+  keys.push_back(uint64_t(1) << 40);
+  values.push_back(7);
+  const compresso::LabelMapping mapping(keys.data(), values.data(), keys.size());
+  std::vector<uint32_t> expected(labels);
+  for (auto& x : expected) {
+    auto it = std::lower_bound(keys.begin(), keys.end(), x);
+    if (it != keys.end() && *it == x) x = static_cast<uint32_t>(values[it - keys.begin()]);
+  }
+  for (size_t connectivity : {4, 6}) {
+    std::vector<unsigned char> encoded;
+    ASSERT_EQ(0, compresso::compress(labels.data(), 4, sx, sy, sz, 4, 4, 1, connectivity, false,
+                                     encoded));
+    for (size_t num_threads : {1, 3}) {
+      std::vector<uint32_t> decoded(sxy * (sz - 2));
+      ASSERT_EQ(0, (compresso::decompress_range<void, void>(encoded.data(), encoded.size(), 2,
+                                                            sz, decoded.data(), num_threads,
+                                                            mapping)));
+      ASSERT_TRUE(std::equal(decoded.begin(), decoded.end(), expected.begin() + sxy * 2))
+          << connectivity << ", " << num_threads;
+    }
+  }
+}
+
+template <class Label>
+void TestLabelQueries(size_t sz, size_t connectivity, bool random_access_z_index) {
+  const size_t sx = 23, sy = 19;
+  auto labels = MakeLabels<Label>(sx, sy, sz, 60, std::numeric_limits<Label>::max() / 60);
+  std::map<uint64_t, uint64_t> expected;
+  for (Label label : labels) ++expected[label];
+  std::vector<uint64_t> expected_labels, expected_counts;
+  for (const auto& entry : expected) {
+    expected_labels.push_back(entry.first);
+    expected_counts.push_back(entry.second);
+  }
+  std::vector<unsigned char> encoded;
+  ASSERT_EQ(0, compresso::compress(labels.data(), sizeof(Label), sx, sy, sz, 4, 4, 1,
+                                   connectivity, random_access_z_index, encoded));
+  std::vector<uint64_t> unique, counted, counts;
+  ASSERT_EQ(0, compresso::labels(encoded.data(), encoded.size(), unique));
+  EXPECT_EQ(expected_labels, unique) << sz << ", " << connectivity;
+  ASSERT_EQ(0, compresso::label_counts(encoded.data(), encoded.size(), counted, counts));
+  EXPECT_EQ(expected_labels, counted) << sz << ", " << connectivity;
+  EXPECT_EQ(expected_counts, counts) << sz << ", " << connectivity;
+}
+
+TEST(CompressoTest, LabelQueries) {
+  for (size_t sz : {1, 2, 9, 33}) {
+    TestLabelQueries<uint8_t>(sz, 4, false);
+    TestLabelQueries<uint32_t>(sz, 4, true);
+    TestLabelQueries<uint64_t>(sz, 4, false);
+    TestLabelQueries<uint64_t>(sz, 6, false);
+  }
+  std::vector<uint64_t> labels, counts;
+  std::vector<unsigned char> encoded(10, 0);
+  EXPECT_EQ(9, compresso::labels(encoded.data(), encoded.size(), labels));
+  EXPECT_EQ(9, compresso::label_counts(encoded.data(), encoded.size(), labels, counts));
+}
+
+TEST(CompressoTest, PackedConnectedComponents) {
+  std::mt19937 gen(0);
+  for (int64_t sx : {1, 7, 64, 65, 130}) {
+    for (int64_t sy : {1, 5, 33}) {
+      for (int density : {2, 4, 10}) {
+        const int64_t voxels = sx * sy;
+        std::unique_ptr<bool[]> boundaries(new bool[voxels]);
+        std::vector<uint64_t> packed((voxels + 63) / 64, 0);
+        for (int64_t i = 0; i < voxels; ++i) {
+          boundaries[i] = gen() % density == 0;
+          packed[i / 64] |= static_cast<uint64_t>(boundaries[i]) << (i % 64);
+        }
+        const size_t max_labels = (voxels + 2) / 2;
+        std::vector<uint32_t> expected(voxels, 0), actual(voxels, 7);
+        size_t expected_n = 0, actual_n = 0;
+        cc3d::connected_components2d_4<uint32_t>(boundaries.get(), sx, sy, 1, max_labels,
+                                                 expected.data(), expected_n, 5);
+        cc3d::connected_components2d_4<uint32_t>(packed.data(), sx, sy, max_labels,
+                                                 actual.data(), actual_n, 5);
+        ASSERT_EQ(expected_n, actual_n) << sx << "x" << sy;
+        ASSERT_EQ(expected, actual) << sx << "x" << sy;
+      }
+    }
+  }
+}
+
+}  // namespace
@@ -0,0 +1,104 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Transcodes compresso streams into the compressed segmentation format without
+// decoding the whole volume: slices are decoded a slab of blocks at a time and
+// encoded as they are produced.
+//
+// This header includes compresso.hpp, which defines non-inline functions, and
+// so may only be included by one translation unit of a program.
+
+#ifndef NEUROGLANCER_COMPRESSO_TRANSCODE_H_
+#define NEUROGLANCER_COMPRESSO_TRANSCODE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "compress_segmentation.h"
+#include "compresso.hpp"
+
+namespace neuroglancer {
+namespace compresso_transcode {
+
+// Returned by CompressoToCompressedSegmentation if `get_output` returned null.
+constexpr int kOutputAllocationFailed = -1;
+
+namespace internal {
+
+struct TranscodeFn {
+  unsigned char* buffer;
+  size_t num_bytes;
+  const compresso::CompressoHeader& header;
+  const ptrdiff_t* block_size;
+  const compress_segmentation::OutputAllocator& get_output;
+
+  template <typename LABEL, typename WINDOW>
+  int run() {
+    compresso::CompressoTables<LABEL, WINDOW> tables;
+    int err = compresso::read_tables<LABEL, WINDOW>(buffer, num_bytes, header, tables);
+    if (err) return err;
+    // Batches of block_size[2] slices are exactly the slabs requested by
+    // CompressChannelSlabs.
+    compresso::SliceBatchDecoder<LABEL, WINDOW> decoder(header, tables, block_size[2],
+                                                        compresso::LabelMapping());
+    auto get_slab = [&](ptrdiff_t, ptrdiff_t) -> const LABEL* {
+      const LABEL* slices = nullptr;
+      size_t z_begin = 0, z_end = 0;
+      err = decoder.next(slices, z_begin, z_end);
+      return err ? nullptr : slices;
+    };
+    const ptrdiff_t volume_size[3] = {header.sx, header.sy, header.sz};
+    if (!compress_segmentation::CompressChannelSlabs<LABEL>(volume_size, block_size, get_slab,
+                                                            get_output)) {
+      return err ? err : kOutputAllocationFailed;
+    }
+    return 0;
+  }
+};
+
+}  // namespace internal
+
+// Encodes the compresso stream `buffer` in the compressed segmentation format
+// with the specified (x, y, z) block size, into the buffer returned by
+// `get_output`.  The output is identical to that of
+// compress_segmentation::CompressChannels for the decoded volume as a single
+// channel, with labels of the type of the stream: 8-, 16- and 32-bit labels
+// are encoded in the uint32 format, and 64-bit labels in the uint64 format.
+//
+// Apart from the output and the compresso tables, memory use for
+// 4-connected streams is that of a slab of block_size[2] slices and of the
+// encoded blocks.  The components of 6-connected streams span slices, so
+// those streams are decoded in full before encoding, and memory use is that
+// of the whole volume.
+//
+// Returns 0 on success, kOutputAllocationFailed, or a compresso error code.
+inline int CompressoToCompressedSegmentation(
+    unsigned char* buffer, size_t num_bytes, const ptrdiff_t block_size[3],
+    const compress_segmentation::OutputAllocator& get_output) {
+  if (num_bytes < compresso::CompressoHeader::header_size) {
+    return 9;
+  } else if (!compresso::CompressoHeader::valid_header(buffer)) {
+    return 12;
+  }
+  const compresso::CompressoHeader header(buffer);
+  internal::TranscodeFn fn = {buffer, num_bytes, header, block_size, get_output};
+  return compresso::dispatch_types(header, fn);
+}
+
+}  // namespace compresso_transcode
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_COMPRESSO_TRANSCODE_H_
@@ -0,0 +1,107 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compresso_transcode.h"
+
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using neuroglancer::compress_segmentation::CompressChannels;
+using neuroglancer::compresso_transcode::CompressoToCompressedSegmentation;
+using neuroglancer::compresso_transcode::kOutputAllocationFailed;
+
+// Blocky labels with some noise, so that blocks have varying numbers of
+// distinct values.
+template <class Label>
+std::vector<Label> MakeLabels(size_t sx, size_t sy, size_t sz, uint64_t label_scale) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 40);
+  std::uniform_int_distribution<int> noise_dist(0, 9);
+  std::vector<Label> labels(sx * sy * sz);
+  for (size_t z = 0; z < sz; ++z) {
+    for (size_t y = 0; y < sy; ++y) {
+      for (size_t x = 0; x < sx; ++x) {
+        uint64_t label = (x / 5 + 3 * (y / 4) + 7 * (z / 3)) % 41;
+        if (noise_dist(gen) == 0) label = label_dist(gen);
+        labels[x + sx * (y + sy * z)] = static_cast<Label>(label * label_scale);
+      }
+    }
+  }
+  return labels;
+}
+
+template <class Label>
+void TestTranscode(size_t sz, size_t connectivity, bool random_access_z_index,
+                   const ptrdiff_t block_size[3]) {
+  const size_t sx = 29, sy = 17;
+  auto labels = MakeLabels<Label>(sx, sy, sz, std::numeric_limits<Label>::max() / 40);
+  std::vector<unsigned char> encoded;
+  ASSERT_EQ(0, compresso::compress(labels.data(), sizeof(Label), sx, sy, sz, 4, 4, 1,
+                                   connectivity, random_access_z_index, encoded));
+
+  const ptrdiff_t input_strides[4] = {1, static_cast<ptrdiff_t>(sx),
+                                      static_cast<ptrdiff_t>(sx * sy), 0};
+  const ptrdiff_t volume_size[4] = {static_cast<ptrdiff_t>(sx), static_cast<ptrdiff_t>(sy),
+                                    static_cast<ptrdiff_t>(sz), 1};
+  std::vector<uint32_t> expected;
+  CompressChannels(labels.data(), input_strides, volume_size, block_size, &expected);
+
+  std::vector<uint32_t> output;
+  ASSERT_EQ(0, CompressoToCompressedSegmentation(encoded.data(), encoded.size(), block_size,
+                                                 [&](size_t size) {
+                                                   output.resize(size);
+                                                   return output.data();
+                                                 }));
+  EXPECT_EQ(expected, output) << "sz=" << sz << " connectivity=" << connectivity
+                              << " block_size=" << block_size[0] << "," << block_size[1] << ","
+                              << block_size[2];
+}
+
+TEST(CompressoTranscodeTest, MatchesCompressChannels) {
+  const ptrdiff_t block_sizes[][3] = {{8, 8, 8}, {4, 5, 3}, {64, 64, 1}, {2, 3, 40}};
+  for (const auto& block_size : block_sizes) {
+    for (size_t sz : {1, 9, 33}) {
+      TestTranscode<uint8_t>(sz, 4, false, block_size);
+      TestTranscode<uint16_t>(sz, 4, true, block_size);
+      TestTranscode<uint32_t>(sz, 4, false, block_size);
+      TestTranscode<uint64_t>(sz, 4, true, block_size);
+      TestTranscode<uint64_t>(sz, 6, false, block_size);
+    }
+  }
+}
+
+TEST(CompressoTranscodeTest, Errors) {
+  const ptrdiff_t block_size[3] = {8, 8, 8};
+  auto labels = MakeLabels<uint32_t>(10, 10, 10, 1);
+  std::vector<unsigned char> encoded;
+  ASSERT_EQ(0, compresso::compress(labels.data(), sizeof(uint32_t), 10, 10, 10, 4, 4, 1, 4,
+                                   false, encoded));
+  auto get_output = [](size_t) -> uint32_t* { return nullptr; };
+  EXPECT_EQ(kOutputAllocationFailed,
+            CompressoToCompressedSegmentation(encoded.data(), encoded.size(), block_size,
+                                              get_output));
+  EXPECT_EQ(9, CompressoToCompressedSegmentation(encoded.data(), 10, block_size, get_output));
+  // Truncated tables.
+  EXPECT_NE(0, CompressoToCompressedSegmentation(encoded.data(), encoded.size() / 2, block_size,
+                                                 get_output));
+}
+
+}  // namespace
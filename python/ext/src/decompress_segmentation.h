@@ -0,0 +1,417 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Implements decoding of the compressed segmentation format produced by
+// compress_segmentation.h (see that file for a description of the format).
+//
+// This is header-only so that it can also be compiled to WebAssembly for the
+// viewer (see src/sliceview/compresso/build_wasm.sh) without pulling in the
+// encoder.  Malformed input is detected and reported rather than causing
+// out-of-bounds reads, since the input is typically received over the
+// network.
+
+#ifndef NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
+#define NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace neuroglancer {
+namespace compress_segmentation {
+
+// Mapping from label values to label values.  Values not among the keys are
+// left unchanged.
+template <class Label>
+struct LabelMapping {
+  // Keys in strictly increasing order.
+  const Label* keys = nullptr;
+  // Value corresponding to each key.
+  const Label* values = nullptr;
+  size_t size = 0;
+};
+
+namespace decompress_internal {
+
+// Unpacks all of the `Bits`-bit indices stored in `num_words` words.  Each
+// word is unpacked independently with shifts by constant amounts, which
+// compilers vectorize (e.g. with -msimd128 when targeting WebAssembly).
+template <int Bits>
+void UnpackIndices(const uint32_t* input, size_t num_words, uint32_t* output) {
+  constexpr int kIndicesPerWord = 32 / Bits;
+  constexpr uint32_t kMask = Bits == 32 ? 0xffffffffu : (1u << Bits) - 1;
+  for (size_t word_i = 0; word_i < num_words; ++word_i) {
+    const uint32_t word = input[word_i];
+    for (int i = 0; i < kIndicesPerWord; ++i) {
+      output[i] = (word >> (i * Bits)) & kMask;
+    }
+    output += kIndicesPerWord;
+  }
+}
+
+template <class Label>
+constexpr size_t NumWordsPerLabel() {
+  return (sizeof(Label) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+}
+
+template <class Label>
+Label LoadLabel(const uint32_t* input) {
+  Label value = 0;
+  for (size_t word_i = 0; word_i < NumWordsPerLabel<Label>(); ++word_i) {
+    value |= static_cast<Label>(input[word_i]) << (32 * word_i);
+  }
+  return value;
+}
+
+template <class Label>
+Label MapLabel(const LabelMapping<Label>& mapping, Label value) {
+  const Label* keys_end = mapping.keys + mapping.size;
+  const Label* it = std::lower_bound(mapping.keys, keys_end, value);
+  if (it != keys_end && *it == value) return mapping.values[it - mapping.keys];
+  return value;
+}
+
+// Unpacks the `bits`-bit indices stored in `num_words` words.  Returns false
+// if `bits` is not a valid encoding width.
+inline bool UnpackIndices(size_t bits, const uint32_t* input, size_t num_words,
+                          uint32_t* output) {
+  switch (bits) {
+    case 1:
+      UnpackIndices<1>(input, num_words, output);
+      return true;
+    case 2:
+      UnpackIndices<2>(input, num_words, output);
+      return true;
+    case 4:
+      UnpackIndices<4>(input, num_words, output);
+      return true;
+    case 8:
+      UnpackIndices<8>(input, num_words, output);
+      return true;
+    case 16:
+      UnpackIndices<16>(input, num_words, output);
+      return true;
+    case 32:
+      UnpackIndices<32>(input, num_words, output);
+      return true;
+    default:
+      return false;
+  }
+}
+
+struct BlockHeader {
+  size_t table_offset;
+  size_t encoded_bits;
+  const uint32_t* encoded_values;
+};
+
+// Reads the header of the block at `block_index`, and checks that its encoded
+// values are within the input.
+inline bool ReadBlockHeader(const uint32_t* input, size_t input_size,
+                            size_t block_index, size_t block_num_elements,
+                            BlockHeader* header) {
+  if (block_index * 2 + 2 > input_size) return false;
+  const uint32_t h0 = input[block_index * 2], h1 = input[block_index * 2 + 1];
+  header->table_offset = h0 & 0xffffff;
+  header->encoded_bits = h0 >> 24;
+  const size_t num_words =
+      (block_num_elements * header->encoded_bits + 31) / 32;
+  if (h1 > input_size || num_words > input_size - h1) return false;
+  header->encoded_values = input + h1;
+  return true;
+}
+
+// Returns true if a table of `table_size` entries at `table_offset` is within
+// the input.
+template <class Label>
+bool IsTableValid(size_t input_size, size_t table_offset, size_t table_size) {
+  return table_offset <= input_size &&
+         table_size * NumWordsPerLabel<Label>() <= input_size - table_offset;
+}
+
+}  // namespace decompress_internal
+
+// Decodes the subvolume [begin, end) of a single channel.  Only the blocks
+// that intersect the subvolume are read, and within them only the encoded
+// values of the rows that intersect it, so this is also suitable for reading
+// a span of a row or an xy slice.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoding of the channel.
+//
+//   input_size: Number of 32-bit words available at `input`.
+//
+//   volume_size: Extent of the x, y, and z dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   begin, end: Bounds of the subvolume, which must be within the volume.
+//
+//   output: Receives the values of the subvolume, with x varying fastest.
+//
+//   mapping: If not null, each value is replaced according to the mapping.
+//       It is applied to the entries of the value tables as they are first
+//       used, rather than to each position.
+//
+// Label must be uint32_t or uint64_t, matching the encoding.  Returns false if
+// the input is malformed or the bounds are invalid, in which case `output` is
+// partially written.
+template <class Label>
+bool DecompressSubvolume(const uint32_t* input, size_t input_size,
+                         const ptrdiff_t volume_size[3],
+                         const ptrdiff_t block_size[3],
+                         const ptrdiff_t begin[3], const ptrdiff_t end[3],
+                         Label* output,
+                         const LabelMapping<Label>* mapping = nullptr) {
+  using namespace decompress_internal;
+  ptrdiff_t grid_size[3], grid_begin[3], grid_end[3], output_size[3];
+  for (size_t i = 0; i < 3; ++i) {
+    if (block_size[i] <= 0 || begin[i] < 0 || begin[i] > end[i] ||
+        end[i] > volume_size[i]) {
+      return false;
+    }
+    grid_size[i] = (volume_size[i] + block_size[i] - 1) / block_size[i];
+    grid_begin[i] = begin[i] / block_size[i];
+    grid_end[i] = (end[i] + block_size[i] - 1) / block_size[i];
+    output_size[i] = end[i] - begin[i];
+  }
+  const size_t block_num_elements = block_size[0] * block_size[1] * block_size[2];
+  // Unpacked indices of one row of a block, with room for the indices of
+  // neighboring rows that share its first and last words.
+  std::vector<uint32_t> indices(block_size[0] + 64);
+  // Mapped entries of the table of the current block, extended as rows refer
+  // to further entries.
+  std::vector<Label> mapped_table;
+  for (ptrdiff_t bz = grid_begin[2]; bz < grid_end[2]; ++bz) {
+    for (ptrdiff_t by = grid_begin[1]; by < grid_end[1]; ++by) {
+      for (ptrdiff_t bx = grid_begin[0]; bx < grid_end[0]; ++bx) {
+        BlockHeader header;
+        if (!ReadBlockHeader(input, input_size,
+                             bx + grid_size[0] * (by + grid_size[1] * bz),
+                             block_num_elements, &header)) {
+          return false;
+        }
+        const size_t bits = header.encoded_bits;
+        const uint32_t* table = input + header.table_offset;
+        // Intersection of the block with the subvolume, relative to the
+        // block origin.
+        const ptrdiff_t block[3] = {bx, by, bz};
+        ptrdiff_t lower[3], upper[3];
+        for (size_t i = 0; i < 3; ++i) {
+          const ptrdiff_t origin = block[i] * block_size[i];
+          lower[i] = std::max(begin[i], origin) - origin;
+          upper[i] = std::min(end[i], origin + block_size[i]) - origin;
+        }
+        const ptrdiff_t nx = upper[0] - lower[0];
+        if (bits == 0) std::fill_n(indices.begin(), nx, 0);
+        mapped_table.clear();
+        for (ptrdiff_t z = lower[2]; z < upper[2]; ++z) {
+          for (ptrdiff_t y = lower[1]; y < upper[1]; ++y) {
+            const uint32_t* row_indices = indices.data();
+            size_t table_size = 1;
+            if (bits != 0) {
+              // With a power-of-2 number of bits, word boundaries are also
+              // index boundaries.
+              const size_t first_index =
+                  (z * block_size[1] + y) * block_size[0] + lower[0];
+              const size_t first_word = first_index * bits / 32;
+              const size_t end_word = ((first_index + nx) * bits + 31) / 32;
+              if (!UnpackIndices(bits, header.encoded_values + first_word,
+                                 end_word - first_word, indices.data())) {
+                return false;
+              }
+              row_indices += first_index - first_word * (32 / bits);
+              table_size =
+                  *std::max_element(row_indices, row_indices + nx) + size_t(1);
+            }
+            if (!IsTableValid<Label>(input_size, header.table_offset,
+                                     table_size)) {
+              return false;
+            }
+            Label* out = output + (block[0] * block_size[0] + lower[0] -
+                                   begin[0]) +
+                         output_size[0] *
+                             ((block[1] * block_size[1] + y - begin[1]) +
+                              output_size[1] *
+                                  (block[2] * block_size[2] + z - begin[2]));
+            if (mapping) {
+              for (size_t i = mapped_table.size(); i < table_size; ++i) {
+                mapped_table.push_back(MapLabel(
+                    *mapping,
+                    LoadLabel<Label>(table + i * NumWordsPerLabel<Label>())));
+              }
+              for (ptrdiff_t x = 0; x < nx; ++x) {
+                out[x] = mapped_table[row_indices[x]];
+              }
+            } else {
+              for (ptrdiff_t x = 0; x < nx; ++x) {
+                out[x] = LoadLabel<Label>(
+                    table + row_indices[x] * NumWordsPerLabel<Label>());
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Decodes a single channel.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoding of the channel.
+//
+//   input_size: Number of 32-bit words available at `input`.
+//
+//   volume_size: Extent of the x, y, and z dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   output: Receives volume_size[0] * volume_size[1] * volume_size[2] values,
+//       with x varying fastest.
+//
+//   mapping: If not null, each value is replaced according to the mapping.
+//
+// Label must be uint32_t or uint64_t, matching the encoding.  Returns false if
+// the input is malformed, in which case `output` is partially written.
+template <class Label>
+bool DecompressChannel(const uint32_t* input, size_t input_size,
+                       const ptrdiff_t volume_size[3],
+                       const ptrdiff_t block_size[3], Label* output,
+                       const LabelMapping<Label>* mapping = nullptr) {
+  const ptrdiff_t begin[3] = {0, 0, 0};
+  return DecompressSubvolume(input, input_size, volume_size, block_size, begin,
+                             volume_size, output, mapping);
+}
+
+// Reads the value at `position` of a single channel, which requires reading
+// only one block header, one encoded word and one table entry.
+template <class Label>
+bool ReadValue(const uint32_t* input, size_t input_size,
+               const ptrdiff_t volume_size[3], const ptrdiff_t block_size[3],
+               const ptrdiff_t position[3], Label* output) {
+  const ptrdiff_t end[3] = {position[0] + 1, position[1] + 1, position[2] + 1};
+  return DecompressSubvolume(input, input_size, volume_size, block_size,
+                             position, end, output);
+}
+
+// Computes the sorted distinct values of a single channel from the value
+// tables, without decoding any voxels.  The encoded values of each block are
+// still unpacked to determine the size of its table, since it is not stored.
+template <class Label>
+bool GetUniqueValues(const uint32_t* input, size_t input_size,
+                     const ptrdiff_t volume_size[3],
+                     const ptrdiff_t block_size[3],
+                     std::vector<Label>* output) {
+  using namespace decompress_internal;
+  output->clear();
+  size_t num_blocks = 1;
+  for (size_t i = 0; i < 3; ++i) {
+    if (block_size[i] <= 0 || volume_size[i] < 0) return false;
+    num_blocks *= (volume_size[i] + block_size[i] - 1) / block_size[i];
+  }
+  const size_t block_num_elements = block_size[0] * block_size[1] * block_size[2];
+  std::vector<uint32_t> indices(block_num_elements + 32);
+  // Offset and size of the table of each block.
+  std::vector<std::pair<size_t, size_t>> tables(num_blocks);
+  for (size_t block_i = 0; block_i < num_blocks; ++block_i) {
+    BlockHeader header;
+    if (!ReadBlockHeader(input, input_size, block_i, block_num_elements,
+                         &header)) {
+      return false;
+    }
+    size_t table_size = 1;
+    if (header.encoded_bits != 0) {
+      if (!UnpackIndices(header.encoded_bits, header.encoded_values,
+                         (block_num_elements * header.encoded_bits + 31) / 32,
+                         indices.data())) {
+        return false;
+      }
+      table_size = *std::max_element(indices.begin(),
+                                     indices.begin() + block_num_elements) +
+                   size_t(1);
+    }
+    tables[block_i] = {header.table_offset, table_size};
+  }
+  // Read each shared table only once, using the largest size of any block
+  // that refers to it.
+  std::sort(tables.begin(), tables.end());
+  for (size_t i = 0; i < tables.size(); ++i) {
+    if (i + 1 < tables.size() && tables[i + 1].first == tables[i].first) {
+      continue;
+    }
+    const size_t table_offset = tables[i].first, table_size = tables[i].second;
+    if (!IsTableValid<Label>(input_size, table_offset, table_size)) {
+      return false;
+    }
+    for (size_t j = 0; j < table_size; ++j) {
+      output->push_back(LoadLabel<Label>(input + table_offset +
+                                         j * NumWordsPerLabel<Label>()));
+    }
+  }
+  std::sort(output->begin(), output->end());
+  output->erase(std::unique(output->begin(), output->end()), output->end());
+  return true;
+}
+
+// Decodes the output of CompressChannels.
+//
+// Args:
+//
+//   input: Pointer to the start of the encoding.
+//
+//   input_size: Number of 32-bit words available at `input`.
+//
+//   volume_size: Extent of the x, y, z, and channel dimensions.
+//
+//   block_size: Extent of the x, y, and z dimensions of the block.
+//
+//   output: Receives the product of `volume_size` values, with x varying
+//       fastest and channel slowest.
+//
+//   mapping: If not null, each value is replaced according to the mapping.
+//
+// Returns false if the input is malformed.
+template <class Label>
+bool DecompressChannels(const uint32_t* input, size_t input_size,
+                        const ptrdiff_t volume_size[4],
+                        const ptrdiff_t block_size[3], Label* output,
+                        const LabelMapping<Label>* mapping = nullptr) {
+  if (volume_size[3] < 0 || static_cast<size_t>(volume_size[3]) > input_size) {
+    return false;
+  }
+  const size_t channel_num_elements =
+      volume_size[0] * volume_size[1] * volume_size[2];
+  for (ptrdiff_t channel_i = 0; channel_i < volume_size[3]; ++channel_i) {
+    const size_t offset = input[channel_i];
+    if (offset > input_size ||
+        !DecompressChannel(input + offset, input_size - offset, volume_size,
+                           block_size, output + channel_i * channel_num_elements,
+                           mapping)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_DECOMPRESS_SEGMENTATION_H_
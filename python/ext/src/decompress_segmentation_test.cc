@@ -0,0 +1,202 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decompress_segmentation.h"
+
+#include <algorithm>
+#include <random>
+
+#include "compress_segmentation.h"
+#include "gtest/gtest.h"
+
+namespace neuroglancer {
+namespace compress_segmentation {
+namespace {
+
+template <class Label>
+void TestRoundTrip(uint64_t max_label) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, max_label);
+  std::uniform_int_distribution<int> run_dist(1, 12);
+  const ptrdiff_t volume_size[4] = {37, 21, 13, 3};
+  const ptrdiff_t input_strides[4] = {1, 37, 37 * 21, 37 * 21 * 13};
+  std::vector<Label> input(37 * 21 * 13 * 3);
+  for (size_t i = 0; i < input.size();) {
+    const Label label = static_cast<Label>(label_dist(gen) * 0x100000001ull);
+    for (int run = run_dist(gen); run > 0 && i < input.size(); --run) {
+      input[i++] = label;
+    }
+  }
+  for (const auto& block_size : {std::vector<ptrdiff_t>{8, 8, 8},
+                                 std::vector<ptrdiff_t>{4, 3, 2},
+                                 std::vector<ptrdiff_t>{64, 64, 64}}) {
+    std::vector<uint32_t> encoded;
+    CompressChannels(input.data(), input_strides, volume_size,
+                     block_size.data(), &encoded);
+    std::vector<Label> decoded(input.size());
+    ASSERT_TRUE(DecompressChannels(encoded.data(), encoded.size(),
+                                   volume_size, block_size.data(),
+                                   decoded.data()));
+    ASSERT_EQ(input, decoded);
+  }
+}
+
+// Label sets of various sizes exercise all of the encoding bit widths.
+TEST(DecompressChannelsTest, RoundTrip) {
+  for (uint64_t max_label : {0, 1, 3, 12, 200, 70000}) {
+    TestRoundTrip<uint32_t>(max_label);
+    TestRoundTrip<uint64_t>(max_label);
+  }
+}
+
+TEST(DecompressChannelsTest, Truncated) {
+  const ptrdiff_t volume_size[4] = {9, 5, 3, 1};
+  const ptrdiff_t input_strides[4] = {1, 9, 9 * 5, 9 * 5 * 3};
+  const ptrdiff_t block_size[3] = {4, 4, 4};
+  std::vector<uint64_t> input(9 * 5 * 3);
+  for (size_t i = 0; i < input.size(); ++i) input[i] = i % 7;
+  std::vector<uint32_t> encoded;
+  CompressChannels(input.data(), input_strides, volume_size, block_size,
+                   &encoded);
+  std::vector<uint64_t> decoded(input.size());
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    ASSERT_FALSE(DecompressChannels(encoded.data(), size, volume_size,
+                                    block_size, decoded.data()))
+        << size;
+  }
+  ASSERT_TRUE(DecompressChannels(encoded.data(), encoded.size(), volume_size,
+                                 block_size, decoded.data()));
+  ASSERT_EQ(input, decoded);
+}
+
+TEST(DecompressSubvolumeTest, MatchesFullDecode) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 20);
+  const ptrdiff_t volume_size[3] = {37, 21, 13};
+  const ptrdiff_t input_strides[3] = {1, 37, 37 * 21};
+  const ptrdiff_t block_size[3] = {8, 4, 2};
+  std::vector<uint64_t> input(37 * 21 * 13);
+  for (auto& x : input) x = label_dist(gen) << 32 | label_dist(gen);
+  std::vector<uint32_t> encoded;
+  CompressChannel(input.data(), input_strides, volume_size, block_size,
+                  &encoded);
+
+  for (int i = 0; i < 100; ++i) {
+    ptrdiff_t begin[3], end[3];
+    for (int j = 0; j < 3; ++j) {
+      std::uniform_int_distribution<ptrdiff_t> dist(0, volume_size[j]);
+      begin[j] = dist(gen);
+      end[j] = dist(gen);
+      if (begin[j] > end[j]) std::swap(begin[j], end[j]);
+    }
+    std::vector<uint64_t> expected;
+    for (ptrdiff_t z = begin[2]; z < end[2]; ++z) {
+      for (ptrdiff_t y = begin[1]; y < end[1]; ++y) {
+        for (ptrdiff_t x = begin[0]; x < end[0]; ++x) {
+          expected.push_back(input[x + 37 * (y + 21 * z)]);
+        }
+      }
+    }
+    std::vector<uint64_t> decoded(expected.size());
+    ASSERT_TRUE(DecompressSubvolume(encoded.data(), encoded.size(),
+                                    volume_size, block_size, begin, end,
+                                    decoded.data()));
+    ASSERT_EQ(expected, decoded);
+  }
+
+  for (ptrdiff_t z = 0; z < volume_size[2]; ++z) {
+    for (ptrdiff_t y = 0; y < volume_size[1]; ++y) {
+      for (ptrdiff_t x = 0; x < volume_size[0]; ++x) {
+        const ptrdiff_t position[3] = {x, y, z};
+        uint64_t value;
+        ASSERT_TRUE(ReadValue(encoded.data(), encoded.size(), volume_size,
+                              block_size, position, &value));
+        ASSERT_EQ(input[x + 37 * (y + 21 * z)], value);
+      }
+    }
+  }
+
+  const ptrdiff_t begin[3] = {0, 0, 5}, end[3] = {37, 21, 14};
+  std::vector<uint64_t> decoded(37 * 21 * 9);
+  ASSERT_FALSE(DecompressSubvolume(encoded.data(), encoded.size(), volume_size,
+                                   block_size, begin, end, decoded.data()));
+}
+
+TEST(DecompressChannelsTest, Mapping) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint64_t> label_dist(0, 30);
+  const ptrdiff_t volume_size[4] = {23, 17, 9, 2};
+  const ptrdiff_t input_strides[4] = {1, 23, 23 * 17, 23 * 17 * 9};
+  std::vector<uint64_t> input(23 * 17 * 9 * 2);
+  for (auto& x : input) x = label_dist(gen);
+  // Maps odd labels, some of them onto labels that are also present.
+  std::vector<uint64_t> keys, values;
+  for (uint64_t key = 1; key <= 29; key += 2) {
+    keys.push_back(key);
+    values.push_back(key % 3 == 0 ? key - 1 : key << 40);
+  }
+  LabelMapping<uint64_t> mapping;
+  mapping.keys = keys.data();
+  mapping.values = values.data();
+  mapping.size = keys.size();
+  std::vector<uint64_t> expected(input);
+  for (auto& x : expected) {
+    if (x % 2 == 1 && x <= 29) x = x % 3 == 0 ? x - 1 : x << 40;
+  }
+  for (const auto& block_size : {std::vector<ptrdiff_t>{8, 8, 8},
+                                 std::vector<ptrdiff_t>{4, 3, 2}}) {
+    std::vector<uint32_t> encoded;
+    CompressChannels(input.data(), input_strides, volume_size,
+                     block_size.data(), &encoded);
+    std::vector<uint64_t> decoded(input.size());
+    ASSERT_TRUE(DecompressChannels(encoded.data(), encoded.size(),
+                                   volume_size, block_size.data(),
+                                   decoded.data(), &mapping));
+    ASSERT_EQ(expected, decoded);
+  }
+}
+
+TEST(GetUniqueValuesTest, Basic) {
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<uint32_t> label_dist(0, 1000);
+  const ptrdiff_t volume_size[3] = {19, 11, 7};
+  const ptrdiff_t input_strides[3] = {1, 19, 19 * 11};
+  std::vector<uint32_t> input(19 * 11 * 7);
+  // Mostly a few labels, with some distinct ones so that blocks use tables
+  // of various sizes.
+  for (auto& x : input) {
+    x = label_dist(gen);
+    if (x > 50) x %= 4;
+  }
+  std::vector<uint32_t> expected(input);
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+  for (const auto& block_size : {std::vector<ptrdiff_t>{8, 8, 8},
+                                 std::vector<ptrdiff_t>{4, 3, 2},
+                                 std::vector<ptrdiff_t>{1, 1, 1}}) {
+    std::vector<uint32_t> encoded;
+    CompressChannel(input.data(), input_strides, volume_size,
+                    block_size.data(), &encoded);
+    std::vector<uint32_t> values;
+    ASSERT_TRUE(GetUniqueValues(encoded.data(), encoded.size(), volume_size,
+                                block_size.data(), &values));
+    ASSERT_EQ(expected, values);
+  }
+}
+
+}  // namespace
+}  // namespace compress_segmentation
+}  // namespace neuroglancer
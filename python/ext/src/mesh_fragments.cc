@@ -0,0 +1,120 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mesh_fragments.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+
+namespace neuroglancer {
+namespace meshing {
+
+void SplitMeshIntoFragments(const TriangleMesh& mesh,
+                            const std::array<float, 3>& fragment_size,
+                            std::vector<MeshFragment>* fragments) {
+  using VertexIndex = TriangleMesh::VertexIndex;
+  fragments->clear();
+  const size_t num_triangles = mesh.triangles.size();
+  if (num_triangles == 0) return;
+
+  // Determine the fragment of each triangle.  The map is ordered by (z, y, x)
+  // so that fragments are emitted in grid order.
+  std::map<std::array<int64_t, 3>, uint32_t> fragment_index;
+  std::vector<uint32_t> triangle_fragment(num_triangles);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    auto const& triangle = mesh.triangles[t];
+    std::array<int64_t, 3> key;
+    for (int i = 0; i < 3; ++i) {
+      const float centroid = (mesh.vertex_positions[triangle[0]][i] +
+                              mesh.vertex_positions[triangle[1]][i] +
+                              mesh.vertex_positions[triangle[2]][i]) /
+                             3;
+      key[2 - i] = static_cast<int64_t>(std::floor(centroid / fragment_size[i]));
+    }
+    // Fragments are provisionally numbered in order of first occurrence.
+    auto result = fragment_index.emplace(
+        key, static_cast<uint32_t>(fragment_index.size()));
+    triangle_fragment[t] = result.first->second;
+  }
+
+  // Renumber fragments in grid order.
+  const size_t num_fragments = fragment_index.size();
+  std::vector<uint32_t> provisional_to_final(num_fragments);
+  fragments->resize(num_fragments);
+  {
+    uint32_t i = 0;
+    for (auto const& p : fragment_index) {
+      provisional_to_final[p.second] = i;
+      auto& fragment = (*fragments)[i];
+      fragment.lower_bound.fill(std::numeric_limits<float>::infinity());
+      fragment.upper_bound.fill(-std::numeric_limits<float>::infinity());
+      ++i;
+    }
+  }
+
+  // Group the triangles by fragment with a counting sort.
+  std::vector<uint32_t> offsets(num_fragments + 1, 0);
+  for (auto& f : triangle_fragment) {
+    f = provisional_to_final[f];
+    ++offsets[f + 1];
+  }
+  for (size_t i = 0; i < num_fragments; ++i) offsets[i + 1] += offsets[i];
+  std::vector<uint32_t> sorted_triangles(num_triangles);
+  {
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < num_triangles; ++t) {
+      sorted_triangles[fill[triangle_fragment[t]]++] = static_cast<uint32_t>(t);
+    }
+  }
+
+  // Copy triangles one fragment at a time, duplicating shared vertices.  The
+  // mapping from input vertex to fragment vertex is tagged with the fragment
+  // for which it was computed, so it never needs to be reset.
+  std::vector<uint32_t> vertex_fragment(mesh.vertex_positions.size(),
+                                        std::numeric_limits<uint32_t>::max());
+  std::vector<VertexIndex> vertex_index(mesh.vertex_positions.size());
+  for (uint32_t f = 0; f < num_fragments; ++f) {
+    auto& fragment = (*fragments)[f];
+    auto& fragment_mesh = fragment.mesh;
+    fragment_mesh.triangles.reserve(offsets[f + 1] - offsets[f]);
+    for (uint32_t i = offsets[f]; i < offsets[f + 1]; ++i) {
+      auto triangle = mesh.triangles[sorted_triangles[i]];
+      for (auto& v : triangle) {
+        if (vertex_fragment[v] != f) {
+          vertex_fragment[v] = f;
+          vertex_index[v] =
+              static_cast<VertexIndex>(fragment_mesh.vertex_positions.size());
+          auto const& position = mesh.vertex_positions[v];
+          fragment_mesh.vertex_positions.push_back(position);
+          for (int j = 0; j < 3; ++j) {
+            fragment.lower_bound[j] =
+                std::min(fragment.lower_bound[j], position[j]);
+            fragment.upper_bound[j] =
+                std::max(fragment.upper_bound[j], position[j]);
+          }
+        }
+        v = vertex_index[v];
+      }
+      fragment_mesh.triangles.push_back(triangle);
+    }
+  }
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,52 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Splits a mesh into spatial fragments aligned to a regular grid.  Each
+// fragment records the bounding box of its vertices, which a caller can use
+// to select the fragments that intersect a region of interest.
+
+#ifndef NEUROGLANCER_MESH_FRAGMENTS_H_
+#define NEUROGLANCER_MESH_FRAGMENTS_H_
+
+#include <array>
+#include <vector>
+
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+struct MeshFragment {
+  // Bounding box of the vertices of the fragment.
+  std::array<float, 3> lower_bound;
+  std::array<float, 3> upper_bound;
+
+  TriangleMesh mesh;
+};
+
+// Partitions the triangles of `mesh` by the grid cell of size
+// `fragment_size` containing their centroid.  Each fragment is a
+// self-contained mesh: vertices shared by triangles in different fragments
+// are duplicated in each of them.  Fragments are ordered by grid position,
+// with x varying fastest.
+void SplitMeshIntoFragments(const TriangleMesh& mesh,
+                            const std::array<float, 3>& fragment_size,
+                            std::vector<MeshFragment>* fragments);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_MESH_FRAGMENTS_H_
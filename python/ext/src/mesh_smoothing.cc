@@ -0,0 +1,121 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mesh_smoothing.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#ifdef USE_OMP
+#include <omp.h>
+#endif
+
+namespace neuroglancer {
+namespace meshing {
+
+VertexAdjacency::VertexAdjacency(const TriangleMesh& mesh) {
+  const size_t num_vertices = mesh.vertex_positions.size();
+
+  // Each triangle contributes its two other vertices to the neighbor list of
+  // each of its vertices.  Interior edges are therefore listed twice (once
+  // per adjacent triangle), and boundary edges only once.
+  std::vector<uint32_t> raw_offsets(num_vertices + 1, 0);
+  for (auto const& triangle : mesh.triangles) {
+    for (auto v : triangle) raw_offsets[v + 1] += 2;
+  }
+  for (size_t v = 0; v < num_vertices; ++v) {
+    raw_offsets[v + 1] += raw_offsets[v];
+  }
+  std::vector<TriangleMesh::VertexIndex> raw_neighbors(raw_offsets.back());
+  {
+    std::vector<uint32_t> fill(raw_offsets.begin(), raw_offsets.end() - 1);
+    for (auto const& triangle : mesh.triangles) {
+      for (int i = 0; i < 3; ++i) {
+        auto v = triangle[i];
+        raw_neighbors[fill[v]++] = triangle[(i + 1) % 3];
+        raw_neighbors[fill[v]++] = triangle[(i + 2) % 3];
+      }
+    }
+  }
+
+  offsets.assign(num_vertices + 1, 0);
+  neighbors.reserve(raw_neighbors.size() / 2);
+  boundary.assign(num_vertices, false);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    auto begin = raw_neighbors.begin() + raw_offsets[v];
+    auto end = raw_neighbors.begin() + raw_offsets[v + 1];
+    std::sort(begin, end);
+    for (auto it = begin; it != end;) {
+      auto next = std::find_if(it, end,
+                               [&](TriangleMesh::VertexIndex w) { return w != *it; });
+      if (next - it == 1) boundary[v] = true;
+      neighbors.push_back(*it);
+      it = next;
+    }
+    offsets[v + 1] = static_cast<uint32_t>(neighbors.size());
+  }
+}
+
+namespace {
+
+// Computes output = input + factor * (mean(neighbors) - input) for every
+// vertex that is not locked.
+void LaplacianStep(const VertexAdjacency& adjacency, bool lock_boundary_vertices,
+                   float factor, const VertexPositions& input,
+                   VertexPositions* output) {
+  const int64_t num_vertices = static_cast<int64_t>(input.size());
+#ifdef USE_OMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int64_t v = 0; v < num_vertices; ++v) {
+    const uint32_t begin = adjacency.offsets[v], end = adjacency.offsets[v + 1];
+    auto const& position = input[v];
+    auto& new_position = (*output)[v];
+    if (begin == end || (lock_boundary_vertices && adjacency.boundary[v])) {
+      new_position = position;
+      continue;
+    }
+    std::array<float, 3> sum = {{0, 0, 0}};
+    for (uint32_t i = begin; i < end; ++i) {
+      auto const& neighbor_position = input[adjacency.neighbors[i]];
+      for (int j = 0; j < 3; ++j) sum[j] += neighbor_position[j];
+    }
+    const float scale = 1.0f / (end - begin);
+    for (int j = 0; j < 3; ++j) {
+      new_position[j] = position[j] + factor * (sum[j] * scale - position[j]);
+    }
+  }
+}
+
+}  // namespace
+
+void SmoothMesh(const SmoothOptions& options, TriangleMesh* mesh) {
+  if (options.iterations <= 0 || mesh->triangles.empty()) {
+    return;
+  }
+  VertexAdjacency adjacency(*mesh);
+  auto& positions = mesh->vertex_positions;
+  VertexPositions temp(positions.size());
+  for (int iteration = 0; iteration < options.iterations; ++iteration) {
+    LaplacianStep(adjacency, options.lock_boundary_vertices,
+                  static_cast<float>(options.lambda), positions, &temp);
+    LaplacianStep(adjacency, options.lock_boundary_vertices,
+                  static_cast<float>(options.mu), temp, &positions);
+  }
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
@@ -0,0 +1,73 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Implements Taubin (lambda|mu) smoothing of a TriangleMesh, as described in:
+//
+//   Taubin.  "A Signal Processing Approach to Fair Surface Design."
+//   SIGGRAPH 1995.
+//
+// Each iteration applies a shrinking Laplacian step with a positive factor
+// lambda followed by an inflating step with a negative factor mu, which
+// removes the stair-step artifacts of marching cubes output without the
+// volume loss of plain Laplacian smoothing.
+
+#ifndef NEUROGLANCER_MESH_SMOOTHING_H_
+#define NEUROGLANCER_MESH_SMOOTHING_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+struct SmoothOptions {
+  // Number of lambda|mu iterations.  Set this to 0 to disable smoothing.
+  int iterations = 0;
+
+  // Factor for the shrinking step, must be in (0, 1).
+  double lambda = 0.5;
+
+  // Factor for the inflating step, must satisfy mu < -lambda.
+  double mu = -0.53;
+
+  // Vertices along mesh surface boundaries are not moved.
+  bool lock_boundary_vertices = true;
+};
+
+// Vertex-to-vertex adjacency of a TriangleMesh in compressed sparse row form.
+struct VertexAdjacency {
+  // neighbors[offsets[v]:offsets[v+1]] are the distinct vertices that share
+  // an edge with vertex v.
+  std::vector<uint32_t> offsets;
+  std::vector<TriangleMesh::VertexIndex> neighbors;
+
+  // Specifies for each vertex whether it lies on a mesh surface boundary,
+  // i.e. is incident to an edge used by only a single triangle.
+  std::vector<bool> boundary;
+
+  explicit VertexAdjacency(const TriangleMesh& mesh);
+};
+
+// Smooths the vertex positions of `mesh` in place.  The connectivity is
+// unchanged.
+void SmoothMesh(const SmoothOptions& options, TriangleMesh* mesh);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_MESH_SMOOTHING_H_
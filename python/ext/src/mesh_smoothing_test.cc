@@ -0,0 +1,122 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mesh_smoothing.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mesh_objects.h"
+
+namespace {
+
+using neuroglancer::meshing::SmoothMesh;
+using neuroglancer::meshing::SmoothOptions;
+using neuroglancer::meshing::TriangleMesh;
+using neuroglancer::meshing::Vector3d;
+
+// Returns the surface mesh of a voxelized sphere centered in a volume of
+// size^3 voxels.
+TriangleMesh MakeSphereMesh(int64_t size, double radius) {
+  std::vector<uint32_t> labels(size * size * size, 0);
+  const double center = (size - 1) / 2.0;
+  for (int64_t z = 0; z < size; ++z) {
+    for (int64_t y = 0; y < size; ++y) {
+      for (int64_t x = 0; x < size; ++x) {
+        const double dx = x - center, dy = y - center, dz = z - center;
+        if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+          labels[x + size * (y + size * z)] = 1;
+        }
+      }
+    }
+  }
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
+  neuroglancer::meshing::MeshObjects(labels.data(), Vector3d{{size, size, size}},
+                                     Vector3d{{1, size, size * size}}, &meshes);
+  return meshes[1];
+}
+
+std::array<double, 3> GetCentroid(const TriangleMesh& mesh) {
+  std::array<double, 3> centroid = {{0, 0, 0}};
+  for (const auto& position : mesh.vertex_positions) {
+    for (int i = 0; i < 3; ++i) centroid[i] += position[i];
+  }
+  for (int i = 0; i < 3; ++i) centroid[i] /= mesh.vertex_positions.size();
+  return centroid;
+}
+
+double GetMeanRadius(const TriangleMesh& mesh,
+                     const std::array<double, 3>& center) {
+  double sum = 0;
+  for (const auto& position : mesh.vertex_positions) {
+    double squared = 0;
+    for (int i = 0; i < 3; ++i) {
+      const double d = position[i] - center[i];
+      squared += d * d;
+    }
+    sum += std::sqrt(squared);
+  }
+  return sum / mesh.vertex_positions.size();
+}
+
+TEST(MeshSmoothingTest, ZeroIterationsIsIdentity) {
+  const TriangleMesh mesh = MakeSphereMesh(24, 9);
+  TriangleMesh smoothed = mesh;
+  SmoothOptions options;
+  options.iterations = 0;
+  SmoothMesh(options, &smoothed);
+  EXPECT_EQ(mesh.vertex_positions, smoothed.vertex_positions);
+  EXPECT_EQ(mesh.triangles, smoothed.triangles);
+}
+
+// Taubin smoothing preserves the connectivity, and unlike Laplacian smoothing
+// with the same number of iterations, barely shrinks the mesh.
+TEST(MeshSmoothingTest, TaubinPreservesVolume) {
+  const TriangleMesh mesh = MakeSphereMesh(32, 12);
+  const auto centroid = GetCentroid(mesh);
+  const double radius = GetMeanRadius(mesh, centroid);
+  ASSERT_NEAR(12, radius, 1);
+
+  SmoothOptions options;
+  options.iterations = 20;
+  TriangleMesh taubin = mesh;
+  SmoothMesh(options, &taubin);
+  ASSERT_EQ(mesh.vertex_positions.size(), taubin.vertex_positions.size());
+  ASSERT_EQ(mesh.triangles, taubin.triangles);
+  ASSERT_NE(mesh.vertex_positions, taubin.vertex_positions);
+  const auto taubin_centroid = GetCentroid(taubin);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(centroid[i], taubin_centroid[i], 0.01);
+  }
+  const double taubin_radius = GetMeanRadius(taubin, taubin_centroid);
+  EXPECT_NEAR(radius, taubin_radius, 0.01 * radius);
+
+  // Laplacian smoothing with a step of lambda per iteration.
+  options.mu = 0;
+  TriangleMesh laplacian = mesh;
+  SmoothMesh(options, &laplacian);
+  const double laplacian_radius =
+      GetMeanRadius(laplacian, GetCentroid(laplacian));
+  EXPECT_LT(laplacian_radius, radius - 0.02 * radius);
+  EXPECT_GT(std::abs(radius - laplacian_radius),
+            5 * std::abs(radius - taubin_radius));
+}
+
+}  // namespace
@@ -15,7 +15,11 @@
  */
 
 #include "on_demand_object_mesh_generator.h"
+#include "mesh_fragments.h"
 #include "mesh_objects.h"
+#include "mesh_smoothing.h"
+#include "vertex_cache_optimizer.h"
+#include "vertex_clustering_simplifier.h"
 
 #include "OpenMesh/Core/Mesh/TriMeshT.hh"
 #if OM_VERSION == 0x10000
@@ -27,7 +31,11 @@
 #include "OpenMesh/Tools/Decimater/ModNormalFlippingT.hh"
 #include "OpenMesh/Tools/Decimater/ModQuadricT.hh"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <memory>
+#include <mutex>
 
 #if __APPLE__
 #include <libkern/OSByteOrder.h>
@@ -68,6 +76,29 @@ void ConvertToOpenMeshTriangleMesh(const TriangleMesh& mesh,
   }
 }
 
+// Converts an OpenMeshTriangleMesh (after garbage collection) back into a
+// TriangleMesh.
+void ConvertFromOpenMeshTriangleMesh(const OpenMeshTriangleMesh& mesh,
+                                     TriangleMesh* new_mesh) {
+  new_mesh->clear();
+  new_mesh->vertex_positions.reserve(mesh.n_vertices());
+  for (auto vertex_it = mesh.vertices_begin(); vertex_it != mesh.vertices_end();
+       ++vertex_it) {
+    auto const& pt = mesh.point(vertex_it.handle());
+    new_mesh->vertex_positions.push_back({{pt[0], pt[1], pt[2]}});
+  }
+  new_mesh->triangles.reserve(mesh.n_faces());
+  for (auto face_it = mesh.faces_begin(); face_it != mesh.faces_end();
+       ++face_it) {
+    std::array<TriangleMesh::VertexIndex, 3> triangle;
+    auto circ = mesh.cfh_iter(face_it.handle());
+    for (int i = 0; i < 3; ++i, ++circ) {
+      triangle[i] = mesh.to_vertex_handle(circ.handle()).idx();
+    }
+    new_mesh->triangles.push_back(triangle);
+  }
+}
+
 std::string EncodeMesh(const OpenMeshTriangleMesh& mesh) {
   std::string output;
   size_t output_size = sizeof(uint32_t);
@@ -115,16 +146,143 @@ std::string EncodeMesh(const OpenMeshTriangleMesh& mesh) {
   return output;
 }
 
-bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh) {
-  if (options.lock_boundary_vertices) {
-    mesh->request_vertex_status();
-    for (auto it = mesh->vertices_begin(), end = mesh->vertices_end();
-         it != end; ++it) {
-      mesh->status(it.handle()).set_locked(mesh->is_boundary(it.handle()));
+std::string EncodeMesh(const TriangleMesh& mesh) {
+  std::string output;
+  const size_t num_vertices = mesh.vertex_positions.size();
+  size_t output_size = sizeof(uint32_t);
+  const size_t vertex_offset = output_size;
+  output_size += sizeof(float) * num_vertices * 3;
+  const size_t triangle_offset = output_size;
+  output_size += mesh.triangles.size() * 3 * sizeof(uint32_t);
+  output.resize(output_size);
+
+  // Write number of vertices.
+  *reinterpret_cast<uint32_t*>(&output[0]) = num_vertices;
+
+  // Write vertices.
+  {
+    float* vertex_buffer = reinterpret_cast<float*>(&output[vertex_offset]);
+    for (auto const& pt : mesh.vertex_positions) {
+      for (int i = 0; i < 3; ++i) {
+        *(vertex_buffer++) = pt[i];
+      }
     }
   }
-  mesh->request_face_normals();
-  mesh->update_face_normals();
+
+  // Write triangles.
+  {
+    uint32_t* index_buffer =
+        reinterpret_cast<uint32_t*>(&output[triangle_offset]);
+    for (auto const& triangle : mesh.triangles) {
+      for (int i = 0; i < 3; ++i) {
+        *(index_buffer++) = triangle[i];
+      }
+    }
+  }
+  // Encoded mesh is a sequence of 32-bit values.  We need to convert
+  // to little endian.
+  const size_t num_32bit_words = output_size / sizeof(uint32_t);
+  uint32_t *output_buffer = reinterpret_cast<uint32_t*>(&output[0]);
+  for (size_t i = 0; i < num_32bit_words; ++i) {
+    output_buffer[i] = htole32(output_buffer[i]);
+  }
+  return output;
+}
+
+// Inverse of EncodeMesh.
+void DecodeMesh(const std::string& encoded, TriangleMesh* mesh) {
+  mesh->clear();
+  if (encoded.size() < sizeof(uint32_t)) return;
+  // Byte swapping is an involution, so htole32 also converts from little
+  // endian.
+  const uint32_t* input = reinterpret_cast<const uint32_t*>(encoded.data());
+  const size_t num_vertices = htole32(input[0]);
+  const size_t num_triangles =
+      (encoded.size() / sizeof(uint32_t) - 1 - num_vertices * 3) / 3;
+  ++input;
+  mesh->vertex_positions.resize(num_vertices);
+  for (auto& vertex : mesh->vertex_positions) {
+    for (int i = 0; i < 3; ++i) {
+      uint32_t bits = htole32(*(input++));
+      std::memcpy(&vertex[i], &bits, sizeof(float));
+    }
+  }
+  mesh->triangles.resize(num_triangles);
+  for (auto& triangle : mesh->triangles) {
+    for (int i = 0; i < 3; ++i) {
+      triangle[i] = htole32(*(input++));
+    }
+  }
+}
+
+// Returns the length of the diagonal of the bounding box of `mesh`, in voxels.
+double GetBoundingBoxDiagonal(const TriangleMesh& mesh) {
+  if (mesh.vertex_positions.empty()) return 0;
+  auto lower = mesh.vertex_positions[0], upper = lower;
+  for (auto const& position : mesh.vertex_positions) {
+    for (int i = 0; i < 3; ++i) {
+      lower[i] = std::min(lower[i], position[i]);
+      upper[i] = std::max(upper[i], position[i]);
+    }
+  }
+  double sum = 0;
+  for (int i = 0; i < 3; ++i) {
+    const double d = upper[i] - lower[i];
+    sum += d * d;
+  }
+  return std::sqrt(sum);
+}
+
+// Returns the size in bytes of the mesh encoded by EncodeMesh.
+size_t GetEncodedMeshSize(size_t n_vertices, size_t n_faces) {
+  return sizeof(uint32_t) + 3 * sizeof(float) * n_vertices +
+         3 * sizeof(uint32_t) * n_faces;
+}
+
+// Returns true if a mesh with the specified vertex and face counts satisfies
+// the max_faces and max_bytes limits of `options`.
+bool IsWithinBudget(const SimplifyOptions& options, size_t n_vertices,
+                    size_t n_faces) {
+  if (options.max_faces > 0 &&
+      n_faces > static_cast<size_t>(options.max_faces)) {
+    return false;
+  }
+  if (options.max_bytes > 0 && GetEncodedMeshSize(n_vertices, n_faces) >
+                                   static_cast<size_t>(options.max_bytes)) {
+    return false;
+  }
+  return true;
+}
+
+// Returns the maximum number of faces permitted by the max_faces and
+// max_bytes limits of `options` for a mesh with the specified vertex and face
+// counts, or 0 if there is no limit.
+size_t GetTargetFaceCount(const SimplifyOptions& options, size_t n_vertices,
+                          size_t n_faces) {
+  size_t target = 0;
+  if (options.max_faces > 0) {
+    target = static_cast<size_t>(options.max_faces);
+  }
+  if (options.max_bytes > 0 && n_faces > 0) {
+    // The encoded size is 4 + 12 * (n_vertices + n_faces) bytes.  We assume
+    // that simplification approximately preserves the ratio of vertices to
+    // faces.
+    const double bytes_per_face = 12.0 * (n_vertices + n_faces) / n_faces;
+    const size_t byte_target = static_cast<size_t>(std::max(
+        1.0, (static_cast<double>(options.max_bytes) - 4) / bytes_per_face));
+    if (target == 0 || byte_target < target) target = byte_target;
+  }
+  return target;
+}
+
+// Runs a single decimation pass.
+//
+// Collapses are prioritized by quadric error.  If max_quadrics_error is
+// non-negative, collapses with a larger error are prohibited.  If
+// target_faces is non-zero, decimation stops once the mesh has at most that
+// many faces.
+bool DecimateMesh(const SimplifyOptions& options, double max_quadrics_error,
+                  size_t target_faces, OpenMeshTriangleMesh* mesh) {
   Decimater decimater(*mesh);
 #if OM_VERSION == 0x10000
   OpenMesh::Decimater::ModQuadricT<Decimater>::Handle quadrics_module;
@@ -137,21 +295,73 @@ bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh) {
   OpenMesh::Decimater::ModNormalFlippingT<OpenMeshTriangleMesh>::Handle normals_module;
   decimater.add(normals_module);
 #endif
-  decimater.module(quadrics_module).set_max_err(options.max_quadrics_error);
+  if (max_quadrics_error >= 0) {
+    decimater.module(quadrics_module).set_max_err(max_quadrics_error);
+  } else {
+    decimater.module(quadrics_module).unset_max_err();
+  }
   decimater.module(normals_module)
       .set_max_normal_deviation(options.max_normal_angle_deviation);
   if (!decimater.initialize()) {
     return false;
   }
-  decimater.decimate_to(0);
+  if (target_faces != 0) {
+    decimater.decimate_to_faces(0, target_faces);
+  } else {
+    decimater.decimate_to(0);
+  }
   mesh->garbage_collection();
+  return true;
+}
+
+bool SimplifyMesh(const SimplifyOptions& options, OpenMeshTriangleMesh* mesh) {
+  if (options.lock_boundary_vertices) {
+    mesh->request_vertex_status();
+    for (auto it = mesh->vertices_begin(), end = mesh->vertices_end();
+         it != end; ++it) {
+      mesh->status(it.handle()).set_locked(mesh->is_boundary(it.handle()));
+    }
+  }
+  mesh->request_face_normals();
+  mesh->update_face_normals();
+  if (options.max_quadrics_error >= 0) {
+    if (!DecimateMesh(options, options.max_quadrics_error, 0, mesh)) {
+      return false;
+    }
+  }
+  // If the mesh still exceeds the max_faces or max_bytes budget, continue in
+  // order of quadric error without the error bound.  The face count
+  // corresponding to max_bytes is only an estimate, so it is refined from the
+  // simplified mesh and retried until the budget is met or no further
+  // collapse is permitted.
+  while (!IsWithinBudget(options, mesh->n_vertices(), mesh->n_faces())) {
+    const size_t prev_faces = mesh->n_faces();
+    if (!DecimateMesh(
+            options, -1,
+            GetTargetFaceCount(options, mesh->n_vertices(), prev_faces),
+            mesh)) {
+      return false;
+    }
+    if (mesh->n_faces() == prev_faces) break;
+  }
   mesh->release_face_normals();
   return true;
 }
 
 struct OnDemandObjectMeshGenerator::Impl {
-  std::unordered_map<uint64_t, TriangleMesh> unsimplified_meshes;
-  std::unordered_map<uint64_t, std::string> simplified_meshes;
+  // Guards the maps below.  The Python bindings call the generator with the
+  // GIL released, so it is accessed concurrently.  Meshes are computed
+  // without holding the mutex, so that requests for different objects, in
+  // particular preview requests, are not serialized.  Entries are shared
+  // pointers so that results remain valid after they are replaced or
+  // erased.
+  std::mutex mutex;
+  std::unordered_map<uint64_t, std::shared_ptr<const TriangleMesh>>
+      unsimplified_meshes;
+  std::unordered_map<uint64_t, std::shared_ptr<const std::string>>
+      simplified_meshes;
+  std::unordered_map<uint64_t, std::shared_ptr<const std::string>>
+      preview_meshes;
   std::array<float,3> voxel_size, offset;
   SimplifyOptions simplify_options;
 };
@@ -167,47 +377,196 @@ OnDemandObjectMeshGenerator::OnDemandObjectMeshGenerator(
     impl_->offset[i] = offset[i];
   }
   impl_->simplify_options = simplify_options;
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
   MeshObjects(labels, {size[0], size[1], size[2]},
-              {strides[0], strides[1], strides[2]},
-              &impl_->unsimplified_meshes);
+              {strides[0], strides[1], strides[2]}, &meshes);
+  for (auto& p : meshes) {
+    impl_->unsimplified_meshes.emplace(
+        p.first, std::make_shared<const TriangleMesh>(std::move(p.second)));
+  }
 }
 
 
-const std::string& OnDemandObjectMeshGenerator::GetSimplifiedMesh(
-    uint64_t object_id) {
-  const static std::string empty_string;
+// Smooths and simplifies `unsimplified_mesh`, in voxel coordinates,
+// according to `options`, and stores the result, in the output coordinate
+// space, in `mesh`.
+bool ComputeSimplifiedMesh(const TriangleMesh& unsimplified_mesh,
+                           const SimplifyOptions& options,
+                           const std::array<float, 3>& voxel_size,
+                           const std::array<float, 3>& offset,
+                           OpenMeshTriangleMesh* mesh) {
+  const TriangleMesh* input_mesh = &unsimplified_mesh;
+  TriangleMesh smoothed_mesh;
+  if (options.smoothing_iterations > 0) {
+    SmoothOptions smooth_options;
+    smooth_options.iterations = options.smoothing_iterations;
+    smooth_options.lambda = options.smoothing_lambda;
+    smooth_options.mu = options.smoothing_mu;
+    smooth_options.lock_boundary_vertices = options.lock_boundary_vertices;
+    smoothed_mesh = unsimplified_mesh;
+    SmoothMesh(smooth_options, &smoothed_mesh);
+    input_mesh = &smoothed_mesh;
+  }
+  ConvertToOpenMeshTriangleMesh(*input_mesh, mesh, voxel_size, offset);
+  auto simplify_options = options;
+  if (simplify_options.max_quadrics_error >= 0 ||
+      simplify_options.max_faces > 0 || simplify_options.max_bytes > 0) {
+    double voxel_volume = 1;
+    for (int i = 0; i < 3; ++i) {
+      voxel_volume *= voxel_size[i];
+    }
+    simplify_options.max_quadrics_error *= voxel_volume * voxel_volume;
+    if (simplify_options.max_quadrics_error > 0 &&
+        simplify_options.adaptive_error_reference_extent > 0) {
+      const double ratio = GetBoundingBoxDiagonal(*input_mesh) /
+                           simplify_options.adaptive_error_reference_extent;
+      simplify_options.max_quadrics_error *= ratio * ratio;
+    }
+    if (!SimplifyMesh(simplify_options, mesh)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::shared_ptr<const std::string>
+OnDemandObjectMeshGenerator::GetSimplifiedMesh(uint64_t object_id) {
+  std::shared_ptr<const TriangleMesh> unsimplified_mesh;
   {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
     auto it = impl_->simplified_meshes.find(object_id);
     if (it != impl_->simplified_meshes.end()) {
       return it->second;
     }
+    auto unsimplified_it = impl_->unsimplified_meshes.find(object_id);
+    if (unsimplified_it == impl_->unsimplified_meshes.end()) {
+      return nullptr;
+    }
+    unsimplified_mesh = unsimplified_it->second;
   }
-
-  auto it = impl_->unsimplified_meshes.find(object_id);
-
-  if (it == impl_->unsimplified_meshes.end()) {
-    return empty_string;
-  }
-  TriangleMesh& unsimplified_mesh = it->second;
   OpenMeshTriangleMesh triangle_mesh;
-  ConvertToOpenMeshTriangleMesh(unsimplified_mesh, &triangle_mesh, impl_->voxel_size,
-                        impl_->offset);
+  if (!ComputeSimplifiedMesh(*unsimplified_mesh, impl_->simplify_options,
+                             impl_->voxel_size, impl_->offset,
+                             &triangle_mesh)) {
+    // Can't happen.
+    return nullptr;
+  }
+  std::shared_ptr<const std::string> encoded;
+  if (impl_->simplify_options.optimize_vertex_cache) {
+    TriangleMesh output_mesh;
+    ConvertFromOpenMeshTriangleMesh(triangle_mesh, &output_mesh);
+    OptimizeVertexCache(&output_mesh);
+    encoded = std::make_shared<const std::string>(EncodeMesh(output_mesh));
+  } else {
+    encoded = std::make_shared<const std::string>(EncodeMesh(triangle_mesh));
+  }
+  std::lock_guard<std::mutex> lock(impl_->mutex);
   impl_->unsimplified_meshes.erase(object_id);
-  auto simplify_options = impl_->simplify_options;
-  if (simplify_options.max_quadrics_error >= 0) {
-    double voxel_volume = 1;
+  impl_->preview_meshes.erase(object_id);
+  // If another thread computed the same mesh concurrently, its result is
+  // kept.
+  return impl_->simplified_meshes.emplace(object_id, std::move(encoded))
+      .first->second;
+}
+
+std::shared_ptr<const std::string>
+OnDemandObjectMeshGenerator::GetPreviewMesh(uint64_t object_id) {
+  std::shared_ptr<const TriangleMesh> unsimplified_mesh;
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    auto it = impl_->simplified_meshes.find(object_id);
+    if (it != impl_->simplified_meshes.end()) {
+      return it->second;
+    }
+    auto preview_it = impl_->preview_meshes.find(object_id);
+    if (preview_it != impl_->preview_meshes.end()) {
+      return preview_it->second;
+    }
+    auto unsimplified_it = impl_->unsimplified_meshes.find(object_id);
+    if (unsimplified_it == impl_->unsimplified_meshes.end()) {
+      return nullptr;
+    }
+    unsimplified_mesh = unsimplified_it->second;
+  }
+  const float cell_size =
+      static_cast<float>(impl_->simplify_options.preview_cell_size);
+  TriangleMesh preview_mesh;
+  ClusterVertices(*unsimplified_mesh, {{cell_size, cell_size, cell_size}},
+                  &preview_mesh);
+  for (auto& vertex : preview_mesh.vertex_positions) {
     for (int i = 0; i < 3; ++i) {
-      voxel_volume *= impl_->voxel_size[i];
+      vertex[i] = (vertex[i] + impl_->offset[i]) * impl_->voxel_size[i];
     }
-    simplify_options.max_quadrics_error *= voxel_volume * voxel_volume;
-    if (!SimplifyMesh(simplify_options, &triangle_mesh)) {
+  }
+  if (impl_->simplify_options.optimize_vertex_cache) {
+    OptimizeVertexCache(&preview_mesh);
+  }
+  auto encoded = std::make_shared<const std::string>(EncodeMesh(preview_mesh));
+  std::lock_guard<std::mutex> lock(impl_->mutex);
+  // The simplified mesh may have been computed concurrently.
+  auto it = impl_->simplified_meshes.find(object_id);
+  if (it != impl_->simplified_meshes.end()) {
+    return it->second;
+  }
+  return impl_->preview_meshes.emplace(object_id, std::move(encoded))
+      .first->second;
+}
+
+std::vector<EncodedMeshFragment>
+OnDemandObjectMeshGenerator::GetSimplifiedMeshFragments(
+    uint64_t object_id, const float fragment_size[3]) {
+  std::vector<EncodedMeshFragment> encoded_fragments;
+  std::shared_ptr<const std::string> encoded;
+  std::shared_ptr<const TriangleMesh> unsimplified_mesh;
+  {
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    auto it = impl_->simplified_meshes.find(object_id);
+    if (it != impl_->simplified_meshes.end()) {
+      encoded = it->second;
+    } else {
+      auto unsimplified_it = impl_->unsimplified_meshes.find(object_id);
+      if (unsimplified_it == impl_->unsimplified_meshes.end()) {
+        return encoded_fragments;
+      }
+      unsimplified_mesh = unsimplified_it->second;
+    }
+  }
+  TriangleMesh mesh;
+  if (encoded) {
+    // The simplified mesh is only cached in encoded form.
+    DecodeMesh(*encoded, &mesh);
+  } else {
+    OpenMeshTriangleMesh triangle_mesh;
+    if (!ComputeSimplifiedMesh(*unsimplified_mesh, impl_->simplify_options,
+                               impl_->voxel_size, impl_->offset,
+                               &triangle_mesh)) {
       // Can't happen.
-      return empty_string;
+      return encoded_fragments;
     }
+    ConvertFromOpenMeshTriangleMesh(triangle_mesh, &mesh);
+    if (impl_->simplify_options.optimize_vertex_cache) {
+      OptimizeVertexCache(&mesh);
+    }
+    encoded = std::make_shared<const std::string>(EncodeMesh(mesh));
+    std::lock_guard<std::mutex> lock(impl_->mutex);
+    impl_->unsimplified_meshes.erase(object_id);
+    impl_->preview_meshes.erase(object_id);
+    impl_->simplified_meshes.emplace(object_id, std::move(encoded));
   }
-  std::string encoded = EncodeMesh(triangle_mesh);
-  return impl_->simplified_meshes.emplace(object_id, std::move(encoded))
-      .first->second;
+  std::vector<MeshFragment> fragments;
+  SplitMeshIntoFragments(
+      mesh, {{fragment_size[0], fragment_size[1], fragment_size[2]}},
+      &fragments);
+  encoded_fragments.resize(fragments.size());
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    auto& fragment = fragments[i];
+    auto& encoded_fragment = encoded_fragments[i];
+    encoded_fragment.lower_bound = fragment.lower_bound;
+    encoded_fragment.upper_bound = fragment.upper_bound;
+    encoded_fragment.encoded_mesh = EncodeMesh(fragment.mesh);
+    fragment.mesh.clear();
+  }
+  return encoded_fragments;
 }
 
 #define DO_INSTANTIATE(Label)                                           \
@@ -17,9 +17,12 @@
 #ifndef NEUROGLANCER_ON_DEMAND_OBJECT_MESH_GENERATOR_H
 #define NEUROGLANCER_ON_DEMAND_OBJECT_MESH_GENERATOR_H
 
+#include <array>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace neuroglancer {
 namespace meshing {
@@ -34,6 +37,48 @@ struct SimplifyOptions {
   double max_normal_angle_deviation = 90;
 
   bool lock_boundary_vertices = true;
+
+  // If positive, simplification continues (in order of quadric error, but
+  // ignoring max_quadrics_error) until the mesh has at most this many faces.
+  // If the budget is unreachable because no further collapse is permitted by
+  // max_normal_angle_deviation and lock_boundary_vertices, the most simplified
+  // mesh reached is returned, even though it exceeds the budget.
+  int64_t max_faces = 0;
+
+  // If positive, the same as max_faces, but limits the size in bytes of the
+  // encoded mesh.
+  int64_t max_bytes = 0;
+
+  // If positive, max_quadrics_error applies to an object whose bounding box
+  // diagonal spans this many voxels, and is scaled for each object by the
+  // square of the ratio of its bounding box diagonal to this value.  This
+  // keeps the relative simplification level of small and large objects
+  // similar.
+  double adaptive_error_reference_extent = 0;
+
+  // Number of Taubin smoothing iterations applied to the marching cubes
+  // output prior to simplification.  Set this to 0 to disable smoothing.
+  int smoothing_iterations = 0;
+
+  // Taubin smoothing factors, see mesh_smoothing.h.
+  double smoothing_lambda = 0.5;
+  double smoothing_mu = -0.53;
+
+  // Grid cell size, in voxels, used by the vertex clustering simplifier that
+  // generates preview meshes.
+  double preview_cell_size = 4;
+
+  // Reorder the output triangles for GPU vertex cache locality, and renumber
+  // the vertices in order of first use.
+  bool optimize_vertex_cache = false;
+};
+
+struct EncodedMeshFragment {
+  // Bounding box of the vertices of the fragment.
+  std::array<float, 3> lower_bound;
+  std::array<float, 3> upper_bound;
+
+  std::string encoded_mesh;
 };
 
 class OnDemandObjectMeshGenerator {
@@ -49,7 +94,22 @@ class OnDemandObjectMeshGenerator {
                               const float offset[3],
                               const SimplifyOptions& simplify_options);
 
-  const std::string& GetSimplifiedMesh(uint64_t object_id);
+  // The methods below may be called concurrently.
+
+  // Returns the encoded simplified mesh, or nullptr if there is no mesh for
+  // the object.
+  std::shared_ptr<const std::string> GetSimplifiedMesh(uint64_t object_id);
+
+  // Returns a coarse mesh computed by vertex clustering, which is much
+  // faster to compute than the simplified mesh.  If the simplified mesh has
+  // already been computed, it is returned instead.
+  std::shared_ptr<const std::string> GetPreviewMesh(uint64_t object_id);
+
+  // Splits the simplified mesh into fragments on a grid with the specified
+  // cell size (in the output coordinate space), in grid order.  Returns an
+  // empty vector if there is no mesh for the object.
+  std::vector<EncodedMeshFragment> GetSimplifiedMeshFragments(
+      uint64_t object_id, const float fragment_size[3]);
   explicit operator bool() { return bool(impl_); }
   std::shared_ptr<Impl> impl_;
 };
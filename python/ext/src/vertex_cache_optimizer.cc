@@ -0,0 +1,169 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vertex_cache_optimizer.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+using VertexIndex = TriangleMesh::VertexIndex;
+using Triangle = std::array<VertexIndex, 3>;
+
+constexpr VertexIndex kInvalidVertex = std::numeric_limits<VertexIndex>::max();
+
+// Vertex-to-triangle adjacency in compressed sparse row form.
+struct VertexTriangleAdjacency {
+  // triangles[offsets[v]:offsets[v+1]] are the triangles that use vertex v.
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+
+  VertexTriangleAdjacency(const std::vector<Triangle>& mesh_triangles,
+                          size_t num_vertices)
+      : offsets(num_vertices + 1, 0),
+        triangles(mesh_triangles.size() * 3) {
+    for (const auto& triangle : mesh_triangles) {
+      for (auto v : triangle) ++offsets[v + 1];
+    }
+    for (size_t v = 0; v < num_vertices; ++v) {
+      offsets[v + 1] += offsets[v];
+    }
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < mesh_triangles.size(); ++t) {
+      for (auto v : mesh_triangles[t]) {
+        triangles[fill[v]++] = static_cast<uint32_t>(t);
+      }
+    }
+  }
+};
+
+// Returns the next fanning vertex once the current one has been exhausted, by
+// popping the dead-end stack, and falling back to a linear scan over the
+// vertices.  Returns kInvalidVertex once all triangles have been emitted.
+VertexIndex SkipDeadEnd(const std::vector<uint32_t>& live_triangles,
+                        std::vector<VertexIndex>* dead_end_stack,
+                        VertexIndex* cursor) {
+  while (!dead_end_stack->empty()) {
+    VertexIndex v = dead_end_stack->back();
+    dead_end_stack->pop_back();
+    if (live_triangles[v] > 0) return v;
+  }
+  for (; *cursor < live_triangles.size(); ++*cursor) {
+    if (live_triangles[*cursor] > 0) return *cursor;
+  }
+  return kInvalidVertex;
+}
+
+}  // namespace
+
+void OptimizeVertexCache(TriangleMesh* mesh, size_t cache_size) {
+  auto& triangles = mesh->triangles;
+  auto& vertex_positions = mesh->vertex_positions;
+  const size_t num_vertices = vertex_positions.size();
+  const size_t num_triangles = triangles.size();
+  if (num_triangles == 0) {
+    vertex_positions.clear();
+    return;
+  }
+
+  VertexTriangleAdjacency adjacency(triangles, num_vertices);
+
+  // Number of not-yet-emitted triangles that use each vertex.
+  std::vector<uint32_t> live_triangles(num_vertices);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    live_triangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+  }
+
+  // Simulated FIFO cache: a vertex is in the cache if
+  // timestamp - cache_time[v] <= cache_size.
+  std::vector<size_t> cache_time(num_vertices, 0);
+  size_t timestamp = cache_size + 1;
+
+  std::vector<bool> emitted(num_triangles, false);
+  std::vector<VertexIndex> dead_end_stack;
+  std::vector<VertexIndex> candidates;
+  std::vector<Triangle> output_triangles;
+  output_triangles.reserve(num_triangles);
+
+  VertexIndex cursor = 0;
+  VertexIndex fanning_vertex =
+      SkipDeadEnd(live_triangles, &dead_end_stack, &cursor);
+  while (fanning_vertex != kInvalidVertex) {
+    candidates.clear();
+    for (uint32_t i = adjacency.offsets[fanning_vertex],
+                  end = adjacency.offsets[fanning_vertex + 1];
+         i < end; ++i) {
+      const uint32_t t = adjacency.triangles[i];
+      if (emitted[t]) continue;
+      emitted[t] = true;
+      const auto& triangle = triangles[t];
+      output_triangles.push_back(triangle);
+      for (auto v : triangle) {
+        dead_end_stack.push_back(v);
+        candidates.push_back(v);
+        --live_triangles[v];
+        if (timestamp - cache_time[v] > cache_size) {
+          cache_time[v] = timestamp++;
+        }
+      }
+    }
+
+    // Choose the candidate that will remain in the cache the longest after
+    // emitting all of its remaining triangles.
+    VertexIndex best_vertex = kInvalidVertex;
+    size_t best_priority = 0;
+    for (auto v : candidates) {
+      if (live_triangles[v] == 0) continue;
+      size_t priority = 0;
+      if (timestamp - cache_time[v] + 2 * live_triangles[v] <= cache_size) {
+        priority = timestamp - cache_time[v];
+      }
+      if (best_vertex == kInvalidVertex || priority > best_priority) {
+        best_vertex = v;
+        best_priority = priority;
+      }
+    }
+    if (best_vertex == kInvalidVertex) {
+      best_vertex = SkipDeadEnd(live_triangles, &dead_end_stack, &cursor);
+    }
+    fanning_vertex = best_vertex;
+  }
+
+  // Renumber vertices in order of first use.
+  std::vector<VertexIndex> new_index(num_vertices, kInvalidVertex);
+  VertexPositions new_vertex_positions;
+  new_vertex_positions.reserve(num_vertices);
+  for (auto& triangle : output_triangles) {
+    for (auto& v : triangle) {
+      auto& mapped = new_index[v];
+      if (mapped == kInvalidVertex) {
+        mapped = static_cast<VertexIndex>(new_vertex_positions.size());
+        new_vertex_positions.push_back(vertex_positions[v]);
+      }
+      v = mapped;
+    }
+  }
+  triangles = std::move(output_triangles);
+  vertex_positions = std::move(new_vertex_positions);
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
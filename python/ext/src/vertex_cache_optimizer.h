@@ -0,0 +1,53 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Implements triangle and vertex reordering for GPU post-transform vertex
+// cache locality.
+//
+// Triangles are reordered using the Tipsify algorithm described in:
+//
+//   Sander, Nehab, and Barczak.  "Fast Triangle Reordering for Vertex
+//   Locality and Reduced Overdraw."  ACM Transactions on Graphics, 2007.
+//
+// Vertices are then renumbered in order of first use by the reordered
+// triangles, which also improves vertex fetch locality and makes the index
+// stream more compressible.
+
+#ifndef NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
+#define NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
+
+#include <cstddef>
+
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Default simulated post-transform cache size, in vertices.  Tipsify is not
+// very sensitive to this value; 16 is a reasonable choice for current GPUs.
+constexpr size_t kDefaultVertexCacheSize = 16;
+
+// Reorders the triangles of `mesh` for vertex cache locality, and then
+// renumbers the vertices in order of first use.  Vertices not referenced by
+// any triangle are removed.  The set of triangles (including the winding order
+// of each triangle) is unchanged.
+void OptimizeVertexCache(TriangleMesh* mesh,
+                         size_t cache_size = kDefaultVertexCacheSize);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_VERTEX_CACHE_OPTIMIZER_H_
@@ -0,0 +1,160 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vertex_cache_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mesh_objects.h"
+
+namespace {
+
+using neuroglancer::meshing::OptimizeVertexCache;
+using neuroglancer::meshing::TriangleMesh;
+using neuroglancer::meshing::Vector3d;
+using Position = std::array<float, 3>;
+using PositionTriangle = std::array<Position, 3>;
+
+// Returns the triangles of `mesh` in terms of vertex positions, each rotated
+// to start at its smallest vertex (which preserves the winding order), in
+// sorted order.
+std::vector<PositionTriangle> GetCanonicalTriangles(const TriangleMesh& mesh) {
+  std::vector<PositionTriangle> triangles;
+  for (const auto& triangle : mesh.triangles) {
+    PositionTriangle positions;
+    for (int i = 0; i < 3; ++i) {
+      positions[i] = mesh.vertex_positions[triangle[i]];
+    }
+    std::rotate(positions.begin(),
+                std::min_element(positions.begin(), positions.end()),
+                positions.end());
+    triangles.push_back(positions);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+// Returns the sorted vertex positions of `mesh`.
+std::vector<Position> GetSortedPositions(const TriangleMesh& mesh) {
+  std::vector<Position> positions = mesh.vertex_positions;
+  std::sort(positions.begin(), positions.end());
+  return positions;
+}
+
+// Returns the average number of misses per triangle of a FIFO vertex cache
+// of the specified size.
+double GetAverageCacheMissRatio(const TriangleMesh& mesh, size_t cache_size) {
+  std::vector<size_t> cache_time(mesh.vertex_positions.size(), 0);
+  size_t timestamp = cache_size + 1;
+  size_t misses = 0;
+  for (const auto& triangle : mesh.triangles) {
+    for (auto v : triangle) {
+      if (timestamp - cache_time[v] > cache_size) {
+        cache_time[v] = timestamp++;
+        ++misses;
+      }
+    }
+  }
+  return static_cast<double>(misses) / mesh.triangles.size();
+}
+
+// Returns a grid of n x n squares, each split into two triangles, in
+// row-major order.
+TriangleMesh MakeGridMesh(uint32_t n) {
+  TriangleMesh mesh;
+  for (uint32_t y = 0; y <= n; ++y) {
+    for (uint32_t x = 0; x <= n; ++x) {
+      mesh.vertex_positions.push_back(
+          {{static_cast<float>(x), static_cast<float>(y), 0}});
+    }
+  }
+  for (uint32_t y = 0; y < n; ++y) {
+    for (uint32_t x = 0; x < n; ++x) {
+      const uint32_t v = y * (n + 1) + x;
+      mesh.triangles.push_back({{v, v + 1, v + n + 2}});
+      mesh.triangles.push_back({{v, v + n + 2, v + n + 1}});
+    }
+  }
+  return mesh;
+}
+
+// Returns the surface mesh of a voxelized sphere.
+TriangleMesh MakeSphereMesh(int64_t radius) {
+  const int64_t size = 2 * radius + 4;
+  std::vector<uint32_t> labels(size * size * size, 0);
+  for (int64_t z = 0; z < size; ++z) {
+    for (int64_t y = 0; y < size; ++y) {
+      for (int64_t x = 0; x < size; ++x) {
+        const int64_t dx = x - size / 2, dy = y - size / 2, dz = z - size / 2;
+        if (dx * dx + dy * dy + dz * dz <= radius * radius) {
+          labels[x + size * (y + size * z)] = 1;
+        }
+      }
+    }
+  }
+  std::unordered_map<uint64_t, TriangleMesh> meshes;
+  neuroglancer::meshing::MeshObjects(labels.data(), Vector3d{{size, size, size}},
+                                     Vector3d{{1, size, size * size}}, &meshes);
+  return meshes[1];
+}
+
+void ExpectSameMesh(const TriangleMesh& expected, const TriangleMesh& actual) {
+  EXPECT_EQ(expected.triangles.size(), actual.triangles.size());
+  EXPECT_EQ(GetCanonicalTriangles(expected), GetCanonicalTriangles(actual));
+  EXPECT_EQ(GetSortedPositions(expected), GetSortedPositions(actual));
+}
+
+TEST(VertexCacheOptimizerTest, PreservesTrianglesAndVertices) {
+  for (const auto& mesh : {MakeSphereMesh(10), MakeGridMesh(37)}) {
+    ASSERT_GT(mesh.triangles.size(), 0);
+    for (size_t cache_size : {3, 16, 32}) {
+      TriangleMesh optimized = mesh;
+      OptimizeVertexCache(&optimized, cache_size);
+      ExpectSameMesh(mesh, optimized);
+    }
+  }
+}
+
+TEST(VertexCacheOptimizerTest, ReducesCacheMisses) {
+  for (const auto& mesh : {MakeGridMesh(64), MakeSphereMesh(16)}) {
+    TriangleMesh optimized = mesh;
+    OptimizeVertexCache(&optimized);
+    const double before = GetAverageCacheMissRatio(mesh, 16);
+    const double after = GetAverageCacheMissRatio(optimized, 16);
+    EXPECT_LT(after, before);
+    EXPECT_LT(after, 0.8);
+  }
+}
+
+TEST(VertexCacheOptimizerTest, RemovesUnreferencedVertices) {
+  TriangleMesh mesh;
+  mesh.vertex_positions = {{{0, 0, 0}}, {{5, 5, 5}}, {{1, 0, 0}}, {{0, 1, 0}}};
+  mesh.triangles = {{{0, 2, 3}}};
+  OptimizeVertexCache(&mesh);
+  ASSERT_EQ(3, mesh.vertex_positions.size());
+  EXPECT_EQ((std::vector<std::array<uint32_t, 3>>{{{0, 1, 2}}}), mesh.triangles);
+
+  mesh.triangles.clear();
+  OptimizeVertexCache(&mesh);
+  EXPECT_TRUE(mesh.vertex_positions.empty());
+}
+
+}  // namespace
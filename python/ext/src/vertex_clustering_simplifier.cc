@@ -0,0 +1,194 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vertex_clustering_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace neuroglancer {
+namespace meshing {
+
+namespace {
+
+using VertexIndex = TriangleMesh::VertexIndex;
+
+// Symmetric 4x4 error quadric, see Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics", SIGGRAPH 1997.
+//
+// The error of position p is p^T A p + 2 b^T p + c.
+struct Quadric {
+  // Upper triangle of A: a00, a01, a02, a11, a12, a22.
+  double a[6] = {0, 0, 0, 0, 0, 0};
+  double b[3] = {0, 0, 0};
+  double c = 0;
+
+  // Adds the quadric of the plane n^T p + d = 0, weighted by `weight`.  `n`
+  // must be a unit vector.
+  void AddPlane(const double n[3], double d, double weight) {
+    a[0] += weight * n[0] * n[0];
+    a[1] += weight * n[0] * n[1];
+    a[2] += weight * n[0] * n[2];
+    a[3] += weight * n[1] * n[1];
+    a[4] += weight * n[1] * n[2];
+    a[5] += weight * n[2] * n[2];
+    for (int i = 0; i < 3; ++i) b[i] += weight * n[i] * d;
+    c += weight * d * d;
+  }
+
+  // Computes the position minimizing the error.  Returns false if the system
+  // is too poorly conditioned, e.g. when all incident triangles are
+  // coplanar.
+  bool Minimize(double result[3]) const {
+    const double m00 = a[0], m01 = a[1], m02 = a[2], m11 = a[3], m12 = a[4],
+                 m22 = a[5];
+    const double c00 = m11 * m22 - m12 * m12;
+    const double c01 = m02 * m12 - m01 * m22;
+    const double c02 = m01 * m12 - m02 * m11;
+    const double det = m00 * c00 + m01 * c01 + m02 * c02;
+    const double trace = m00 + m11 + m22;
+    if (!(std::abs(det) > 1e-3 * trace * trace * trace)) return false;
+    const double c11 = m00 * m22 - m02 * m02;
+    const double c12 = m01 * m02 - m00 * m12;
+    const double c22 = m00 * m11 - m01 * m01;
+    const double inv_det = 1.0 / det;
+    result[0] = -(c00 * b[0] + c01 * b[1] + c02 * b[2]) * inv_det;
+    result[1] = -(c01 * b[0] + c11 * b[1] + c12 * b[2]) * inv_det;
+    result[2] = -(c02 * b[0] + c12 * b[1] + c22 * b[2]) * inv_det;
+    return true;
+  }
+};
+
+struct Cluster {
+  Quadric quadric;
+  double sum[3] = {0, 0, 0};
+  uint32_t count = 0;
+  int64_t cell[3];
+};
+
+struct HashTriangle {
+  size_t operator()(const std::array<VertexIndex, 3>& t) const {
+    uint64_t h = t[0];
+    h = h * 0x9e3779b97f4a7c15ull + t[1];
+    h = h * 0x9e3779b97f4a7c15ull + t[2];
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+};
+
+}  // namespace
+
+void ClusterVertices(const TriangleMesh& input,
+                     const std::array<float, 3>& cell_size,
+                     TriangleMesh* output) {
+  output->clear();
+  const size_t num_vertices = input.vertex_positions.size();
+
+  // Assign each vertex to a cluster.
+  std::vector<VertexIndex> vertex_cluster(num_vertices);
+  std::vector<Cluster> clusters;
+  {
+    std::unordered_map<uint64_t, VertexIndex> cell_to_cluster;
+    for (size_t v = 0; v < num_vertices; ++v) {
+      auto const& position = input.vertex_positions[v];
+      int64_t cell[3];
+      uint64_t key = 0;
+      for (int i = 0; i < 3; ++i) {
+        cell[i] = static_cast<int64_t>(std::floor(position[i] / cell_size[i]));
+        key = (key << 21) | (static_cast<uint64_t>(cell[i]) & 0x1fffff);
+      }
+      auto result = cell_to_cluster.emplace(
+          key, static_cast<VertexIndex>(clusters.size()));
+      if (result.second) {
+        clusters.emplace_back();
+        std::copy(cell, cell + 3, clusters.back().cell);
+      }
+      auto& cluster = clusters[result.first->second];
+      for (int i = 0; i < 3; ++i) cluster.sum[i] += position[i];
+      ++cluster.count;
+      vertex_cluster[v] = result.first->second;
+    }
+  }
+
+  // Accumulate area-weighted plane quadrics, and collect the non-degenerate
+  // triangles between clusters.
+  std::unordered_set<std::array<VertexIndex, 3>, HashTriangle> seen_triangles;
+  for (auto const& triangle : input.triangles) {
+    auto const& p0 = input.vertex_positions[triangle[0]];
+    auto const& p1 = input.vertex_positions[triangle[1]];
+    auto const& p2 = input.vertex_positions[triangle[2]];
+    double e1[3], e2[3], n[3];
+    for (int i = 0; i < 3; ++i) {
+      e1[i] = p1[i] - p0[i];
+      e2[i] = p2[i] - p0[i];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    const double norm = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (norm > 0) {
+      for (int i = 0; i < 3; ++i) n[i] /= norm;
+      const double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+      const double area = 0.5 * norm;
+      for (auto v : triangle) {
+        clusters[vertex_cluster[v]].quadric.AddPlane(n, d, area);
+      }
+    }
+
+    std::array<VertexIndex, 3> new_triangle = {{vertex_cluster[triangle[0]],
+                                                vertex_cluster[triangle[1]],
+                                                vertex_cluster[triangle[2]]}};
+    if (new_triangle[0] == new_triangle[1] ||
+        new_triangle[1] == new_triangle[2] ||
+        new_triangle[0] == new_triangle[2]) {
+      continue;
+    }
+    // Rotate the smallest index to the front, preserving orientation, so that
+    // duplicate triangles can be detected.
+    std::rotate(new_triangle.begin(),
+                std::min_element(new_triangle.begin(), new_triangle.end()),
+                new_triangle.end());
+    if (seen_triangles.insert(new_triangle).second) {
+      output->triangles.push_back(new_triangle);
+    }
+  }
+
+  // Place each representative vertex.  If the quadric minimizer is not well
+  // defined, or lies outside of the cell (grown by half a cell on each side),
+  // the mean of the clustered vertices is used instead.
+  output->vertex_positions.resize(clusters.size());
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    auto const& cluster = clusters[i];
+    auto& position = output->vertex_positions[i];
+    double optimal[3];
+    bool use_optimal = cluster.quadric.Minimize(optimal);
+    for (int j = 0; j < 3 && use_optimal; ++j) {
+      const double lower = (cluster.cell[j] - 0.5) * cell_size[j];
+      const double upper = (cluster.cell[j] + 1.5) * cell_size[j];
+      if (!(optimal[j] >= lower && optimal[j] <= upper)) use_optimal = false;
+    }
+    for (int j = 0; j < 3; ++j) {
+      position[j] = static_cast<float>(use_optimal ? optimal[j]
+                                                   : cluster.sum[j] / cluster.count);
+    }
+  }
+}
+
+}  // namespace meshing
+}  // namespace neuroglancer
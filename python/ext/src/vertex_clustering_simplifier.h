@@ -0,0 +1,49 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Implements linear-time mesh simplification by vertex clustering.
+//
+// All vertices within the same cell of a regular grid are merged into a
+// single representative vertex, placed at the position minimizing the sum of
+// squared distances to the planes of the triangles incident to the cluster,
+// as described in:
+//
+//   Lindstrom.  "Out-of-Core Simplification of Large Polygonal Models."
+//   SIGGRAPH 2000.
+//
+// Triangles that become degenerate are dropped.  The result is of lower
+// quality than quadric edge-collapse decimation, but is computed in a small
+// fraction of the time, which makes it suitable as a quick preview.
+
+#ifndef NEUROGLANCER_VERTEX_CLUSTERING_SIMPLIFIER_H_
+#define NEUROGLANCER_VERTEX_CLUSTERING_SIMPLIFIER_H_
+
+#include "voxel_mesh_generator.h"
+
+namespace neuroglancer {
+namespace meshing {
+
+// Simplifies `input` by clustering its vertices on a grid with the specified
+// cell size (in the same units as the vertex positions), and stores the
+// result in `output`.
+void ClusterVertices(const TriangleMesh& input,
+                     const std::array<float, 3>& cell_size,
+                     TriangleMesh* output);
+
+}  // namespace meshing
+}  // namespace neuroglancer
+
+#endif  // NEUROGLANCER_VERTEX_CLUSTERING_SIMPLIFIER_H_
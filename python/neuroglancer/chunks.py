@@ -37,3 +37,122 @@ def encode_npz(subvol):
 
 def encode_raw(subvol):
     return subvol.tostring("C")
+
+
+def _check_compressed_segmentation_input(subvol):
+    if subvol.ndim not in (3, 4):
+        raise ValueError("compressed_segmentation encoding requires rank 3 or 4.")
+    if subvol.dtype not in (np.uint8, np.uint16, np.uint32, np.uint64):
+        raise ValueError(
+            "compressed_segmentation encoding requires unsigned integer data."
+        )
+
+
+def _convert_label_map(label_map, dtype):
+    if isinstance(label_map, dict):
+        keys = list(label_map.keys())
+        values = list(label_map.values())
+    else:
+        keys, values = label_map
+    keys = np.asarray(keys, dtype=dtype)
+    values = np.asarray(values, dtype=dtype)
+    if keys.ndim != 1 or keys.shape != values.shape:
+        raise ValueError("label_map keys and values must be 1-d of the same length.")
+    order = np.argsort(keys, kind="stable")
+    keys = keys[order]
+    values = values[order]
+    if np.any(keys[1:] == keys[:-1]):
+        raise ValueError("label_map keys must be distinct.")
+    return (keys, values)
+
+
+def encode_compressed_segmentation(
+    subvol, block_size, out=None, label_map=None, num_threads=1
+):
+    """Encodes an unsigned integer volume in the compressed_segmentation format.
+
+    uint8, uint16 and uint32 volumes are encoded in the uint32 format, and
+    uint64 volumes in the uint64 format.
+
+    @param subvol: Array of rank 3, or rank 4 where the last dimension is the
+        channel dimension.  As with the other encodings, the first dimension
+        varies fastest in the encoded representation.
+
+    @param block_size: Sequence [bx, by, bz] of block sizes.
+
+    @param out: Optional writable buffer, such as a bytearray or the buffer of
+        a multiprocessing.shared_memory.SharedMemory, into which the encoding
+        is written.  It must be 4-byte aligned and at least as large as the
+        encoding; compressed_segmentation_max_size gives a suitable size.
+
+    @param label_map: Optional mapping applied to the values of `subvol`,
+        specified as a dict or as a pair of (keys, values) sequences.  Values
+        not among the keys are unchanged.  The mapping is applied to the value
+        table of each block rather than to each voxel, so this is much cheaper
+        than mapping `subvol` before encoding it.
+
+    @param num_threads: Number of threads used to encode blocks.  The result
+        does not depend on it.
+
+    @return: The encoding as bytes, or the number of bytes written to `out`.
+    """
+    from . import _neuroglancer
+
+    _check_compressed_segmentation_input(subvol)
+    if out is not None:
+        out = np.frombuffer(out, dtype=np.uint8)
+    mapping = None
+    if label_map is not None:
+        mapping = _convert_label_map(label_map, subvol.dtype)
+    return _neuroglancer.compress_segmentation(
+        subvol.transpose(),
+        tuple(block_size),
+        out=out,
+        mapping=mapping,
+        num_threads=num_threads,
+    )
+
+
+def compressed_segmentation_max_size(subvol, block_size):
+    """Returns an upper bound on the size in bytes of the result of
+    encode_compressed_segmentation, without examining the values of `subvol`.
+    """
+    from . import _neuroglancer
+
+    _check_compressed_segmentation_input(subvol)
+    return _neuroglancer.get_compressed_segmentation_max_size(
+        subvol.transpose(), tuple(block_size)
+    )
+
+
+def encode_compresso(subvol, steps=(8, 8, 1), random_access_z_index=False):
+    """Encodes an integer volume in the compresso format.
+
+    For segmentations it is often several times smaller than
+    compressed_segmentation.
+
+    @param subvol: Array of rank at least 2.  As with the other encodings, the
+        first dimension varies fastest in the encoded representation; the
+        first two dimensions map to the compresso x and y dimensions, and the
+        remaining dimensions, including any channel dimension, are combined
+        into the z dimension.
+
+    @param steps: Sequence [x, y, z] of boundary window sizes, with a product
+        of at most 64.
+
+    @param random_access_z_index: Append a per-slice index so that slices can
+        be decoded independently.
+    """
+    from . import _neuroglancer
+
+    if subvol.ndim < 2:
+        raise ValueError("compresso encoding requires rank of at least 2.")
+    if subvol.dtype.kind not in "iu":
+        raise ValueError("compresso encoding requires integer data.")
+    subvol = np.ascontiguousarray(subvol.transpose())
+    subvol = subvol.reshape((-1,) + subvol.shape[-2:])
+    return _neuroglancer.compresso_compress(
+        subvol,
+        steps=tuple(steps),
+        random_access_z_index=random_access_z_index,
+    )
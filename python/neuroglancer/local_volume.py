@@ -24,7 +24,13 @@ except ImportError:
     ts = None
 
 from . import downsample, downsample_scales, trackable_state
-from .chunks import encode_jpeg, encode_npz, encode_raw
+from .chunks import (
+    encode_compressed_segmentation,
+    encode_compresso,
+    encode_jpeg,
+    encode_npz,
+    encode_raw,
+)
 from .coordinate_space import CoordinateSpace
 from .random_token import make_random_token
 
@@ -67,6 +73,16 @@ class LocalVolume(trackable_state.ChangeNotifier):
 
         @param data: Source data.
 
+        @param encoding: Chunk encoding: 'npz', 'raw', 'jpeg',
+            'compressed_segmentation', or 'compresso'.  The
+            'compressed_segmentation' encoding requires the native extension
+            module, and applies only to uint32 and uint64 data; it is much
+            smaller than 'npz' for segmentations and is decoded directly by
+            the viewer.  Other data types fall back to 'npz'.  The
+            'compresso' encoding also requires the native extension module,
+            and applies to integer data; it is often several times smaller
+            than 'compressed_segmentation'.  Float data falls back to 'npz'.
+
         @param downsampling: '3d' to use isotropic downsampling, '2d' to
             downsample separately in XY, XZ, and YZ, None to use no
             downsampling.
@@ -99,6 +115,41 @@ class LocalVolume(trackable_state.ChangeNotifier):
                   surface boundaries, which can only occur at the boundary of
                   the volume.  Defaults to true.
 
+                - max_faces: int.  If positive, simplification continues past
+                  max_quadrics_error, in order of increasing quadrics error,
+                  until each mesh has at most this many triangles.  If no
+                  further edge collapse is permitted before the limit is
+                  reached, the most simplified mesh is returned even though it
+                  exceeds the limit.  Defaults to 0 (no limit).
+
+                - max_bytes: int.  Like max_faces, but limits the size in
+                  bytes of each encoded mesh.  Defaults to 0 (no limit).
+
+                - adaptive_error_reference_extent: float.  If positive,
+                  max_quadrics_error applies to an object whose bounding box
+                  diagonal is this many voxels long, and is scaled for each
+                  object by the squared ratio of its own diagonal to this
+                  length.  Defaults to 0 (disabled).
+
+                - preview_cell_size: float.  Grid cell size, in voxels, of the
+                  vertex clustering used to compute preview meshes.  Defaults
+                  to 4.
+
+                - smoothing_iterations: int.  Number of volume-preserving
+                  Taubin smoothing iterations applied to the marching cubes
+                  output before simplification.  Smoothing removes voxel
+                  stair-stepping, which allows simplification to reach far
+                  fewer triangles for the same max_quadrics_error.  Defaults
+                  to 0 (disabled).
+
+                - smoothing_lambda, smoothing_mu: float.  Taubin smoothing
+                  factors.  Defaults to 0.5 and -0.53.
+
+                - optimize_vertex_cache: bool.  Reorder the triangles of each
+                  mesh for GPU vertex cache locality and renumber the vertices
+                  in order of first use, which speeds up rendering and makes
+                  the encoded mesh more compressible.  Defaults to false.
+
         """
         super().__init__()
         self.token = make_random_token()
@@ -191,7 +242,9 @@ class LocalVolume(trackable_state.ChangeNotifier):
 
         return info
 
-    def get_encoded_subvolume(self, data_format, start, end, scale_key):
+    def get_encoded_subvolume(
+        self, data_format, start, end, scale_key, block_size=None
+    ):
         rank = self.rank
         if len(start) != rank or len(end) != rank:
             raise ValueError("Invalid request")
@@ -235,17 +288,54 @@ class LocalVolume(trackable_state.ChangeNotifier):
             data = encode_npz(subvol)
         elif data_format == "raw":
             data = encode_raw(subvol)
+        elif data_format == "compressed_segmentation":
+            if block_size is None:
+                block_size = (8, 8, 8)
+            data = encode_compressed_segmentation(subvol, block_size)
+        elif data_format == "compresso":
+            data = encode_compresso(subvol)
         else:
             raise ValueError("Invalid data format requested.")
         return data, content_type
 
-    def get_object_mesh(self, object_id):
+    def get_object_mesh(self, object_id, preview=False):
+        """Returns the encoded mesh for the specified object.
+
+        @param preview: If true, returns a coarse mesh computed by vertex
+            clustering, which is much faster to compute than the simplified
+            mesh, unless the simplified mesh has already been computed.
+        """
         mesh_generator = self._get_mesh_generator()
-        data = mesh_generator.get_mesh(object_id)
+        data = mesh_generator.get_mesh(object_id, preview=preview)
         if data is None:
             raise InvalidObjectIdForMesh()
         return data
 
+    def get_object_mesh_fragments(self, object_id, fragment_size):
+        """Returns the mesh for the specified object split into fragments.
+
+        Triangles are assigned to cells of a grid with the specified
+        `fragment_size` (in the units of the coordinate space) by their
+        centroid.  Vertices shared between fragments are duplicated, so that
+        each fragment is a self-contained mesh.  The fragments are only
+        returned to the caller; the viewer still requests the whole mesh.
+
+        @return: A list of dicts with keys "lowerBound" and "upperBound"
+            specifying the bounding box of the fragment vertices, and "data"
+            specifying the encoded fragment mesh, in the same format as
+            returned by `get_object_mesh`.
+        """
+        mesh_generator = self._get_mesh_generator()
+        fragments = mesh_generator.get_mesh_fragments(
+            object_id, tuple(float(x) for x in fragment_size)
+        )
+        if fragments is None:
+            raise InvalidObjectIdForMesh()
+        return [
+            dict(lowerBound=list(lower), upperBound=list(upper), data=data)
+            for lower, upper, data in fragments
+        ]
+
     def _get_mesh_generator(self):
         if self._mesh_generator is not None:
             return self._mesh_generator
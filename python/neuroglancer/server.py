@@ -419,6 +419,9 @@ class SubvolumeHandler(BaseRequestHandler):
     async def get(self, data_format, token, scale_key, start, end):
         start_pos = np.array(start.split(","), dtype=np.int64)
         end_pos = np.array(end.split(","), dtype=np.int64)
+        block_size = self.get_argument("block_size", None)
+        if block_size is not None:
+            block_size = np.array(block_size.split(","), dtype=np.int64)
         vol = self.server.get_volume(token)
         if vol is None or not isinstance(vol, local_volume.LocalVolume):
             self.send_error(404)
@@ -432,6 +435,7 @@ class SubvolumeHandler(BaseRequestHandler):
                     start=start_pos,
                     end=end_pos,
                     scale_key=scale_key,
+                    block_size=block_size,
                 )
             )
         except ValueError as e:
@@ -444,6 +448,7 @@ class SubvolumeHandler(BaseRequestHandler):
 class MeshHandler(BaseRequestHandler):
     async def get(self, key, object_id):
         object_id = int(object_id)
+        preview = self.get_argument("quality", "full") == "preview"
         vol = self.server.get_volume(key)
         if vol is None or not isinstance(vol, local_volume.LocalVolume):
             self.send_error(404)
@@ -451,7 +456,7 @@ class MeshHandler(BaseRequestHandler):
 
         try:
             encoded_mesh = await asyncio.wrap_future(
-                self.server.executor.submit(vol.get_object_mesh, object_id)
+                self.server.executor.submit(vol.get_object_mesh, object_id, preview)
             )
         except local_volume.MeshImplementationNotAvailable:
             self.send_error(501, message="Mesh implementation not available")
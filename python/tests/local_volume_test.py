@@ -79,3 +79,405 @@ def test_tensorstore_features():
         names=["x", "y", "d2"], units=units, scales=scales
     )
     assert local_volume.dimensions.to_json() == dimensions.to_json()
+
+
+def _decode_compressed_segmentation(encoded, shape, dtype, block_size):
+    """Reference decoder for the compressed_segmentation format.
+
+    `shape` is (x, y, z, channels); returns an array indexed by [x, y, z, c].
+    """
+    words = np.frombuffer(encoded, dtype="<u4")
+    words_per_value = max(1, np.dtype(dtype).itemsize // 4)
+    grid_size = [-(-shape[i] // block_size[i]) for i in range(3)]
+    output = np.zeros(shape, dtype=dtype)
+    for c in range(shape[3]):
+        base = int(words[c])
+        for bz in range(grid_size[2]):
+            for by in range(grid_size[1]):
+                for bx in range(grid_size[0]):
+                    block_index = bx + grid_size[0] * (by + grid_size[1] * bz)
+                    header = base + 2 * block_index
+                    table_offset = base + int(words[header] & 0xFFFFFF)
+                    bits = int(words[header] >> 24)
+                    values_offset = base + int(words[header + 1])
+                    start = [bx, by, bz]
+                    for z in range(block_size[2]):
+                        for y in range(block_size[1]):
+                            for x in range(block_size[0]):
+                                pos = [
+                                    start[0] * block_size[0] + x,
+                                    start[1] * block_size[1] + y,
+                                    start[2] * block_size[2] + z,
+                                ]
+                                if any(pos[i] >= shape[i] for i in range(3)):
+                                    continue
+                                index = 0
+                                if bits:
+                                    bit = (
+                                        x + block_size[0] * (y + block_size[1] * z)
+                                    ) * bits
+                                    word = int(words[values_offset + bit // 32])
+                                    index = (word >> (bit % 32)) & ((1 << bits) - 1)
+                                entry = table_offset + index * words_per_value
+                                value = 0
+                                for i in range(words_per_value):
+                                    value |= int(words[entry + i]) << (32 * i)
+                                output[pos[0], pos[1], pos[2], c] = value
+    return output
+
+
+@pytest.mark.parametrize("dtype", [np.uint8, np.uint16, np.uint32, np.uint64])
+@pytest.mark.parametrize("rank", [3, 4])
+def test_compressed_segmentation_encoding(dtype, rank):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    rng = np.random.default_rng(0)
+    shape = (11, 7, 5, 2)[:rank]
+    data = rng.integers(0, 5, size=shape).astype(dtype)
+    data[:4, :4, :4] = np.iinfo(dtype).max
+    block_size = (4, 3, 2)
+    vol = neuroglancer.LocalVolume(data, volume_type="segmentation")
+    encoded, content_type = vol.get_encoded_subvolume(
+        data_format="compressed_segmentation",
+        start=np.zeros(rank, dtype=np.int64),
+        end=np.array(shape, dtype=np.int64),
+        scale_key=",".join(["1"] * rank),
+        block_size=block_size,
+    )
+    assert content_type == "application/octet-stream"
+    decoded = _decode_compressed_segmentation(
+        encoded, (shape + (1,))[:4], dtype, block_size
+    )
+    np.testing.assert_array_equal(decoded.reshape(shape), data)
+
+
+def test_compressed_segmentation_encoding_into_buffer():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import chunks
+
+    rng = np.random.default_rng(0)
+    data = rng.integers(0, 20, size=(9, 10, 11)).astype(np.uint64)
+    expected = chunks.encode_compressed_segmentation(data, (4, 4, 4))
+    max_size = chunks.compressed_segmentation_max_size(data, (4, 4, 4))
+    assert max_size >= len(expected)
+    out = bytearray(max_size)
+    size = chunks.encode_compressed_segmentation(data, (4, 4, 4), out=out)
+    assert bytes(out[:size]) == expected
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(data, (4, 4, 4), out=bytearray(4))
+
+
+def test_compressed_segmentation_encoding_threads():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import chunks
+
+    rng = np.random.default_rng(0)
+    data = rng.integers(0, 20, size=(2, 17, 30, 41)).astype(np.uint64)
+    expected = chunks.encode_compressed_segmentation(data, (8, 8, 4))
+    for num_threads in [2, 5]:
+        assert (
+            chunks.encode_compressed_segmentation(
+                data, (8, 8, 4), num_threads=num_threads
+            )
+            == expected
+        )
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(data, (8, 8, 4), num_threads=0)
+
+
+@pytest.mark.parametrize("dtype", [np.uint8, np.uint32, np.uint64])
+def test_compressed_segmentation_encoding_with_label_map(dtype):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import chunks
+
+    rng = np.random.default_rng(0)
+    data = rng.integers(0, 20, size=(9, 10, 11)).astype(dtype)
+    # Merges labels 0-9 in pairs, and leaves labels 15-19 unmapped.
+    label_map = {label: 100 - label // 2 for label in range(10)}
+    label_map.update({label: label + 50 for label in range(10, 15)})
+    lookup = np.arange(20, dtype=dtype)
+    for key, value in label_map.items():
+        lookup[key] = value
+    expected = chunks.encode_compressed_segmentation(lookup[data], (4, 4, 4))
+    assert (
+        chunks.encode_compressed_segmentation(data, (4, 4, 4), label_map=label_map)
+        == expected
+    )
+    keys = np.array(list(label_map.keys()))[::-1]
+    values = np.array(list(label_map.values()))[::-1]
+    assert (
+        chunks.encode_compressed_segmentation(data, (4, 4, 4), label_map=(keys, values))
+        == expected
+    )
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(
+            data, (4, 4, 4), label_map=([1, 1], [2, 3])
+        )
+
+
+@pytest.mark.parametrize("dtype", [np.int8, np.int32, np.int64])
+def test_compressed_segmentation_encoding_rejects_signed(dtype):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer, chunks
+
+    data = np.full((8, 8, 8), -1, dtype=dtype)
+    with pytest.raises(ValueError):
+        chunks.encode_compressed_segmentation(data, (4, 4, 4))
+    with pytest.raises(ValueError):
+        _neuroglancer.compress_segmentation(data, (4, 4, 4))
+    # Keys of -1 and 1 would be out of order if reinterpreted as unsigned.
+    mapping = (np.array([-1, 1], dtype=dtype), np.array([2, 3], dtype=dtype))
+    with pytest.raises(ValueError):
+        _neuroglancer.compress_segmentation(data, (4, 4, 4), mapping=mapping)
+    with pytest.raises(ValueError):
+        _neuroglancer.get_compressed_segmentation_max_size(data, (4, 4, 4))
+
+
+@pytest.mark.parametrize("dtype", [np.uint32, np.uint64])
+def test_compressed_segmentation_subvolume_decode(dtype):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    rng = np.random.default_rng(0)
+    # Indexed by [c, z, y, x].
+    data = rng.integers(0, 20, size=(2, 17, 30, 41)).astype(dtype)
+    data[1] += 100
+    block_size = (8, 8, 4)
+    encoded = _neuroglancer.compress_segmentation(data, block_size)
+    volume_size = data.shape[:0:-1]
+    uint64 = dtype == np.uint64
+    for channel in range(2):
+        decoded = _neuroglancer.decompress_segmentation(
+            encoded, volume_size, block_size, uint64=uint64, channel=channel
+        )
+        assert decoded.dtype == dtype
+        np.testing.assert_array_equal(decoded, data[channel])
+        np.testing.assert_array_equal(
+            _neuroglancer.get_compressed_segmentation_unique_values(
+                encoded, volume_size, block_size, uint64=uint64, channel=channel
+            ),
+            np.unique(data[channel]),
+        )
+    # Subvolume spanning partial blocks, a single z slice and a single voxel.
+    for begin, end in [
+        ((3, 5, 2), (37, 22, 15)),
+        ((0, 0, 9), (41, 30, 10)),
+        ((40, 29, 16), (41, 30, 17)),
+    ]:
+        decoded = _neuroglancer.decompress_segmentation(
+            encoded, volume_size, block_size, uint64=uint64, begin=begin, end=end
+        )
+        np.testing.assert_array_equal(
+            decoded,
+            data[0, begin[2] : end[2], begin[1] : end[1], begin[0] : end[0]],
+        )
+    keys = np.array([1, 5, 19], dtype=dtype)
+    values = np.array([7, 6, 5], dtype=dtype)
+    lookup = np.arange(20, dtype=dtype)
+    lookup[keys] = values
+    np.testing.assert_array_equal(
+        _neuroglancer.decompress_segmentation(
+            encoded, volume_size, block_size, uint64=uint64, mapping=(keys, values)
+        ),
+        lookup[data[0]],
+    )
+    with pytest.raises(ValueError):
+        _neuroglancer.decompress_segmentation(
+            encoded, volume_size, block_size, uint64=uint64, end=(42, 30, 17)
+        )
+    with pytest.raises(ValueError):
+        _neuroglancer.decompress_segmentation(
+            encoded, volume_size, block_size, uint64=uint64, channel=2**20
+        )
+    with pytest.raises(ValueError):
+        _neuroglancer.decompress_segmentation(
+            encoded[: len(encoded) // 2], volume_size, block_size, uint64=uint64
+        )
+    with pytest.raises(ValueError):
+        _neuroglancer.get_compressed_segmentation_unique_values(
+            encoded[:64], volume_size, block_size, uint64=uint64, channel=1
+        )
+
+
+@pytest.mark.parametrize("dtype", [np.uint8, np.int16, np.uint32, np.uint64])
+@pytest.mark.parametrize("rank", [3, 4])
+def test_compresso_encoding(dtype, rank):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    rng = np.random.default_rng(0)
+    shape = (3, 11, 17, 19)[-rank:]
+    data = (np.indices(shape).sum(axis=0) // 5).astype(dtype)
+    data[rng.random(shape) < 0.1] = np.iinfo(dtype).max
+    vol = neuroglancer.LocalVolume(data, volume_type="segmentation")
+    encoded, content_type = vol.get_encoded_subvolume(
+        data_format="compresso",
+        start=np.zeros(rank, dtype=np.int64),
+        end=np.array(shape, dtype=np.int64),
+        scale_key=",".join(["1"] * rank),
+    )
+    assert content_type == "application/octet-stream"
+    assert encoded[:4] == b"cpso"
+    # Decoded in the chunk layout of the viewer, with the first dimension
+    # varying fastest.
+    decoded = _neuroglancer.compresso_decompress(encoded)
+    assert decoded.tobytes() == data.tobytes(order="F")
+
+
+def _compresso_location_codes(encoded):
+    """Returns the location codes of a compresso stream with 16-bit windows."""
+    data_width = encoded[5]
+    id_size = int(np.frombuffer(encoded[15:23], dtype="<u8")[0])
+    value_size = int(np.frombuffer(encoded[23:27], dtype="<u4")[0])
+    location_size = int(np.frombuffer(encoded[27:35], dtype="<u8")[0])
+    start = 36 + id_size * data_width + value_size * 2
+    locations = np.frombuffer(
+        encoded[start : start + location_size * data_width],
+        dtype=f"<u{data_width}",
+    )
+    codes = []
+    i = 0
+    while i < len(locations):
+        codes.append(int(locations[i]))
+        # Code 6 is followed by a literal label.
+        i += 2 if locations[i] == 6 else 1
+    return codes
+
+
+def test_compresso_z_index():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer, chunks
+
+    data = np.repeat(np.arange(8, dtype=np.uint32), 64).reshape(8, 8, 8)
+    encoded = _neuroglancer.compresso_compress(
+        data, steps=(4, 4, 1), random_access_z_index=True
+    )
+    assert encoded[4] == 1
+    assert _neuroglancer.compresso_compress(data, steps=(4, 4, 1))[4] == 0
+    np.testing.assert_array_equal(_neuroglancer.compresso_decompress(encoded), data)
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_decompress(encoded[:-20])
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_compress(data, steps=(16, 8, 1))
+    with pytest.raises(ValueError):
+        chunks.encode_compresso(data.astype(np.float32))
+
+
+def test_compresso_range_decode():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.repeat(np.arange(8, dtype=np.uint32), 64).reshape(8, 8, 8)
+    encoded = _neuroglancer.compresso_compress(
+        data, steps=(4, 4, 1), random_access_z_index=True
+    )
+    np.testing.assert_array_equal(
+        _neuroglancer.compresso_decompress(encoded, z_start=3, z_end=5), data[3:5]
+    )
+    np.testing.assert_array_equal(
+        _neuroglancer.compresso_decompress(encoded, z_start=1), data[1:]
+    )
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_decompress(encoded, z_start=5, z_end=5)
+
+
+def test_compresso_threads():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.repeat(np.arange(8, dtype=np.uint32), 64).reshape(8, 8, 8)
+    encoded = _neuroglancer.compresso_compress(
+        data, steps=(4, 4, 1), random_access_z_index=True
+    )
+    np.testing.assert_array_equal(
+        _neuroglancer.compresso_decompress(encoded, z_start=1, num_threads=3), data[1:]
+    )
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_decompress(encoded, num_threads=0)
+
+
+def test_compresso_threads_linked_slices():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    # Pairs of slices share labels, so that without a z index, location codes
+    # 4 and 5 refer to the neighboring slices and restrict where the decoder
+    # can split the volume between threads.
+    rng = np.random.default_rng(0)
+    shape = (23, 17, 29)
+    z, y, x = np.indices(shape)
+    data = ((x // 5 + 3 * (y // 4) + 7 * (z // 2)) % 41).astype(np.uint32)
+    noise = rng.random(shape) < 0.1
+    data[noise] = rng.integers(0, 41, noise.sum())
+    encoded = _neuroglancer.compresso_compress(data, steps=(4, 4, 1))
+    assert encoded[4] == 0
+    assert encoded[35] == 4
+    codes = _compresso_location_codes(encoded)
+    assert 4 in codes
+    assert 5 in codes
+    for num_threads in [2, 3, 8, 64]:
+        np.testing.assert_array_equal(
+            _neuroglancer.compresso_decompress(encoded, num_threads=num_threads), data
+        )
+        np.testing.assert_array_equal(
+            _neuroglancer.compresso_decompress(
+                encoded, z_start=5, z_end=12, num_threads=num_threads
+            ),
+            data[5:12],
+        )
+
+
+def test_compresso_mapping():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.repeat(np.arange(8, dtype=np.uint32), 64).reshape(8, 8, 8)
+    encoded = _neuroglancer.compresso_compress(
+        data, steps=(4, 4, 1), random_access_z_index=True
+    )
+    mapping = (
+        np.array([1, 3, 7], dtype=np.uint64),
+        np.array([10, 0, 20], dtype=np.uint64),
+    )
+    np.testing.assert_array_equal(
+        _neuroglancer.compresso_decompress(encoded, z_start=1, mapping=mapping),
+        np.choose(data[1:], [0, 10, 2, 0, 4, 5, 6, 20]),
+    )
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_decompress(encoded, mapping=([3, 1], [0, 0]))
+
+
+def test_compresso_labels():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer, chunks
+
+    data = np.arange(6 * 7 * 8, dtype=np.uint16).reshape(6, 7, 8) // 17 * 5
+    encoded = chunks.encode_compresso(data)
+    labels, counts = np.unique(data, return_counts=True)
+    unique = _neuroglancer.compresso_labels(encoded)
+    assert unique.dtype == np.uint16
+    np.testing.assert_array_equal(unique, labels)
+    unique, unique_counts = _neuroglancer.compresso_labels(encoded, counts=True)
+    np.testing.assert_array_equal(unique, labels)
+    np.testing.assert_array_equal(unique_counts, counts)
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_labels(encoded[:20])
+
+
+@pytest.mark.parametrize("dtype", [np.uint8, np.uint32, np.uint64])
+@pytest.mark.parametrize("connectivity", [4, 6])
+def test_compresso_to_compressed_segmentation(dtype, connectivity):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    rng = np.random.default_rng(0)
+    data = (np.indices((13, 10, 11)).sum(axis=0) // 4).astype(dtype)
+    data[rng.random(data.shape) < 0.1] = 7
+    encoded = _neuroglancer.compresso_compress(data, (8, 8, 1), connectivity)
+    for block_size in [(4, 4, 4), (8, 3, 5)]:
+        assert _neuroglancer.compresso_to_compressed_segmentation(
+            encoded, block_size
+        ) == _neuroglancer.compress_segmentation(data, block_size)
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_to_compressed_segmentation(encoded, (4, 0, 4))
+    with pytest.raises(ValueError):
+        _neuroglancer.compresso_to_compressed_segmentation(encoded[:20], (4, 4, 4))
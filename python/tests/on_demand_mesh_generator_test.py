@@ -13,6 +13,7 @@
 # limitations under the License.
 
 
+import concurrent.futures
 import os
 import platform
 
@@ -54,3 +55,218 @@ def test_simple_mesh():
     test_util.check_golden_contents(
         os.path.join(testdata_dir, "simple2"), vol.get_object_mesh(2)
     )
+
+
+def test_preview_mesh():
+    data = np.zeros((32, 32, 32), dtype=np.uint32)
+    data[4:28, 4:28, 4:28] = 1
+    dimensions = viewer_state.CoordinateSpace(
+        names=["x", "y", "z"],
+        scales=[1, 1, 1],
+        units=["m", "m", "m"],
+    )
+    vol = local_volume.LocalVolume(
+        data,
+        dimensions=dimensions,
+        mesh_options=dict(
+            max_quadrics_error=-1,
+        ),
+    )
+    preview = vol.get_object_mesh(1, preview=True)
+    full = vol.get_object_mesh(1)
+    assert len(preview) < len(full)
+    # Once the full mesh is available, it is also returned for preview requests.
+    assert vol.get_object_mesh(1, preview=True) == full
+
+
+@pytest.mark.parametrize("preview_cell_size", [0, -1, float("nan")])
+def test_preview_cell_size_validation(preview_cell_size):
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.zeros((8, 8, 8), dtype=np.uint32)
+    with pytest.raises(ValueError):
+        _neuroglancer.OnDemandObjectMeshGenerator(
+            data, (1, 1, 1), (0, 0, 0), preview_cell_size=preview_cell_size
+        )
+
+
+def test_concurrent_preview_and_full_meshes():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.zeros((32, 32, 32), dtype=np.uint32)
+    for i in range(4):
+        for j in range(4):
+            data[2:30, i * 8 + 1 : i * 8 + 7, j * 8 + 1 : j * 8 + 7] = 1 + i * 4 + j
+    object_ids = list(range(1, 17))
+
+    def make_generator():
+        return _neuroglancer.OnDemandObjectMeshGenerator(
+            data, (1, 1, 1), (0, 0, 0), max_quadrics_error=-1
+        )
+
+    generator = make_generator()
+    previews = {i: generator.get_mesh(i, preview=True) for i in object_ids}
+    full = {i: generator.get_mesh(i) for i in object_ids}
+
+    # The full mesh replaces the cached preview mesh while other threads may
+    # still be returning it.
+    for _ in range(5):
+        generator = make_generator()
+        requests = [(i, preview) for i in object_ids for preview in (True, False)]
+        with concurrent.futures.ThreadPoolExecutor(max_workers=8) as executor:
+            results = list(
+                executor.map(
+                    lambda request: generator.get_mesh(request[0], preview=request[1]),
+                    requests,
+                )
+            )
+        for (i, preview), result in zip(requests, results):
+            if preview:
+                assert result in (previews[i], full[i])
+            else:
+                assert result == full[i]
+
+
+def test_mesh_fragments():
+    data = np.zeros((32, 32, 32), dtype=np.uint32)
+    data[4:28, 4:28, 4:28] = 1
+    dimensions = viewer_state.CoordinateSpace(
+        names=["x", "y", "z"],
+        scales=[1, 1, 1],
+        units=["m", "m", "m"],
+    )
+    vol = local_volume.LocalVolume(data, dimensions=dimensions)
+    fragments = vol.get_object_mesh_fragments(1, (16, 16, 16))
+    assert len(fragments) == 8
+    for fragment in fragments:
+        assert all(
+            lower <= upper
+            for lower, upper in zip(fragment["lowerBound"], fragment["upperBound"])
+        )
+        num_vertices = np.frombuffer(fragment["data"][:4], dtype="<u4")[0]
+        assert num_vertices > 0
+
+
+def test_mesh_generator_positional_arguments():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    data = np.zeros((16, 16, 16), dtype=np.uint32)
+    data[3:13, 4:12, 2:14] = 1
+    # Options added later are appended to the argument list, so existing
+    # positional arguments keep their meaning.
+    positional = _neuroglancer.OnDemandObjectMeshGenerator(
+        data, (1, 1, 1), (0, 0, 0), 1e6, 90, True, True
+    )
+    keyword = _neuroglancer.OnDemandObjectMeshGenerator(
+        data,
+        (1, 1, 1),
+        (0, 0, 0),
+        max_quadrics_error=1e6,
+        max_normal_angle_deviation=90,
+        lock_boundary_vertices=True,
+        optimize_vertex_cache=True,
+    )
+    unoptimized = _neuroglancer.OnDemandObjectMeshGenerator(
+        data, (1, 1, 1), (0, 0, 0), 1e6, 90, True, False
+    )
+    assert positional.get_mesh(1) == keyword.get_mesh(1)
+    assert positional.get_mesh(1) != unoptimized.get_mesh(1)
+
+
+def _decode_mesh(encoded):
+    num_vertices = np.frombuffer(encoded[:4], dtype="<u4")[0]
+    vertices = np.frombuffer(encoded[4 : 4 + 12 * num_vertices], dtype="<f4")
+    triangles = np.frombuffer(encoded[4 + 12 * num_vertices :], dtype="<u4")
+    return vertices.reshape(-1, 3), triangles.reshape(-1, 3)
+
+
+def test_mesh_smoothing():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    size = 32
+    center = (size - 1) / 2
+    data = ((np.indices((size,) * 3) - center) ** 2).sum(axis=0) <= 12**2
+
+    def get_mesh(**kwargs):
+        # Simplification is disabled, so that the smoothed vertices are
+        # returned as is.
+        generator = _neuroglancer.OnDemandObjectMeshGenerator(
+            data.astype(np.uint32),
+            (1, 1, 1),
+            (0, 0, 0),
+            max_quadrics_error=-1,
+            **kwargs,
+        )
+        return generator.get_mesh(1)
+
+    original = get_mesh()
+    assert get_mesh(smoothing_iterations=0) == original
+    vertices, triangles = _decode_mesh(original)
+    smoothed_vertices, smoothed_triangles = _decode_mesh(
+        get_mesh(smoothing_iterations=20)
+    )
+    assert smoothed_vertices.shape == vertices.shape
+    np.testing.assert_array_equal(smoothed_triangles, triangles)
+    assert not np.allclose(smoothed_vertices, vertices)
+
+    # Taubin smoothing barely shrinks the sphere.
+    centroid = vertices.mean(axis=0)
+    smoothed_centroid = smoothed_vertices.mean(axis=0)
+    np.testing.assert_allclose(smoothed_centroid, centroid, atol=0.01)
+    radius = np.linalg.norm(vertices - centroid, axis=1).mean()
+    smoothed_radius = np.linalg.norm(
+        smoothed_vertices - smoothed_centroid, axis=1
+    ).mean()
+    assert abs(smoothed_radius - radius) < 0.01 * radius
+
+
+def test_mesh_budget():
+    pytest.importorskip("neuroglancer._neuroglancer")
+    from neuroglancer import _neuroglancer
+
+    size = 32
+    center = (size - 1) / 2
+    data = ((np.indices((size,) * 3) - center) ** 2).sum(axis=0) <= 12**2
+
+    def get_mesh(max_quadrics_error=-1, **kwargs):
+        generator = _neuroglancer.OnDemandObjectMeshGenerator(
+            data.astype(np.uint32),
+            (1, 1, 1),
+            (0, 0, 0),
+            max_quadrics_error=max_quadrics_error,
+            **kwargs,
+        )
+        return generator.get_mesh(1)
+
+    # A budget that the error-bounded simplification already meets has no
+    # effect.
+    assert get_mesh(1, max_bytes=10**6) == get_mesh(1)
+
+    num_faces = len(_decode_mesh(get_mesh())[1])
+
+    # The face count for max_bytes is estimated from the unsimplified mesh,
+    # which undershoots the vertex to face ratio of the simplified mesh, so
+    # this budget is only met after retrying.
+    encoded = get_mesh(max_bytes=3000)
+    assert 2500 < len(encoded) <= 3000
+
+    _, triangles = _decode_mesh(get_mesh(max_faces=100))
+    assert 90 < len(triangles) <= 100 < num_faces
+
+    encoded = get_mesh(max_faces=100, max_bytes=1000)
+    _, triangles = _decode_mesh(encoded)
+    assert len(encoded) <= 1000
+    assert len(triangles) <= 100
+
+    # A closed mesh cannot be simplified below a few faces, so the most
+    # simplified mesh is returned when the budget is unreachable.
+    encoded = get_mesh(max_bytes=50)
+    assert len(encoded) > 50
+    assert encoded == get_mesh(max_faces=1)
+    vertices, triangles = _decode_mesh(encoded)
+    assert 0 < len(triangles) < 100
+    assert triangles.max() < len(vertices)
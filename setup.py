@@ -26,6 +26,7 @@ src_dir = os.path.join(python_dir, "ext", "src")
 openmesh_dir = os.path.join(
     python_dir, "ext", "third_party", "openmesh", "OpenMesh", "src"
 )
+compresso_dir = os.path.join(root_dir, "src", "sliceview", "compresso")
 
 
 def _read_requirements(path: str) -> list[str]:
@@ -258,10 +259,15 @@ class BundleClientCommand(
 
 local_sources = [
     "_neuroglancer.cc",
+    "compress_segmentation.cc",
     "openmesh_dependencies.cc",
     "on_demand_object_mesh_generator.cc",
     "voxel_mesh_generator.cc",
+    "mesh_fragments.cc",
     "mesh_objects.cc",
+    "mesh_smoothing.cc",
+    "vertex_cache_optimizer.cc",
+    "vertex_clustering_simplifier.cc",
 ]
 
 USE_OMP = False
@@ -328,7 +334,7 @@ setuptools.setup(
             "neuroglancer._neuroglancer",
             sources=[os.path.join(src_dir, name) for name in local_sources],
             language="c++",
-            include_dirs=[openmesh_dir],
+            include_dirs=[openmesh_dir, compresso_dir],
             define_macros=[
                 ("_USE_MATH_DEFINES", None),  # Needed by OpenMesh when used with MSVC
                 ("Py_LIMITED_API", "0x03090000"),
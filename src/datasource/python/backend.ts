@@ -30,6 +30,8 @@ import {
 } from "#src/mesh/backend.js";
 import { SkeletonChunk, SkeletonSource } from "#src/skeleton/backend.js";
 import { decodeSkeletonChunk } from "#src/skeleton/decode_precomputed_skeleton.js";
+import { decodeCompressedSegmentationChunk } from "#src/sliceview/backend_chunk_decoders/compressed_segmentation.js";
+import { decodeCompressoChunk } from "#src/sliceview/backend_chunk_decoders/compresso.js";
 import { ChunkDecoder } from "#src/sliceview/backend_chunk_decoders/index.js";
 import { decodeJpegChunk } from "#src/sliceview/backend_chunk_decoders/jpeg.js";
 import { decodeNdstoreNpzChunk } from "#src/sliceview/backend_chunk_decoders/ndstoreNpz.js";
@@ -39,6 +41,7 @@ import {
   VolumeChunkSource,
 } from "#src/sliceview/volume/backend.js";
 import { CancellationToken } from "#src/util/cancellation.js";
+import { DataType } from "#src/util/data_type.js";
 import { Endianness } from "#src/util/endian.js";
 import {
   cancellableFetchOk,
@@ -50,14 +53,28 @@ const chunkDecoders = new Map<VolumeChunkEncoding, ChunkDecoder>();
 chunkDecoders.set(VolumeChunkEncoding.NPZ, decodeNdstoreNpzChunk);
 chunkDecoders.set(VolumeChunkEncoding.JPEG, decodeJpegChunk);
 chunkDecoders.set(VolumeChunkEncoding.RAW, decodeRawChunk);
+chunkDecoders.set(
+  VolumeChunkEncoding.COMPRESSED_SEGMENTATION,
+  decodeCompressedSegmentationChunk,
+);
+chunkDecoders.set(VolumeChunkEncoding.COMPRESSO, decodeCompressoChunk);
 
 @registerSharedObject()
 export class PythonVolumeChunkSource extends WithParameters(
   VolumeChunkSource,
   VolumeChunkSourceParameters,
 ) {
-  chunkDecoder = chunkDecoders.get(this.parameters["encoding"])!;
-  encoding = VolumeChunkEncoding[this.parameters.encoding].toLowerCase();
+  // The server can only produce the compressed_segmentation encoding when the chunks are stored in
+  // that format, and the compresso encoding for integer data; otherwise, fall back to npz.
+  effectiveEncoding =
+    (this.parameters.encoding === VolumeChunkEncoding.COMPRESSED_SEGMENTATION &&
+      this.spec.compressedSegmentationBlockSize === undefined) ||
+    (this.parameters.encoding === VolumeChunkEncoding.COMPRESSO &&
+      this.spec.dataType === DataType.FLOAT32)
+      ? VolumeChunkEncoding.NPZ
+      : this.parameters.encoding;
+  chunkDecoder = chunkDecoders.get(this.effectiveEncoding)!;
+  encoding = VolumeChunkEncoding[this.effectiveEncoding].toLowerCase();
 
   async download(chunk: VolumeChunk, cancellationToken: CancellationToken) {
     const { parameters } = this;
@@ -74,6 +91,12 @@ export class PythonVolumeChunkSource extends WithParameters(
         path += (chunkPosition[i] + chunkDataSize[i]).toString();
       }
     }
+    if (
+      this.effectiveEncoding === VolumeChunkEncoding.COMPRESSED_SEGMENTATION
+    ) {
+      const blockSize = this.spec.compressedSegmentationBlockSize!;
+      path += `?block_size=${blockSize[0]},${blockSize[1]},${blockSize[2]}`;
+    }
     const response = await cancellableFetchOk(
       new URL(path, parameters.baseUrl).href,
       {},
@@ -20,6 +20,8 @@ export enum VolumeChunkEncoding {
   JPEG = 0,
   NPZ = 1,
   RAW = 2,
+  COMPRESSED_SEGMENTATION = 3,
+  COMPRESSO = 4,
 }
 
 export class PythonSourceParameters {
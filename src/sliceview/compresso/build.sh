@@ -1,13 +1,17 @@
 #!/bin/bash -xve
 
 # This script builds `compresso.wasm` using emsdk in a docker container.
+#
+# The repository root is mounted, since the module also includes the
+# compressed_segmentation decoder from python/ext/src.
 
 cd "$(dirname "$0")"
 
 docker build .
 docker run \
        --rm \
-       -v ${PWD}:/src \
+       -v ${PWD}/../../..:/src \
+       -w /src/src/sliceview/compresso \
        -u $(id -u):$(id -g) \
        $(docker build -q .) \
        ./build_wasm.sh
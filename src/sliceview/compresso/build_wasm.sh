@@ -2,7 +2,11 @@
 
 compile_options=(
     compresso_wasm.cc
+    compressed_segmentation_wasm.cc
+    ../../../python/ext/src/compress_segmentation.cc
+     -I../../../python/ext/src
      -O3
+     -msimd128
      -DNDEBUG
      --no-entry
      -fno-exceptions
@@ -11,7 +15,7 @@ compile_options=(
      -s ALLOW_MEMORY_GROWTH=1 
      -s TOTAL_STACK=32768
      -s TOTAL_MEMORY=64kb
-     -s EXPORTED_FUNCTIONS='["_compresso_decompress","_malloc","_free"]'
+     -s EXPORTED_FUNCTIONS='["_compresso_decompress","_compresso_decompress_range","_compresso_decompress_mapped","_compresso_labels","_compressed_segmentation_compress","_compressed_segmentation_decompress","_compressed_segmentation_decompress_mapped","_malloc","_free"]'
      -s MALLOC=emmalloc
      -s ENVIRONMENT=worker
      -s STANDALONE_WASM=1
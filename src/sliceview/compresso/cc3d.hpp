@@ -42,6 +42,11 @@
 #include <cmath>
 #include <cstdint>
 #include <stdexcept>
+#include <vector>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
 
 namespace cc3d {
 
@@ -117,14 +122,11 @@ public:
   // Will be O(n).
 };
 
-// This is the second raster pass of the two pass algorithm family.
-// The input array (output_labels) has been assigned provisional 
-// labels and this resolves them into their final labels. We
-// modify this pass to also ensure that the output labels are
-// numbered from 1 sequentially.
+// Maps each provisional label 1..num_labels to its final label,
+// numbered sequentially from start_label in order of first 
+// appearance. N is set to the number of final labels.
 template <typename OUT = uint32_t>
-OUT* relabel(
-    OUT* out_labels, const int64_t voxels,
+std::unique_ptr<OUT[]> renumber_labels(
     const int64_t num_labels, DisjointSet<uint32_t> &equivalences,
     size_t &N = _dummy_N, OUT start_label = 1
   ) {
@@ -145,8 +147,27 @@ OUT* relabel(
     }
   }
 
-  // Raster Scan 2: Write final labels based on equivalences
   N = next_label - start_label;
+  return renumber;
+}
+
+// This is the second raster pass of the two pass algorithm family.
+// The input array (output_labels) has been assigned provisional 
+// labels and this resolves them into their final labels. We
+// modify this pass to also ensure that the output labels are
+// numbered from 1 sequentially.
+template <typename OUT = uint32_t>
+OUT* relabel(
+    OUT* out_labels, const int64_t voxels,
+    const int64_t num_labels, DisjointSet<uint32_t> &equivalences,
+    size_t &N = _dummy_N, OUT start_label = 1
+  ) {
+
+  std::unique_ptr<OUT[]> renumber = renumber_labels<OUT>(
+    num_labels, equivalences, N, start_label
+  );
+
+  // Raster Scan 2: Write final labels based on equivalences
   if (N < static_cast<size_t>(num_labels) || start_label != 1) {
     for (int64_t loc = 0; loc < voxels; loc++) {
       out_labels[loc] = renumber[out_labels[loc]];
@@ -156,78 +177,277 @@ OUT* relabel(
   return out_labels;
 }
 
+// A run of background pixels in columns [begin, end) of a row.
+struct Run {
+  uint32_t begin;
+  uint32_t end;
+  uint32_t label;
+};
+
+// Appends the background runs of each of the rows of length sx 
+// to runs. row_starts[r] is the index in runs of the first run 
+// of row r, and row_starts[rows] is the total.
+inline void find_runs(
+    const bool* in_labels, const int64_t sx, const int64_t rows,
+    std::vector<Run> &runs, std::vector<size_t> &row_starts
+  ) {
+
+  row_starts.resize(rows + 1);
+  for (int64_t r = 0; r < rows; r++) {
+    row_starts[r] = runs.size();
+    const int64_t row_end = sx * (r + 1);
+    int64_t loc = sx * r;
+    while (loc < row_end) {
+      while (loc < row_end && in_labels[loc]) {
+        loc++;
+      }
+      if (loc == row_end) {
+        break;
+      }
+      const int64_t begin = loc;
+      while (loc < row_end && !in_labels[loc]) {
+        loc++;
+      }
+      Run run = { 
+        static_cast<uint32_t>(begin - sx * r), 
+        static_cast<uint32_t>(loc - sx * r), 0 
+      };
+      runs.push_back(run);
+    }
+  }
+  row_starts[rows] = runs.size();
+}
+
+// 4-connected labeling of the runs found by find_runs in images
+// of sy rows each. A run takes the label of the first run in the
+// row above that it overlaps and is unified with the others, so 
+// equivalences are only recorded between runs rather than pixels.
+// Final labels are then filled in run by run, and foreground 
+// pixels set to 0, without writing provisional labels.
 template <typename OUT = uint32_t>
-OUT* connected_components2d_4(
-    bool* in_labels, 
-    const int64_t sx, const int64_t sy, const int64_t sz,
-    size_t max_labels, OUT *out_labels = NULL, 
+OUT* label_runs(
+    std::vector<Run> &runs, const std::vector<size_t> &row_starts,
+    const int64_t sx, const int64_t sy, 
+    size_t max_labels, OUT *out_labels, 
     size_t &N = _dummy_N, OUT start_label = 1
   ) {
 
-  const int64_t sxy = sx * sy;
-  const int64_t voxels = sx * sy * sz;
+  const int64_t rows = static_cast<int64_t>(row_starts.size()) - 1;
+  const int64_t voxels = sx * rows;
 
+  // each run gets at most one new label
+  max_labels = std::min(max_labels, runs.size());
   max_labels++;
   max_labels = std::min(max_labels, static_cast<size_t>(voxels) + 1); // + 1L for an array with no zeros
   max_labels = std::min(max_labels, static_cast<size_t>(std::numeric_limits<OUT>::max()));
 
-
   DisjointSet<uint32_t> equivalences(max_labels);
+  uint32_t next_label = 0;
+
+  for (int64_t r = 0; r < rows; r++) {
+    const bool first_row = (r % sy == 0);
+    size_t above = first_row ? 0 : row_starts[r - 1];
+    const size_t above_end = first_row ? 0 : row_starts[r];
+
+    for (size_t i = row_starts[r]; i < row_starts[r + 1]; i++) {
+      Run &run = runs[i];
+
+      while (above < above_end && runs[above].end <= run.begin) {
+        above++;
+      }
+
+      uint32_t label = 0;
+      for (size_t k = above; k < above_end && runs[k].begin < run.end; k++) {
+        if (label == 0) {
+          label = runs[k].label;
+        }
+        else {
+          equivalences.unify(label, runs[k].label);
+        }
+      }
+      if (label == 0) {
+        next_label++;
+        label = next_label;
+        equivalences.add(label);
+      }
+      run.label = label;
+    }
+  }
+
+  std::unique_ptr<OUT[]> renumber = renumber_labels<OUT>(
+    next_label, equivalences, N, start_label
+  );
+
+  for (int64_t r = 0; r < rows; r++) {
+    OUT* row = out_labels + sx * r;
+    std::fill(row, row + sx, 0);
+    for (size_t i = row_starts[r]; i < row_starts[r + 1]; i++) {
+      std::fill(row + runs[i].begin, row + runs[i].end, renumber[runs[i].label]);
+    }
+  }
+
+  return out_labels;
+}
+
+template <typename OUT = uint32_t>
+OUT* connected_components2d_4(
+    bool* in_labels, 
+    const int64_t sx, const int64_t sy, const int64_t sz,
+    size_t max_labels, OUT *out_labels = NULL, 
+    size_t &N = _dummy_N, OUT start_label = 1
+  ) {
+
+  const int64_t voxels = sx * sy * sz;
 
   if (out_labels == NULL) {
     out_labels = new OUT[voxels]();
   }
-    
-  /*
-    Layout of forward pass mask. 
-    A is the current location.
-    D C 
-    B A 
-  */
 
-  // const int64_t A = 0;
-  const int64_t B = -1;
-  const int64_t C = -sx;
-  const int64_t D = -1-sx;
+  std::vector<Run> runs;
+  std::vector<size_t> row_starts;
+  find_runs(in_labels, sx, sy * sz, runs, row_starts);
 
-  int64_t loc = 0;
-  OUT next_label = 0;
+  return label_runs<OUT>(
+    runs, row_starts, sx, sy, max_labels, out_labels, N, start_label
+  );
+}
 
-  // Raster Scan 1: Set temporary labels and 
-  // record equivalences in a disjoint set.
+// Index of the lowest set bit of x, which must be nonzero.
+inline int lowest_bit(uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<int>(index);
+#elif defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#else
+  int index = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    index++;
+  }
+  return index;
+#endif
+}
 
-  bool cur = 0;
-  for (int64_t z = 0; z < sz; z++) {
-    for (int64_t y = 0; y < sy; y++) {
-      for (int64_t x = 0; x < sx; x++) {
-        loc = x + sx * y + sxy * z;
-        cur = in_labels[loc];
+// Returns the first index in [begin, end) of a packed bitset 
+// (bit i in bit i % 64 of word i / 64) whose bit equals value,
+// or end if there is none. Scans a word at a time.
+inline int64_t find_bit(
+    const uint64_t* bits, const int64_t begin, const int64_t end, 
+    const bool value
+  ) {
 
-        if (cur) {
-          continue;
-        }
+  if (begin >= end) {
+    return end;
+  }
 
-        if (x > 0 && !in_labels[loc + B]) {
-          out_labels[loc] = out_labels[loc + B];
-          if (y > 0 && in_labels[loc + D] && !in_labels[loc + C]) {
-            equivalences.unify(out_labels[loc], out_labels[loc + C]);
+  const uint64_t flip = value ? 0 : ~static_cast<uint64_t>(0);
+  int64_t word = begin >> 6;
+  uint64_t w = (bits[word] ^ flip) & (~static_cast<uint64_t>(0) << (begin & 63));
+  while (w == 0) {
+    word++;
+    if ((word << 6) >= end) {
+      return end;
+    }
+    w = bits[word] ^ flip;
+  }
+
+  return std::min(end, (word << 6) + lowest_bit(w));
+}
+
+// The first pass of connected_components2d_4 for a single image 
+// whose foreground is packed into a bitset as for find_bit. Each 
+// row is scanned as runs of background, and a run takes the label 
+// of the first run above it that it overlaps and unifies it with 
+// the rest. Foreground pixels are labeled 0.
+//
+// out_labels is left holding the num_provisional provisional 
+// labels, and the returned array maps each of them (and 0) to its 
+// final label, so that callers can fold the relabel into a pass 
+// of their own.
+template <typename OUT = uint32_t>
+std::unique_ptr<OUT[]> provisional_components2d_4(
+    const uint64_t* in_labels, 
+    const int64_t sx, const int64_t sy,
+    size_t max_labels, OUT *out_labels, size_t &num_provisional,
+    size_t &N = _dummy_N, OUT start_label = 1
+  ) {
+
+  const int64_t voxels = sx * sy;
+
+  max_labels++;
+  max_labels = std::min(max_labels, static_cast<size_t>(voxels) + 1);
+  max_labels = std::min(max_labels, static_cast<size_t>(std::numeric_limits<OUT>::max()));
+
+  DisjointSet<uint32_t> equivalences(max_labels);
+
+  OUT next_label = 0;
+
+  for (int64_t y = 0; y < sy; y++) {
+    const int64_t row_end = sx * (y + 1);
+    int64_t loc = sx * y;
+
+    while (loc < row_end) {
+      const int64_t begin = find_bit(in_labels, loc, row_end, false);
+      std::fill(out_labels + loc, out_labels + begin, 0);
+      if (begin == row_end) {
+        break;
+      }
+      const int64_t end = find_bit(in_labels, begin, row_end, true);
+
+      OUT label = 0;
+      if (y > 0) {
+        int64_t above = find_bit(in_labels, begin - sx, end - sx, false);
+        while (above < end - sx) {
+          if (label == 0) {
+            label = out_labels[above];
           }
-        }
-        else if (y > 0 && !in_labels[loc + C]) {
-          out_labels[loc] = out_labels[loc + C];
-        }
-        else {
-          next_label++;
-          out_labels[loc] = next_label;
-          equivalences.add(out_labels[loc]);
+          else {
+            equivalences.unify(label, out_labels[above]);
+          }
+          above = find_bit(in_labels, above, end - sx, true);
+          above = find_bit(in_labels, above, end - sx, false);
         }
       }
+      if (label == 0) {
+        next_label++;
+        label = next_label;
+        equivalences.add(label);
+      }
+
+      std::fill(out_labels + begin, out_labels + end, label);
+      loc = end;
     }
   }
 
-  return relabel<OUT>(out_labels, voxels, next_label, equivalences, N, start_label);
+  num_provisional = next_label;
+  return renumber_labels<OUT>(next_label, equivalences, N, start_label);
 }
 
+// connected_components2d_4 for a single image whose foreground
+// is packed into a bitset as for find_bit.
+template <typename OUT = uint32_t>
+OUT* connected_components2d_4(
+    const uint64_t* in_labels, 
+    const int64_t sx, const int64_t sy,
+    size_t max_labels, OUT *out_labels, 
+    size_t &N = _dummy_N, OUT start_label = 1
+  ) {
+
+  size_t num_provisional = 0;
+  std::unique_ptr<OUT[]> renumber = provisional_components2d_4<OUT>(
+    in_labels, sx, sy, max_labels, out_labels, num_provisional, N, start_label
+  );
+
+  if (N < num_provisional || start_label != 1) {
+    for (int64_t loc = 0; loc < sx * sy; loc++) {
+      out_labels[loc] = renumber[out_labels[loc]];
+    }
+  }
+
+  return out_labels;
+}
 
 template <typename OUT = uint32_t>
 OUT* connected_components3d_6(
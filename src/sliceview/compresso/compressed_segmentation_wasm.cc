@@ -0,0 +1,164 @@
+/**
+ * @license
+ * Copyright 2026 Google Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Exports the compressed_segmentation encoder and decoder of the Python
+// extension (python/ext/src/compress_segmentation.h and
+// decompress_segmentation.h) from the same module as the compresso decoder.
+// The viewer does not call these yet, since the checked-in compresso.wasm
+// predates them; it decodes compressed_segmentation chunks on the GPU.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "compress_segmentation.h"
+#include "decompress_segmentation.h"
+
+extern "C" {
+
+// Decodes `num_words` words of compressed_segmentation data with the
+// specified volume size (x, y, z, channels) and block size into `out`.
+// `bytes_per_label` must be 4 or 8.
+//
+// Returns 0 on success, 1 if `bytes_per_label` is invalid, or 2 if the input
+// is malformed.
+int compressed_segmentation_decompress(
+	const uint32_t* buf, unsigned int num_words,
+	unsigned int sx, unsigned int sy, unsigned int sz, unsigned int num_channels,
+	unsigned int bx, unsigned int by, unsigned int bz,
+	unsigned int bytes_per_label, void* out
+) {
+	using namespace neuroglancer::compress_segmentation;
+	const ptrdiff_t volume_size[4] = {
+		static_cast<ptrdiff_t>(sx), static_cast<ptrdiff_t>(sy),
+		static_cast<ptrdiff_t>(sz), static_cast<ptrdiff_t>(num_channels)};
+	const ptrdiff_t block_size[3] = {
+		static_cast<ptrdiff_t>(bx), static_cast<ptrdiff_t>(by),
+		static_cast<ptrdiff_t>(bz)};
+	bool ok;
+	switch (bytes_per_label) {
+	case 4:
+		ok = DecompressChannels(buf, num_words, volume_size, block_size,
+		                        static_cast<uint32_t*>(out));
+		break;
+	case 8:
+		ok = DecompressChannels(buf, num_words, volume_size, block_size,
+		                        static_cast<uint64_t*>(out));
+		break;
+	default:
+		return 1;
+	}
+	return ok ? 0 : 2;
+}
+
+// Like compressed_segmentation_decompress, replacing each value found in
+// `keys`, which must be strictly increasing, with the corresponding entry of
+// `values`.  The mapping is given as uint64 for both label sizes; with 4-byte
+// labels, keys that do not fit are ignored and values are truncated.
+int compressed_segmentation_decompress_mapped(
+	const uint32_t* buf, unsigned int num_words,
+	unsigned int sx, unsigned int sy, unsigned int sz, unsigned int num_channels,
+	unsigned int bx, unsigned int by, unsigned int bz,
+	unsigned int bytes_per_label,
+	const uint64_t* keys, const uint64_t* values, unsigned int mapping_size,
+	void* out
+) {
+	using namespace neuroglancer::compress_segmentation;
+	const ptrdiff_t volume_size[4] = {
+		static_cast<ptrdiff_t>(sx), static_cast<ptrdiff_t>(sy),
+		static_cast<ptrdiff_t>(sz), static_cast<ptrdiff_t>(num_channels)};
+	const ptrdiff_t block_size[3] = {
+		static_cast<ptrdiff_t>(bx), static_cast<ptrdiff_t>(by),
+		static_cast<ptrdiff_t>(bz)};
+	bool ok;
+	switch (bytes_per_label) {
+	case 4: {
+		std::vector<uint32_t> keys32, values32;
+		for (unsigned int i = 0; i < mapping_size && keys[i] <= 0xffffffffu; ++i) {
+			keys32.push_back(static_cast<uint32_t>(keys[i]));
+			values32.push_back(static_cast<uint32_t>(values[i]));
+		}
+		LabelMapping<uint32_t> mapping;
+		mapping.keys = keys32.data();
+		mapping.values = values32.data();
+		mapping.size = keys32.size();
+		ok = DecompressChannels(buf, num_words, volume_size, block_size,
+		                        static_cast<uint32_t*>(out), &mapping);
+		break;
+	}
+	case 8: {
+		LabelMapping<uint64_t> mapping;
+		mapping.keys = keys;
+		mapping.values = values;
+		mapping.size = mapping_size;
+		ok = DecompressChannels(buf, num_words, volume_size, block_size,
+		                        static_cast<uint64_t*>(out), &mapping);
+		break;
+	}
+	default:
+		return 1;
+	}
+	return ok ? 0 : 2;
+}
+
+// Encodes `buf`, containing labels with the specified volume size (x, y, z,
+// channels) in Fortran order, using the specified block size.
+// `bytes_per_label` must be 4 or 8.
+//
+// On success, returns a buffer allocated with malloc, which the caller must
+// free, and stores its size in 32-bit words in `*out_num_words`.  Returns null
+// if `bytes_per_label` is invalid or allocation fails.
+uint32_t* compressed_segmentation_compress(
+	const void* buf,
+	unsigned int sx, unsigned int sy, unsigned int sz, unsigned int num_channels,
+	unsigned int bx, unsigned int by, unsigned int bz,
+	unsigned int bytes_per_label, unsigned int* out_num_words
+) {
+	using namespace neuroglancer::compress_segmentation;
+	const ptrdiff_t volume_size[4] = {
+		static_cast<ptrdiff_t>(sx), static_cast<ptrdiff_t>(sy),
+		static_cast<ptrdiff_t>(sz), static_cast<ptrdiff_t>(num_channels)};
+	const ptrdiff_t input_strides[4] = {
+		1, volume_size[0], volume_size[0] * volume_size[1],
+		volume_size[0] * volume_size[1] * volume_size[2]};
+	const ptrdiff_t block_size[3] = {
+		static_cast<ptrdiff_t>(bx), static_cast<ptrdiff_t>(by),
+		static_cast<ptrdiff_t>(bz)};
+	uint32_t* output = nullptr;
+	auto get_output = [&](size_t size) {
+		// Allocate at least one word so that an empty result is not mistaken
+		// for a failure.
+		output = static_cast<uint32_t*>(std::malloc((size + 1) * sizeof(uint32_t)));
+		*out_num_words = size;
+		return output;
+	};
+	switch (bytes_per_label) {
+	case 4:
+		CompressChannels(static_cast<const uint32_t*>(buf), input_strides,
+		                 volume_size, block_size, get_output);
+		break;
+	case 8:
+		CompressChannels(static_cast<const uint64_t*>(buf), input_strides,
+		                 volume_size, block_size, get_output);
+		break;
+	default:
+		return nullptr;
+	}
+	return output;
+}
+
+}
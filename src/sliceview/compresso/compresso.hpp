@@ -29,12 +29,28 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "cc3d.hpp"
 
+// Tables are read in place when the host is little endian too.
+#if defined(_MSC_VER) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define COMPRESSO_LITTLE_ENDIAN
+#endif
+
+// WASM builds without pthreads cannot start threads.
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define COMPRESSO_THREADS
+#include <thread>
+#endif
+
 namespace compresso {
 
 #define DEFAULT_CONNECTIVITY 4
@@ -79,6 +95,68 @@ uint8_t ctoi(unsigned char* buf, size_t idx) {
 	return static_cast<uint8_t>(buf[idx]);
 }
 
+// Reads a little endian index entry of 1, 2, 4, or 8 bytes.
+inline uint64_t read_index(unsigned char* buf, const size_t width) {
+	uint64_t x = 0;
+	for (size_t i = 0; i < width; i++) {
+		x |= static_cast<uint64_t>(buf[i]) << (8 * i);
+	}
+	return x;
+}
+
+// Reads a little endian T from buf, which need not be aligned.
+template <typename T>
+inline T load(const unsigned char* buf) {
+#ifdef COMPRESSO_LITTLE_ENDIAN
+	T x;
+	std::memcpy(&x, buf, sizeof(T));
+	return x;
+#else
+	uint64_t x = 0;
+	for (size_t i = 0; i < sizeof(T); i++) {
+		x |= static_cast<uint64_t>(buf[i]) << (8 * i);
+	}
+	return static_cast<T>(x);
+#endif
+}
+
+/* A read-only array of little endian values stored in 
+ * place in an encoded stream, so tables need not be copied 
+ * out of it before decoding.
+ */
+template <typename T>
+class ArrayView {
+public:
+	ArrayView() : data(NULL), length(0) {}
+	ArrayView(const unsigned char* data, const size_t length) 
+		: data(data), length(length) {}
+
+	T operator[](const size_t i) const {
+		return load<T>(data + i * sizeof(T));
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+	// The values [offset, offset + n).
+	ArrayView<T> slice(const size_t offset, const size_t n) const {
+		return ArrayView<T>(data + offset * sizeof(T), n);
+	}
+
+private:
+	const unsigned char* data;
+	size_t length;
+};
+
+// Writes the low `width` bytes of x in little endian order.
+template <typename T>
+void itoc(const T x, unsigned char* buf, const size_t width = sizeof(T)) {
+	for (size_t i = 0; i < width; i++) {
+		buf[i] = static_cast<unsigned char>(static_cast<uint64_t>(x) >> (8 * i));
+	}
+}
+
 
 /* Header: 
  *   'cpso'            : magic number (4 bytes)
@@ -90,6 +168,11 @@ uint8_t ctoi(unsigned char* buf, size_t idx) {
  *   value_size       : number of values (u32)
  *   location_size    : number of locations (u64)
  *   connectivity     : CCL algorithm 4 or 6
+ *
+ * The header is followed by the ids, window values, locations,
+ * and run length encoded windows. format_version 1 appends a
+ * z index of sz component counts followed by sz location entry 
+ * counts, one per slice, each index_byte_width() bytes wide.
  */
 struct CompressoHeader {
 public:
@@ -163,6 +246,25 @@ public:
 		return CompressoHeader(buf);
 	}
 
+	void tochars(unsigned char* buf) const {
+		buf[0] = 'c';
+		buf[1] = 'p';
+		buf[2] = 's';
+		buf[3] = 'o';
+		buf[4] = format_version;
+		buf[5] = data_width;
+		itoc<uint16_t>(sx, buf + 6);
+		itoc<uint16_t>(sy, buf + 8);
+		itoc<uint16_t>(sz, buf + 10);
+		buf[12] = xstep;
+		buf[13] = ystep;
+		buf[14] = zstep;
+		itoc<uint64_t>(id_size, buf + 15);
+		itoc<uint32_t>(value_size, buf + 23);
+		itoc<uint64_t>(location_size, buf + 27);
+		buf[35] = connectivity;
+	}
+
 	size_t index_byte_width() const {
 		const size_t sxy = sx * sy;
 		const size_t worst_case = 2 * sxy;
@@ -182,319 +284,412 @@ public:
 	}
 };
 
-template <typename WINDOW>
-std::vector<WINDOW> run_length_decode_windows(
-	const std::vector<WINDOW> &rle_windows, const size_t nblocks
+/* COMPRESS STARTS HERE */
+
+// A voxel is a boundary if it differs from its +x or +y 
+// neighbor (or +z neighbor for 6-connectivity). Connected
+// components of non-boundary voxels therefore have a 
+// single label each.
+template <typename LABEL>
+std::unique_ptr<bool[]> extract_boundaries(
+	const LABEL* labels,
+	const size_t sx, const size_t sy, const size_t sz,
+	const size_t connectivity
 ) {
-	std::vector<WINDOW> windows(nblocks);
+	const size_t sxy = sx * sy;
+	const size_t voxels = sxy * sz;
 
-	WINDOW block = 0;
-	size_t index = 0;
-	const size_t window_size = rle_windows.size();
+	std::unique_ptr<bool[]> boundaries(new bool[voxels]());
 
-	for (size_t i = 0; i < window_size; i++) {
-		block = rle_windows[i];
-		if (block & 1) {
-			index += (block >> 1);
-		}
-		else {
-			windows[index] = block >> 1;
-			index++;
+	for (size_t z = 0; z < sz; z++) {
+		for (size_t y = 0; y < sy; y++) {
+			for (size_t x = 0; x < sx; x++) {
+				size_t loc = x + sx * y + sxy * z;
+				boundaries[loc] = (
+					(x < sx - 1 && labels[loc] != labels[loc + 1])
+					|| (y < sy - 1 && labels[loc] != labels[loc + sx])
+					|| (connectivity == 6 && z < sz - 1 && labels[loc] != labels[loc + sxy])
+				);
+			}
 		}
 	}
 
-	return windows;
+	return boundaries;
 }
 
-/* DECOMPRESS STARTS HERE */
+// Returns the label of each connected component, where
+// ids[i] is the label of component i + 1.
+template <typename LABEL>
+std::vector<LABEL> component_map(
+	const uint32_t* components, const LABEL* labels, 
+	const size_t voxels, const size_t num_components
+) {
+	std::vector<LABEL> ids(num_components);
+	for (size_t i = 0; i < voxels; i++) {
+		if (components[i]) {
+			ids[components[i] - 1] = labels[i];
+		}
+	}
+	return ids;
+}
 
-template <typename LABEL, typename WINDOW>
-std::unique_ptr<bool[]> decode_boundaries(
-	const std::vector<WINDOW> &windows, const std::vector<WINDOW> &window_values, 
+// Computes the boundary bitmask of each xstep x ystep x zstep 
+// block, the inverse of decode_boundaries.
+template <typename WINDOW>
+std::vector<WINDOW> encode_boundaries(
+	const bool* boundaries,
 	const size_t sx, const size_t sy, const size_t sz,
 	const size_t xstep, const size_t ystep, const size_t zstep
 ) {
-
 	const size_t sxy = sx * sy;
-	const size_t voxels = sx * sy * sz;
 
 	const size_t nx = (sx + xstep - 1) / xstep; // round up
 	const size_t ny = (sy + ystep - 1) / ystep; // round up
+	const size_t nz = (sz + zstep - 1) / zstep; // round up
 
-	// check for power of two
-	const bool xstep_pot = (xstep != 0) && ((xstep & (xstep - 1)) == 0);
-	const int xshift = std::log2(xstep); // must use log2 here, not lg/lg2 to avoid fp errors
-
-	std::unique_ptr<bool[]> boundaries(new bool[voxels]());
-
-	if (window_values.size() == 0) {
-		return boundaries;
-	}
-
-	size_t xblock, yblock, zblock;
-	size_t xoffset, yoffset, zoffset;
+	std::vector<WINDOW> windows(nx * ny * nz);
 
 	for (size_t z = 0; z < sz; z++) {
-		zblock = nx * ny * (z / zstep);
-		zoffset = xstep * ystep * (z % zstep);
+		const size_t zblock = nx * ny * (z / zstep);
+		const size_t zoffset = xstep * ystep * (z % zstep);
 		for (size_t y = 0; y < sy; y++) {
-			yblock = nx * (y / ystep);
-			yoffset = xstep * (y % ystep);
-
-			if (xstep_pot) {
-				for (size_t x = 0; x < sx; x++) {
-					size_t iv = x + sx * y + sxy * z;
-
-					xblock = x >> xshift; // x / xstep
-					xoffset = x & ((1 << xshift) - 1); // x % xstep
-					
-					size_t block = xblock + yblock + zblock;
-					size_t offset = xoffset + yoffset + zoffset;
-
-					WINDOW value = window_values[windows[block]];
-					boundaries[iv] = (value >> offset) & 0b1;
-				}				
-			}
-			else {
-				for (size_t x = 0; x < sx; x++) {
-					size_t iv = x + sx * y + sxy * z;
-					xblock = x / xstep;
-					xoffset = x % xstep;
-					
-					size_t block = xblock + yblock + zblock;
-					size_t offset = xoffset + yoffset + zoffset;
-
-					WINDOW value = window_values[windows[block]];
-					boundaries[iv] = (value >> offset) & 0b1;
+			const size_t yblock = nx * (y / ystep);
+			const size_t yoffset = xstep * (y % ystep);
+			for (size_t x = 0; x < sx; x++) {
+				if (!boundaries[x + sx * y + sxy * z]) {
+					continue;
 				}
+				size_t block = x / xstep + yblock + zblock;
+				size_t offset = x % xstep + yoffset + zoffset;
+				windows[block] |= static_cast<WINDOW>(1) << offset;
 			}
 		}
 	}
 
-	return boundaries;
+	return windows;
 }
 
-template <typename LABEL>
-void decode_nonboundary_labels(
-	std::unique_ptr<uint32_t[]> &components, const std::vector<LABEL> &ids, 
-	const size_t sx, const size_t sy, const size_t sz,
-	LABEL* output
-) {
-	const size_t voxels = sx * sy * sz;
-	for (size_t i = 0; i < voxels; i++) {
-		output[i] = ids[components[i]];
+// Zero indices are stored as runs: (run << 1) | 1. 
+// Other indices are stored as index << 1. Trailing zeros
+// are omitted as the decoder zero initializes.
+template <typename WINDOW>
+std::vector<WINDOW> run_length_encode_windows(const std::vector<WINDOW> &windows) {
+	std::vector<WINDOW> rle_windows;
+
+	const size_t max_run = std::numeric_limits<WINDOW>::max() >> 1;
+	size_t run = 0;
+
+	for (size_t i = 0; i < windows.size(); i++) {
+		if (windows[i] == 0) {
+			run++;
+			if (run == max_run) {
+				rle_windows.push_back(static_cast<WINDOW>((run << 1) | 1));
+				run = 0;
+			}
+			continue;
+		}
+		if (run > 0) {
+			rle_windows.push_back(static_cast<WINDOW>((run << 1) | 1));
+			run = 0;
+		}
+		rle_windows.push_back(static_cast<WINDOW>(windows[i] << 1));
 	}
+
+	return rle_windows;
 }
 
+// Records how to label each boundary voxel that the decoder 
+// cannot infer from an already decoded left or upper 
+// non-boundary neighbor. This is the inverse of 
+// decode_indeterminate_locations. With a z index, the
+// references to other slices (4 and 5) are not used so that 
+// each slice can be decoded on its own.
 template <typename LABEL>
-int decode_indeterminate_locations(
-	std::unique_ptr<bool[]> &boundaries, LABEL *labels, 
-	const std::vector<LABEL> &locations, 
+std::vector<LABEL> encode_indeterminate_locations(
+	const bool* boundaries, const LABEL* labels,
 	const size_t sx, const size_t sy, const size_t sz,
-	const size_t connectivity
+	const size_t connectivity, const bool random_access_z_index,
+	std::vector<size_t> &num_locations_per_slice
 ) {
 	const size_t sxy = sx * sy;
+	const LABEL max_offset_label = std::numeric_limits<LABEL>::max() - 7;
 
-	size_t loc = 0;
-	size_t index = 0;
+	std::vector<LABEL> locations;
+	num_locations_per_slice.assign(sz, 0);
 
-	// go through all coordinates
 	for (size_t z = 0; z < sz; z++) {
+		const size_t slice_start = locations.size();
 		for (size_t y = 0; y < sy; y++) {
 			for (size_t x = 0; x < sx; x++) {
-				loc = x + sx * y + sxy * z;
+				size_t loc = x + sx * y + sxy * z;
 
 				if (!boundaries[loc]) {
 					continue;
 				}
 				else if (x > 0 && !boundaries[loc - 1]) {
-					labels[loc] = labels[loc - 1];
 					continue;
 				}
 				else if (y > 0 && !boundaries[loc - sx]) {
-					labels[loc] = labels[loc - sx];
 					continue;
 				}
 				else if (connectivity == 6 && z > 0 && !boundaries[loc - sxy]) {
-					labels[loc] = labels[loc - sxy];
 					continue;
 				}
-				else if (locations.size() == 0) {
-					return 1;
-				}
-				
-				size_t offset = locations[index];
 
-				if (offset == 0) {
-					if (x == 0) {
-						return 2;
-					}
-					labels[loc] = labels[loc - 1];
+				const LABEL label = labels[loc];
+
+				if (x > 0 && labels[loc - 1] == label) {
+					locations.push_back(0);
 				}
-				else if (offset == 1) {
-					if (x >= sx - 1) {
-						return 3;
-					}
-					labels[loc] = labels[loc + 1];
+				else if (x < sx - 1 && labels[loc + 1] == label && !boundaries[loc + 1]) {
+					locations.push_back(1);
 				}
-				else if (offset == 2) {
-					if (y == 0) {
-						return 4;
-					}
-					labels[loc] = labels[loc - sx];
+				else if (y > 0 && labels[loc - sx] == label) {
+					locations.push_back(2);
 				}
-				else if (offset == 3) {
-					if (y >= sy - 1) {
-						return 5;
-					}
-					labels[loc] = labels[loc + sx];
+				else if (y < sy - 1 && labels[loc + sx] == label && !boundaries[loc + sx]) {
+					locations.push_back(3);
 				}
-				else if (offset == 4) {
-					if (z == 0) {
-						return 6;
-					}
-					labels[loc] = labels[loc - sxy];
+				else if (!random_access_z_index && z > 0 && labels[loc - sxy] == label) {
+					locations.push_back(4);
 				}
-				else if (offset == 5) {
-					if (z >= sz - 1) {
-						return 7;
-					}
-					labels[loc] = labels[loc + sxy];
+				else if (
+					!random_access_z_index && z < sz - 1 
+					&& labels[loc + sxy] == label && !boundaries[loc + sxy]
+				) {
+					locations.push_back(5);
 				}
-				else if (offset == 6) {
-					labels[loc] = locations[index + 1];
-					index++;
+				else if (label > max_offset_label) {
+					locations.push_back(6);
+					locations.push_back(label);
 				}
 				else {
-					labels[loc] = offset - 7;
+					locations.push_back(static_cast<LABEL>(label + 7));
 				}
-				index++;
 			}
 		}
+		num_locations_per_slice[z] = locations.size() - slice_start;
 	}
 
-	return 0;
+	return locations;
 }
 
+/* Encodes labels, an sx * sy * sz volume with x varying
+ * fastest, into output. 
+ *
+ * random_access_z_index writes format_version 1, which 
+ * records the number of components and locations of each
+ * slice so that slices can be decoded independently. It 
+ * requires 4-connectivity.
+ *
+ * Returns 0 on success or else:
+ *   1: a dimension is zero or larger than 65535
+ *   2: a step is zero, larger than 255, or the window does 
+ *      not fit in WINDOW
+ *   3: unsupported connectivity
+ *   4: too many distinct windows to index with WINDOW
+ */
 template <typename LABEL, typename WINDOW>
-int decompress(unsigned char* buffer, size_t num_bytes, LABEL* output) {
-	if (output == NULL) {
-		return 8;
+int compress(
+	const LABEL* labels, 
+	const size_t sx, const size_t sy, const size_t sz,
+	const size_t xstep, const size_t ystep, const size_t zstep,
+	const size_t connectivity, const bool random_access_z_index,
+	std::vector<unsigned char> &output
+) {
+	const size_t max_size = std::numeric_limits<uint16_t>::max();
+	if (sx == 0 || sy == 0 || sz == 0 || sx > max_size || sy > max_size || sz > max_size) {
+		return 1;
 	}
-	else if (num_bytes < CompressoHeader::header_size) {
-		return 9;
+	else if (
+		xstep == 0 || ystep == 0 || zstep == 0 
+		|| xstep > 255 || ystep > 255 || zstep > 255
+		|| xstep * ystep * zstep > 8 * sizeof(WINDOW)
+	) {
+		return 2;
 	}
-	else if (!CompressoHeader::valid_header(buffer)) {
-		return 10;
+	else if (
+		(connectivity != 4 && connectivity != 6) 
+		|| (random_access_z_index && connectivity != 4)
+	) {
+		return 3;
 	}
 
-	const CompressoHeader header(buffer);
+	const size_t sxy = sx * sy;
+	const size_t voxels = sxy * sz;
 
-	const size_t sx = header.sx;
-	const size_t sy = header.sy;
-	const size_t sz = header.sz;
-	const size_t voxels = sx * sy * sz;
-	const size_t xstep = header.xstep;
-	const size_t ystep = header.ystep;
-	const size_t zstep = header.zstep;
-	const size_t index_width = header.index_byte_width();
-	const bool random_access_z_index = (header.format_version == 1);
+	std::unique_ptr<bool[]> boundaries = extract_boundaries<LABEL>(
+		labels, sx, sy, sz, connectivity
+	);
 
-	if (sx * sy * sz == 0) {
-		return 11;
-	}
+	size_t num_components = 0;
+	std::unique_ptr<uint32_t[]> components = cc3d::connected_components<uint32_t>(
+		boundaries.get(), sx, sy, sz, connectivity, num_components
+	);
+	std::vector<LABEL> ids = component_map<LABEL>(
+		components.get(), labels, voxels, num_components
+	);
 
-	const size_t nx = (sx + xstep - 1) / xstep; // round up
-	const size_t ny = (sy + ystep - 1) / ystep; // round up
-	const size_t nz = (sz + zstep - 1) / zstep; // round up
-	const size_t nblocks = nz * ny * nx;
+	// With 4-connectivity, components are numbered 
+	// consecutively within each slice.
+	std::vector<size_t> num_components_per_slice;
+	if (random_access_z_index) {
+		num_components_per_slice.resize(sz);
+		size_t last = 0;
+		for (size_t z = 0; z < sz; z++) {
+			size_t hi = last;
+			for (size_t i = sxy * z; i < sxy * (z + 1); i++) {
+				hi = std::max(hi, static_cast<size_t>(components[i]));
+			}
+			num_components_per_slice[z] = hi - last;
+			last = hi;
+		}
+	}
+	components.reset();
 
-	size_t window_bytes = (
-		num_bytes 
-			- CompressoHeader::header_size
-			- (header.id_size * sizeof(LABEL))  
-			- (header.value_size * sizeof(WINDOW))
-			- (header.location_size * sizeof(LABEL))
-			- (sz * index_width * random_access_z_index) // components index
-			- (sz * index_width * random_access_z_index) // locations index
+	std::vector<WINDOW> windows = encode_boundaries<WINDOW>(
+		boundaries.get(), sx, sy, sz, xstep, ystep, zstep
 	);
-	size_t num_condensed_windows = window_bytes / sizeof(WINDOW);
 
-	// allocate memory for all arrays
-	std::vector<LABEL> ids(header.id_size + 1); // +1 to allow vectorized mapping w/ no if statement guarding zero
-	std::vector<WINDOW> window_values(header.value_size);
-	std::vector<LABEL> locations(header.location_size);
-	std::vector<WINDOW> windows(num_condensed_windows);
-
-	size_t iv = CompressoHeader::header_size;
-	for (size_t ix = 0; ix < ids.size() - 1; ix++, iv += sizeof(LABEL)) {
-		ids[ix + 1] = ctoi<LABEL>(buffer, iv);
-	}
-	for (size_t ix = 0; ix < window_values.size(); ix++, iv += sizeof(WINDOW)) {
-		window_values[ix] = ctoi<WINDOW>(buffer, iv);
-	}
-	for (size_t ix = 0; ix < locations.size(); ix++, iv += sizeof(LABEL)) {
-		locations[ix] = ctoi<LABEL>(buffer, iv);
+	std::vector<WINDOW> window_values(windows);
+	std::sort(window_values.begin(), window_values.end());
+	window_values.erase(
+		std::unique(window_values.begin(), window_values.end()), window_values.end()
+	);
+	if (window_values.size() - 1 > static_cast<size_t>(std::numeric_limits<WINDOW>::max() >> 1)) {
+		return 4;
 	}
-	for (size_t ix = 0; ix < num_condensed_windows; ix++, iv += sizeof(WINDOW)) {
-		windows[ix] = ctoi<WINDOW>(buffer, iv);
+	for (size_t i = 0; i < windows.size(); i++) {
+		windows[i] = static_cast<WINDOW>(
+			std::lower_bound(window_values.begin(), window_values.end(), windows[i])
+			- window_values.begin()
+		);
 	}
+	windows = run_length_encode_windows<WINDOW>(windows);
 
-	windows = run_length_decode_windows<WINDOW>(windows, nblocks);
+	std::vector<size_t> num_locations_per_slice;
+	std::vector<LABEL> locations = encode_indeterminate_locations<LABEL>(
+		boundaries.get(), labels, sx, sy, sz, 
+		connectivity, random_access_z_index, num_locations_per_slice
+	);
+	boundaries.reset();
 
-	std::unique_ptr<bool[]> boundaries = decode_boundaries<WINDOW>(
-		windows, window_values, 
+	CompressoHeader header(
+		/*format_version=*/random_access_z_index,
+		/*data_width=*/sizeof(LABEL),
 		sx, sy, sz, 
-		xstep, ystep, zstep
+		xstep, ystep, zstep,
+		/*id_size=*/ids.size(), 
+		/*value_size=*/window_values.size(),
+		/*location_size=*/locations.size(),
+		connectivity
 	);
-	windows = std::vector<WINDOW>();
-	window_values = std::vector<WINDOW>();
+	const size_t index_width = header.index_byte_width();
 
-	std::unique_ptr<uint32_t[]> components = cc3d::connected_components<uint32_t>(
-		boundaries.get(), sx, sy, sz, header.connectivity
+	output.resize(
+		CompressoHeader::header_size
+		+ ids.size() * sizeof(LABEL)
+		+ window_values.size() * sizeof(WINDOW)
+		+ locations.size() * sizeof(LABEL)
+		+ windows.size() * sizeof(WINDOW)
+		+ (random_access_z_index ? 2 * sz * index_width : 0)
 	);
 
-	decode_nonboundary_labels(components, ids, sx, sy, sz, output);
-	components.reset();
-	ids = std::vector<LABEL>();
+	unsigned char* buf = output.data();
+	header.tochars(buf);
+	buf += CompressoHeader::header_size;
+	for (size_t i = 0; i < ids.size(); i++, buf += sizeof(LABEL)) {
+		itoc<LABEL>(ids[i], buf);
+	}
+	for (size_t i = 0; i < window_values.size(); i++, buf += sizeof(WINDOW)) {
+		itoc<WINDOW>(window_values[i], buf);
+	}
+	for (size_t i = 0; i < locations.size(); i++, buf += sizeof(LABEL)) {
+		itoc<LABEL>(locations[i], buf);
+	}
+	for (size_t i = 0; i < windows.size(); i++, buf += sizeof(WINDOW)) {
+		itoc<WINDOW>(windows[i], buf);
+	}
+	if (random_access_z_index) {
+		for (size_t z = 0; z < sz; z++, buf += index_width) {
+			itoc<size_t>(num_components_per_slice[z], buf, index_width);
+		}
+		for (size_t z = 0; z < sz; z++, buf += index_width) {
+			itoc<size_t>(num_locations_per_slice[z], buf, index_width);
+		}
+	}
 
-	int err = decode_indeterminate_locations<LABEL>(
-		boundaries, output, locations, 
-		sx, sy, sz,
-		header.connectivity
-	);
+	return 0;
+}
 
-	// if err is 0, everything was ok
-	return err;
+// Selects the smallest WINDOW that holds a whole block,
+// matching the choice made by decompress<void,void>.
+template <typename LABEL>
+int compress_helper(
+	const LABEL* labels, 
+	const size_t sx, const size_t sy, const size_t sz,
+	const size_t xstep, const size_t ystep, const size_t zstep,
+	const size_t connectivity, const bool random_access_z_index,
+	std::vector<unsigned char> &output
+) {
+	const size_t window_bits = xstep * ystep * zstep;
+	if (window_bits <= 8) {
+		return compress<LABEL,uint8_t>(
+			labels, sx, sy, sz, xstep, ystep, zstep, 
+			connectivity, random_access_z_index, output
+		);
+	}
+	else if (window_bits <= 16) {
+		return compress<LABEL,uint16_t>(
+			labels, sx, sy, sz, xstep, ystep, zstep, 
+			connectivity, random_access_z_index, output
+		);
+	}
+	else if (window_bits <= 32) {
+		return compress<LABEL,uint32_t>(
+			labels, sx, sy, sz, xstep, ystep, zstep, 
+			connectivity, random_access_z_index, output
+		);
+	}
+	else {
+		return compress<LABEL,uint64_t>(
+			labels, sx, sy, sz, xstep, ystep, zstep, 
+			connectivity, random_access_z_index, output
+		);
+	}
 }
 
-// This function is used to produce the cartesian
-// product of LABEL x WINDOW possibilities and reduce
-// the human edited code down from 16 conditions down to
-// 8.
-template <typename WINDOW>
-int decompress_helper(
-	unsigned char* buffer, size_t num_bytes, 
-	void* output, const CompressoHeader &header
+// data_width is the size of a label in bytes (1, 2, 4, or 8).
+// Returns 13 for any other width.
+inline int compress(
+	const void* labels, const size_t data_width,
+	const size_t sx, const size_t sy, const size_t sz,
+	const size_t xstep, const size_t ystep, const size_t zstep,
+	const size_t connectivity, const bool random_access_z_index,
+	std::vector<unsigned char> &output
 ) {
-	if (header.data_width == 1) {
-		return decompress<uint8_t,WINDOW>(
-			buffer, num_bytes, reinterpret_cast<uint8_t*>(output)
+	if (data_width == 1) {
+		return compress_helper<uint8_t>(
+			reinterpret_cast<const uint8_t*>(labels), sx, sy, sz, 
+			xstep, ystep, zstep, connectivity, random_access_z_index, output
 		);
 	}
-	else if (header.data_width == 2) {
-		return decompress<uint16_t,WINDOW>(
-			buffer, num_bytes, reinterpret_cast<uint16_t*>(output)
+	else if (data_width == 2) {
+		return compress_helper<uint16_t>(
+			reinterpret_cast<const uint16_t*>(labels), sx, sy, sz, 
+			xstep, ystep, zstep, connectivity, random_access_z_index, output
 		);
 	}
-	else if (header.data_width == 4) {
-		return decompress<uint32_t,WINDOW>(
-			buffer, num_bytes, reinterpret_cast<uint32_t*>(output)
+	else if (data_width == 4) {
+		return compress_helper<uint32_t>(
+			reinterpret_cast<const uint32_t*>(labels), sx, sy, sz, 
+			xstep, ystep, zstep, connectivity, random_access_z_index, output
 		);
 	}
-	else if (header.data_width == 8) {
-		return decompress<uint64_t,WINDOW>(
-			buffer, num_bytes, reinterpret_cast<uint64_t*>(output)
+	else if (data_width == 8) {
+		return compress_helper<uint64_t>(
+			reinterpret_cast<const uint64_t*>(labels), sx, sy, sz, 
+			xstep, ystep, zstep, connectivity, random_access_z_index, output
 		);
 	}
 	else {
@@ -502,55 +697,1275 @@ int decompress_helper(
 	}
 }
 
+/* DECOMPRESS STARTS HERE */
 
-template <>
-int decompress<void,void>(unsigned char* buffer, size_t num_bytes, void* output) {
-	if (!CompressoHeader::valid_header(buffer)) {
-		return 12;
+/* A mapping applied to labels while decoding, given as strictly
+ * increasing keys and the value of each. Labels that are not keys
+ * are left unchanged. It is applied to the ids and to the labels
+ * stored in the locations, so its cost scales with the number of
+ * those rather than with the number of voxels.
+ */
+struct LabelMapping {
+	const uint64_t* keys;
+	const uint64_t* values;
+	size_t size;
+
+	LabelMapping() : keys(NULL), values(NULL), size(0) {}
+	LabelMapping(const uint64_t* keys, const uint64_t* values, const size_t size)
+		: keys(keys), values(values), size(size) {}
+
+	template <typename LABEL>
+	LABEL operator()(const LABEL label) const {
+		if (size == 0) {
+			return label;
+		}
+		const uint64_t* it = std::lower_bound(keys, keys + size, static_cast<uint64_t>(label));
+		if (it == keys + size || *it != static_cast<uint64_t>(label)) {
+			return label;
+		}
+		return static_cast<LABEL>(values[it - keys]);
 	}
+};
 
-	CompressoHeader header(buffer);
-
-	bool window8 = (
-		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 8
-	);
-	bool window16 = (
-		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 16
-	);
-	bool window32 = (
-		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 32
-	);
+/* Run length decodes the windows and expands them into 
+ * boundaries one slice at a time, holding only the windows 
+ * of one slab of nx * ny blocks (zstep slices). Slices 
+ * must be requested in increasing order.
+ *
+ * Boundaries are packed one bit per voxel, voxel i of the 
+ * slice in bit i % 64 of word i / 64. Each row of a window 
+ * holds xstep consecutive bits, so it is copied in with a 
+ * shift and a mask rather than voxel by voxel.
+ */
+template <typename WINDOW>
+class BoundaryReader {
+public:
+	BoundaryReader(
+		const ArrayView<WINDOW> &rle_windows, const ArrayView<WINDOW> &window_values,
+		const size_t sx, const size_t sy,
+		const size_t xstep, const size_t ystep, const size_t zstep
+	) : 
+		rle_windows(rle_windows), window_values(window_values),
+		sx(sx), sy(sy), xstep(xstep), ystep(ystep), zstep(zstep),
+		nx((sx + xstep - 1) / xstep), ny((sy + ystep - 1) / ystep),
+		slab(nx * ny), slab_z(std::numeric_limits<size_t>::max()), 
+		rle_index(0), block_index(0)
+	{}
 
-	if (window8) {
-		return decompress_helper<uint8_t>(
-			buffer, num_bytes, 
-			reinterpret_cast<uint8_t*>(output),
-			header
-		);
+	// Words needed to hold the boundaries of one slice.
+	size_t slice_words() const {
+		return (sx * sy + 63) / 64;
 	}
-	else if (window16) {
-		return decompress_helper<uint16_t>(
-			buffer, num_bytes, 
-			reinterpret_cast<uint8_t*>(output),
-			header
-		);
+
+	// Decodes the sx * sy boundaries of slice z into slice_words()
+	// words. Returns false if a window refers to a missing window 
+	// value.
+	bool read(const size_t z, uint64_t* boundaries) {
+		std::fill(boundaries, boundaries + slice_words(), 0);
+		if (window_values.size() == 0) {
+			return true;
+		}
+		if (z / zstep != slab_z && !read_slab(z / zstep)) {
+			return false;
+		}
+
+		const size_t zoffset = xstep * ystep * (z % zstep);
+		const uint64_t xmask = (xstep >= 64) 
+			? ~static_cast<uint64_t>(0) 
+			: (static_cast<uint64_t>(1) << xstep) - 1;
+
+		for (size_t y = 0; y < sy; y++) {
+			const size_t yblock = nx * (y / ystep);
+			const size_t shift = xstep * (y % ystep) + zoffset;
+
+			for (size_t xblock = 0; xblock < nx; xblock++) {
+				uint64_t bits = (
+					static_cast<uint64_t>(window_values[slab[xblock + yblock]]) >> shift
+				) & xmask;
+				if (bits == 0) {
+					continue;
+				}
+
+				const size_t x = xblock * xstep;
+				const size_t width = std::min(xstep, sx - x);
+				if (width < xstep) {
+					bits &= (static_cast<uint64_t>(1) << width) - 1;
+				}
+
+				const size_t i = x + sx * y;
+				const size_t bit = i & 63;
+				boundaries[i >> 6] |= bits << bit;
+				if (bit + width > 64) {
+					boundaries[(i >> 6) + 1] |= bits >> (64 - bit);
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// As above, but one bool per voxel.
+	bool read(const size_t z, bool* boundaries) {
+		packed.resize(slice_words());
+		if (!read(z, packed.data())) {
+			return false;
+		}
+		for (size_t i = 0; i < sx * sy; i++) {
+			boundaries[i] = (packed[i >> 6] >> (i & 63)) & 1;
+		}
+		return true;
+	}
+
+private:
+	bool read_slab(const size_t zb) {
+		const size_t slab_start = zb * nx * ny;
+		const size_t slab_end = slab_start + nx * ny;
+		std::fill(slab.begin(), slab.end(), 0);
+
+		// Zero runs can span slabs, so the run length position
+		// is tracked as an absolute block index.
+		while (rle_index < rle_windows.size() && block_index < slab_end) {
+			const WINDOW block = rle_windows[rle_index++];
+			if (block & 1) {
+				block_index += (block >> 1);
+				continue;
+			}
+			const WINDOW value = block >> 1;
+			if (value >= window_values.size()) {
+				return false;
+			}
+			if (block_index >= slab_start) {
+				slab[block_index - slab_start] = value;
+			}
+			block_index++;
+		}
+
+		slab_z = zb;
+		return true;
+	}
+
+	const ArrayView<WINDOW> rle_windows;
+	const ArrayView<WINDOW> window_values;
+	const size_t sx, sy;
+	const size_t xstep, ystep, zstep;
+	const size_t nx, ny;
+	std::vector<WINDOW> slab;
+	std::vector<uint64_t> packed;
+	size_t slab_z;
+	size_t rle_index;
+	size_t block_index;
+};
+
+template <typename LABEL>
+void decode_nonboundary_labels(
+	const uint32_t* components, const LABEL* ids, 
+	const size_t voxels, LABEL* output
+) {
+	for (size_t i = 0; i < voxels; i++) {
+		output[i] = ids[components[i]];
+	}
+}
+
+inline bool is_boundary(const bool* boundaries, const size_t i) {
+	return boundaries[i];
+}
+
+inline bool is_boundary(const uint64_t* boundaries, const size_t i) {
+	return (boundaries[i >> 6] >> (i & 63)) & 1;
+}
+
+// The first boundary voxel in [begin, end), or end.
+inline size_t next_boundary(const bool* boundaries, size_t begin, const size_t end) {
+	while (begin < end && !boundaries[begin]) {
+		begin++;
+	}
+	return begin;
+}
+
+inline size_t next_boundary(const uint64_t* boundaries, size_t begin, const size_t end) {
+	return cc3d::find_bit(boundaries, begin, end, true);
+}
+
+/* Resolves the boundary voxels of slices [z_begin, z_end)
+ * of labels, an sx * sy * sz volume. boundaries holds only
+ * those slices, as bools or packed bits. index is the next 
+ * entry of locations, and is advanced past the entries used.
+ */
+template <typename LABEL, typename BOUNDARIES>
+int decode_indeterminate_locations(
+	const BOUNDARIES* boundaries, LABEL *labels, 
+	const ArrayView<LABEL> &locations, size_t &index,
+	const size_t sx, const size_t sy, const size_t sz,
+	const size_t z_begin, const size_t z_end,
+	const size_t connectivity, const LabelMapping &mapping
+) {
+	const size_t sxy = sx * sy;
+	const size_t boundary_offset = sxy * z_begin;
+
+	size_t loc = 0;
+
+	// go through all boundary voxels
+	for (size_t z = z_begin; z < z_end; z++) {
+		for (size_t y = 0; y < sy; y++) {
+			const size_t row = sx * y + sxy * z - boundary_offset;
+			const size_t row_end = row + sx;
+
+			for (
+				size_t b = next_boundary(boundaries, row, row_end); 
+				b < row_end; 
+				b = next_boundary(boundaries, b + 1, row_end)
+			) {
+				const size_t x = b - row;
+				loc = b + boundary_offset;
+
+				if (x > 0 && !is_boundary(boundaries, b - 1)) {
+					labels[loc] = labels[loc - 1];
+					continue;
+				}
+				else if (y > 0 && !is_boundary(boundaries, b - sx)) {
+					labels[loc] = labels[loc - sx];
+					continue;
+				}
+				else if (connectivity == 6 && z > 0 && !is_boundary(boundaries, b - sxy)) {
+					labels[loc] = labels[loc - sxy];
+					continue;
+				}
+
+				if (index >= locations.size()) {
+					return 1;
+				}
+				
+				size_t offset = locations[index];
+
+				if (offset == 0) {
+					if (x == 0) {
+						return 2;
+					}
+					labels[loc] = labels[loc - 1];
+				}
+				else if (offset == 1) {
+					if (x >= sx - 1) {
+						return 3;
+					}
+					labels[loc] = labels[loc + 1];
+				}
+				else if (offset == 2) {
+					if (y == 0) {
+						return 4;
+					}
+					labels[loc] = labels[loc - sx];
+				}
+				else if (offset == 3) {
+					if (y >= sy - 1) {
+						return 5;
+					}
+					labels[loc] = labels[loc + sx];
+				}
+				else if (offset == 4) {
+					if (z == 0) {
+						return 6;
+					}
+					labels[loc] = labels[loc - sxy];
+				}
+				else if (offset == 5) {
+					if (z >= sz - 1) {
+						return 7;
+					}
+					labels[loc] = labels[loc + sxy];
+				}
+				else if (offset == 6) {
+					if (index + 1 >= locations.size()) {
+						return 1;
+					}
+					labels[loc] = mapping(locations[index + 1]);
+					index++;
+				}
+				else {
+					labels[loc] = mapping(static_cast<LABEL>(offset - 7));
+				}
+				index++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// The tables that follow the header, copied out of the stream.
+template <typename LABEL, typename WINDOW>
+struct CompressoTables {
+	ArrayView<LABEL> ids;
+	ArrayView<WINDOW> window_values;
+	ArrayView<LABEL> locations;
+	ArrayView<WINDOW> windows; // run length encoded
+	// format_version 1 only: the number of components and
+	// of location entries in each slice.
+	std::vector<uint64_t> num_components;
+	std::vector<uint64_t> num_locations;
+};
+
+template <typename LABEL, typename WINDOW>
+int read_tables(
+	unsigned char* buffer, const size_t num_bytes,
+	const CompressoHeader &header, CompressoTables<LABEL, WINDOW> &tables
+) {
+	const size_t sx = header.sx;
+	const size_t sy = header.sy;
+	const size_t sz = header.sz;
+	const size_t index_width = header.index_byte_width();
+	const bool random_access_z_index = (header.format_version == 1);
+
+	// The tables and index must fit in the buffer, which also
+	// keeps the subtraction below from wrapping around.
+	if (
+		header.id_size > num_bytes || header.location_size > num_bytes
+		|| (
+			(header.id_size + header.location_size) * sizeof(LABEL)
+			+ header.value_size * sizeof(WINDOW)
+			+ 2 * sz * index_width * random_access_z_index
+		) > num_bytes - CompressoHeader::header_size
+	) {
+		return 14;
+	}
+
+	size_t window_bytes = (
+		num_bytes 
+			- CompressoHeader::header_size
+			- (header.id_size * sizeof(LABEL))  
+			- (header.value_size * sizeof(WINDOW))
+			- (header.location_size * sizeof(LABEL))
+			- (sz * index_width * random_access_z_index) // components index
+			- (sz * index_width * random_access_z_index) // locations index
+	);
+	size_t num_condensed_windows = window_bytes / sizeof(WINDOW);
+
+	const unsigned char* tables_start = buffer + CompressoHeader::header_size;
+	tables.ids = ArrayView<LABEL>(tables_start, header.id_size);
+	tables_start += header.id_size * sizeof(LABEL);
+	tables.window_values = ArrayView<WINDOW>(tables_start, header.value_size);
+	tables_start += header.value_size * sizeof(WINDOW);
+	tables.locations = ArrayView<LABEL>(tables_start, header.location_size);
+	tables_start += header.location_size * sizeof(LABEL);
+	tables.windows = ArrayView<WINDOW>(tables_start, num_condensed_windows);
+
+	size_t iv = 0;
+	if (random_access_z_index) {
+		// skip the padding left over from the windows
+		iv = num_bytes - 2 * sz * index_width;
+		tables.num_components.resize(sz);
+		tables.num_locations.resize(sz);
+		for (size_t z = 0; z < sz; z++, iv += index_width) {
+			tables.num_components[z] = read_index(buffer + iv, index_width);
+		}
+		for (size_t z = 0; z < sz; z++, iv += index_width) {
+			tables.num_locations[z] = read_index(buffer + iv, index_width);
+		}
+		// A slice has at most one component and two location 
+		// entries per voxel, which also bounds the sums below.
+		for (size_t z = 0; z < sz; z++) {
+			if (tables.num_components[z] > sx * sy || tables.num_locations[z] > 2 * sx * sy) {
+				return 16;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Labels the non-boundary voxels of consecutive 4-connected 
+ * slices with their ids, starting from the component at 
+ * component_offset.
+ */
+template <typename LABEL, typename WINDOW>
+class SliceLabeler {
+public:
+	SliceLabeler(
+		const CompressoHeader &header, const CompressoTables<LABEL, WINDOW> &tables,
+		const size_t component_offset, const LabelMapping &mapping
+	) : 
+		header(header), tables(tables), mapping(mapping),
+		reader(
+			tables.windows, tables.window_values, 
+			header.sx, header.sy, header.xstep, header.ystep, header.zstep
+		),
+		sxy(static_cast<size_t>(header.sx) * header.sy),
+		components(new uint32_t[sxy]),
+		next_component(component_offset)
+	{}
+
+	size_t slice_words() const {
+		return reader.slice_words();
+	}
+
+	// Reads the boundaries of slice z into boundaries, which holds
+	// slice_words() words, and writes the labels of its 
+	// non-boundary voxels to output. Slices must be labeled in order.
+	int label(const size_t z, uint64_t* boundaries, LABEL* output) {
+		if (!reader.read(z, boundaries)) {
+			return 16;
+		}
+		size_t num_provisional = 0;
+		size_t num_components = 0;
+		std::unique_ptr<uint32_t[]> renumber = cc3d::provisional_components2d_4<uint32_t>(
+			boundaries, header.sx, header.sy, 
+			(sxy + 2) / 2, components.get(), num_provisional, num_components
+		);
+		if (next_component + num_components > header.id_size) {
+			return 17;
+		}
+		// The id of each provisional label, so that relabeling 
+		// and the id lookup are a single pass.
+		slice_ids.resize(num_provisional + 1);
+		slice_ids[0] = 0;
+		for (size_t i = 1; i <= num_provisional; i++) {
+			slice_ids[i] = mapping(tables.ids[next_component + renumber[i] - 1]);
+		}
+		decode_nonboundary_labels<LABEL>(
+			components.get(), slice_ids.data(), sxy, output
+		);
+		next_component += num_components;
+		return 0;
+	}
+
+private:
+	const CompressoHeader &header;
+	const CompressoTables<LABEL, WINDOW> &tables;
+	const LabelMapping &mapping;
+	BoundaryReader<WINDOW> reader;
+	const size_t sxy;
+	std::unique_ptr<uint32_t[]> components;
+	size_t next_component;
+	std::vector<LABEL> slice_ids;
+};
+
+/* Decodes slices [z_start, z_end) into output. component_offset
+ * is the number of components in the slices before z_start, and 
+ * locations starts at the first location entry of z_start.
+ *
+ * With 4-connectivity the slices are decoded one at a time, so 
+ * that apart from the tables the scratch memory is a few slices.
+ * Each slice's components are labeled before the boundaries of the 
+ * previous slice are resolved, as those may refer to the next slice.
+ * 6-connected components span slices, so that case decodes all
+ * boundaries at once.
+ */
+template <typename LABEL, typename WINDOW>
+int decode_slices(
+	const CompressoHeader &header, const CompressoTables<LABEL, WINDOW> &tables,
+	const size_t z_start, const size_t z_end,
+	const size_t component_offset, const ArrayView<LABEL> &locations,
+	LABEL* output, const LabelMapping &mapping
+) {
+	const size_t sx = header.sx;
+	const size_t sy = header.sy;
+	const size_t sxy = sx * sy;
+	const size_t sz = z_end - z_start;
+	size_t location_index = 0;
+
+	if (header.connectivity == 6) {
+		BoundaryReader<WINDOW> reader(
+			tables.windows, tables.window_values, 
+			sx, sy, header.xstep, header.ystep, header.zstep
+		);
+		std::unique_ptr<bool[]> boundaries(new bool[sxy * sz]);
+		for (size_t z = 0; z < sz; z++) {
+			if (!reader.read(z_start + z, boundaries.get() + sxy * z)) {
+				return 16;
+			}
+		}
+
+		size_t num_components = 0;
+		std::unique_ptr<uint32_t[]> components = cc3d::connected_components<uint32_t>(
+			boundaries.get(), sx, sy, sz, header.connectivity, num_components
+		);
+		if (component_offset + num_components > header.id_size) {
+			return 17;
+		}
+
+		// the id of each component, with 0 for boundary voxels
+		std::vector<LABEL> component_ids(num_components + 1, 0);
+		for (size_t i = 1; i <= num_components; i++) {
+			component_ids[i] = mapping(tables.ids[component_offset + i - 1]);
+		}
+		decode_nonboundary_labels<LABEL>(
+			components.get(), component_ids.data(), sxy * sz, output
+		);
+		components.reset();
+
+		return decode_indeterminate_locations<LABEL>(
+			boundaries.get(), output, locations, location_index,
+			sx, sy, sz, 0, sz,
+			header.connectivity, mapping
+		);
+	}
+
+	SliceLabeler<LABEL, WINDOW> labeler(header, tables, component_offset, mapping);
+	// packed boundaries of slices z and z + 1, alternating halves
+	const size_t words = labeler.slice_words();
+	std::unique_ptr<uint64_t[]> boundaries(new uint64_t[2 * words]);
+
+	auto label_slice = [&](const size_t z) -> int {
+		return labeler.label(
+			z_start + z, boundaries.get() + words * (z % 2), output + sxy * z
+		);
+	};
+
+	int err = label_slice(0);
+	for (size_t z = 0; z < sz && err == 0; z++) {
+		if (z + 1 < sz) {
+			err = label_slice(z + 1);
+			if (err) {
+				break;
+			}
+		}
+		err = decode_indeterminate_locations<LABEL>(
+			boundaries.get() + words * (z % 2), output, 
+			locations, location_index,
+			sx, sy, sz, z, z + 1,
+			header.connectivity, mapping
+		);
+	}
+
+	return err;
+}
+
+// Splits [begin, end) into at most parts consecutive ranges,
+// returned as their boundaries.
+inline std::vector<size_t> split_range(
+	const size_t begin, const size_t end, const size_t parts
+) {
+	std::vector<size_t> bounds(1, begin);
+	for (size_t i = 1; i < parts; i++) {
+		const size_t bound = begin + (end - begin) * i / parts;
+		if (bound > bounds.back()) {
+			bounds.push_back(bound);
+		}
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+
+// Runs fn(begin, end) on each range given by bounds, one
+// thread per range, and returns the first error.
+template <typename F>
+int run_parallel(const std::vector<size_t> &bounds, F fn) {
+	const size_t num_ranges = bounds.size() - 1;
+	std::vector<int> errors(num_ranges, 0);
+#ifdef COMPRESSO_THREADS
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_ranges; i++) {
+		threads.emplace_back([&, i]() {
+			errors[i] = fn(bounds[i], bounds[i + 1]);
+		});
+	}
+	errors[0] = fn(bounds[0], bounds[1]);
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+#else
+	for (size_t i = 0; i < num_ranges; i++) {
+		errors[i] = fn(bounds[i], bounds[i + 1]);
+	}
+#endif
+	for (size_t i = 0; i < num_ranges; i++) {
+		if (errors[i]) {
+			return errors[i];
+		}
+	}
+	return 0;
+}
+
+// Counts the components and the boundary voxels that need a
+// location entry in each 4-connected slice of [z_begin, z_end).
+template <typename LABEL, typename WINDOW>
+int count_slices(
+	const CompressoHeader &header, const CompressoTables<LABEL, WINDOW> &tables,
+	const size_t z_begin, const size_t z_end,
+	uint64_t* num_components, uint64_t* num_indeterminate
+) {
+	const size_t sx = header.sx;
+	const size_t sy = header.sy;
+	const size_t sxy = sx * sy;
+
+	BoundaryReader<WINDOW> reader(
+		tables.windows, tables.window_values, 
+		sx, sy, header.xstep, header.ystep, header.zstep
+	);
+	std::unique_ptr<uint64_t[]> boundaries(new uint64_t[reader.slice_words()]);
+	std::unique_ptr<uint32_t[]> components(new uint32_t[sxy]);
+
+	for (size_t z = z_begin; z < z_end; z++) {
+		if (!reader.read(z, boundaries.get())) {
+			return 16;
+		}
+		// only the count is needed, so the labels are left provisional
+		size_t num_provisional = 0;
+		size_t n = 0;
+		cc3d::provisional_components2d_4<uint32_t>(
+			boundaries.get(), sx, sy, 
+			(sxy + 2) / 2, components.get(), num_provisional, n
+		);
+		num_components[z - z_begin] = n;
+
+		uint64_t count = 0;
+		for (size_t y = 0; y < sy; y++) {
+			const size_t row = sx * y;
+			for (
+				size_t b = next_boundary(boundaries.get(), row, row + sx); 
+				b < row + sx; 
+				b = next_boundary(boundaries.get(), b + 1, row + sx)
+			) {
+				count += (
+					!(b > row && !is_boundary(boundaries.get(), b - 1))
+					&& !(y > 0 && !is_boundary(boundaries.get(), b - sx))
+				);
+			}
+		}
+		num_indeterminate[z - z_begin] = count;
+	}
+
+	return 0;
+}
+
+/* Decodes 4-connected slices [z_start, z_end) with up to 
+ * num_threads threads, each running decode_slices on a 
+ * range of slices.
+ *
+ * A range needs the number of components and location entries
+ * before it. format_version 1 records them. Otherwise they are
+ * counted in parallel and the location entries walked to find
+ * where each slice's entries end, which requires z_start == 0.
+ *
+ * Location codes 4 and 5 refer to the previous and next slice, 
+ * so ranges are only split between slices that do not refer
+ * to each other.
+ */
+template <typename LABEL, typename WINDOW>
+int decode_slices_parallel(
+	const CompressoHeader &header, const CompressoTables<LABEL, WINDOW> &tables,
+	const size_t z_start, const size_t z_end, const size_t num_threads,
+	LABEL* output, const LabelMapping &mapping
+) {
+	const size_t sxy = static_cast<size_t>(header.sx) * header.sy;
+	const size_t nz = z_end - z_start;
+
+	std::vector<uint64_t> num_components(nz);
+	std::vector<uint64_t> num_locations(nz);
+	size_t component_offset = 0;
+	size_t location_offset = 0;
+
+	if (header.format_version == 1) {
+		for (size_t z = 0; z < z_start; z++) {
+			component_offset += tables.num_components[z];
+			location_offset += tables.num_locations[z];
+		}
+		std::copy(
+			tables.num_components.begin() + z_start, 
+			tables.num_components.begin() + z_end, 
+			num_components.begin()
+		);
+		std::copy(
+			tables.num_locations.begin() + z_start, 
+			tables.num_locations.begin() + z_end, 
+			num_locations.begin()
+		);
+	}
+	else {
+		std::vector<uint64_t> num_indeterminate(nz);
+		int err = run_parallel(
+			split_range(0, nz, num_threads), 
+			[&](const size_t begin, const size_t end) {
+				return count_slices<LABEL, WINDOW>(
+					header, tables, z_start + begin, z_start + end,
+					num_components.data() + begin, num_indeterminate.data() + begin
+				);
+			}
+		);
+		if (err) {
+			return err;
+		}
+		// Code 6 is followed by the label itself.
+		size_t index = 0;
+		for (size_t z = 0; z < nz; z++) {
+			const size_t slice_start = index;
+			for (uint64_t i = 0; i < num_indeterminate[z] && index < tables.locations.size(); i++) {
+				index += (tables.locations[index] == 6) ? 2 : 1;
+			}
+			index = std::min(index, tables.locations.size());
+			num_locations[z] = index - slice_start;
+		}
+	}
+
+	std::vector<size_t> location_starts(nz + 1, location_offset);
+	for (size_t z = 0; z < nz; z++) {
+		location_starts[z + 1] = location_starts[z] + num_locations[z];
+	}
+	if (location_starts[nz] > tables.locations.size()) {
+		return 16;
+	}
+
+	// Slice z can start a range if it does not refer to slice
+	// z - 1 and slice z - 1 does not refer to it.
+	std::vector<bool> splittable(nz + 1, true);
+	for (size_t z = 0; z < nz; z++) {
+		for (size_t i = location_starts[z]; i < location_starts[z + 1]; i++) {
+			if (tables.locations[i] == 6) {
+				i++;
+			}
+			else if (tables.locations[i] == 4) {
+				splittable[z] = false;
+			}
+			else if (tables.locations[i] == 5) {
+				splittable[z + 1] = false;
+			}
+		}
+	}
+	std::vector<size_t> bounds(1, 0);
+	for (size_t bound : split_range(0, nz, num_threads)) {
+		bound = std::max(bound, bounds.back() + 1);
+		while (bound < nz && !splittable[bound]) {
+			bound++;
+		}
+		if (bound < nz) {
+			bounds.push_back(bound);
+		}
+	}
+	bounds.push_back(nz);
+
+	std::vector<size_t> component_starts(nz + 1, component_offset);
+	for (size_t z = 0; z < nz; z++) {
+		component_starts[z + 1] = component_starts[z] + num_components[z];
+	}
+
+	return run_parallel(bounds, [&](const size_t begin, const size_t end) {
+		return decode_slices<LABEL, WINDOW>(
+			header, tables, z_start + begin, z_start + end, component_starts[begin],
+			tables.locations.slice(
+				location_starts[begin], location_starts[end] - location_starts[begin]
+			),
+			output + sxy * begin, mapping
+		);
+	});
+}
+
+/* Decodes slices [z_start, z_end) into output, which holds
+ * sx * sy * (z_end - z_start) labels.
+ *
+ * With format_version 1, the z index locates the components
+ * and location entries of z_start, so only the requested slices 
+ * are decoded. With format_version 0, the whole volume is decoded 
+ * and the requested slices are copied out.
+ *
+ * 4-connected streams are decoded with up to num_threads threads.
+ * Labels are replaced according to mapping as they are decoded.
+ */
+template <typename LABEL, typename WINDOW>
+int decompress_range(
+	unsigned char* buffer, size_t num_bytes, 
+	const size_t z_start, const size_t z_end, LABEL* output,
+	const size_t num_threads = 1, const LabelMapping &mapping = LabelMapping()
+) {
+	if (output == NULL) {
+		return 8;
+	}
+	else if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	else if (!CompressoHeader::valid_header(buffer)) {
+		return 10;
+	}
+
+	const CompressoHeader header(buffer);
+
+	const size_t sx = header.sx;
+	const size_t sy = header.sy;
+	const size_t sz = header.sz;
+	const size_t sxy = sx * sy;
+
+	if (sx * sy * sz == 0) {
+		return 11;
+	}
+	else if (z_start >= z_end || z_end > sz) {
+		return 15;
+	}
+
+	CompressoTables<LABEL, WINDOW> tables;
+	int err = read_tables<LABEL, WINDOW>(buffer, num_bytes, header, tables);
+	if (err) {
+		return err;
+	}
+
+	// Without an index, slices can only be decoded from the start.
+	size_t decode_start = z_start;
+	size_t decode_end = z_end;
+	LABEL* decode_output = output;
+	std::vector<LABEL> volume;
+	if (header.format_version == 0 && (z_start != 0 || z_end != sz)) {
+		decode_start = 0;
+		decode_end = sz;
+		volume.resize(sxy * sz);
+		decode_output = volume.data();
+	}
+
+	if (num_threads > 1 && header.connectivity == 4 && decode_end - decode_start > 1) {
+		err = decode_slices_parallel<LABEL, WINDOW>(
+			header, tables, decode_start, decode_end, num_threads, 
+			decode_output, mapping
+		);
+	}
+	else {
+		size_t component_offset = 0;
+		size_t location_offset = 0;
+		size_t num_locations = tables.locations.size();
+		if (header.format_version == 1) {
+			num_locations = 0;
+			for (size_t z = 0; z < decode_start; z++) {
+				component_offset += tables.num_components[z];
+				location_offset += tables.num_locations[z];
+			}
+			for (size_t z = decode_start; z < decode_end; z++) {
+				num_locations += tables.num_locations[z];
+			}
+			if (location_offset + num_locations > tables.locations.size()) {
+				return 16;
+			}
+		}
+		err = decode_slices<LABEL, WINDOW>(
+			header, tables, decode_start, decode_end, component_offset, 
+			tables.locations.slice(location_offset, num_locations),
+			decode_output, mapping
+		);
+	}
+
+	if (err == 0 && decode_output != output) {
+		std::copy(volume.begin() + sxy * z_start, volume.begin() + sxy * z_end, output);
+	}
+	return err;
+}
+
+template <typename LABEL, typename WINDOW>
+int decompress(unsigned char* buffer, size_t num_bytes, LABEL* output) {
+	if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	return decompress_range<LABEL, WINDOW>(
+		buffer, num_bytes, 0, ctoi<uint16_t>(buffer, 10), output
+	);
+}
+
+// This function is used to produce the cartesian
+// product of LABEL x WINDOW possibilities and reduce
+// the human edited code down from 16 conditions down to
+// 8.
+template <typename WINDOW>
+int decompress_helper(
+	unsigned char* buffer, size_t num_bytes, 
+	const size_t z_start, const size_t z_end,
+	void* output, const CompressoHeader &header, const size_t num_threads,
+	const LabelMapping &mapping
+) {
+	if (header.data_width == 1) {
+		return decompress_range<uint8_t,WINDOW>(
+			buffer, num_bytes, z_start, z_end, 
+			reinterpret_cast<uint8_t*>(output), num_threads, mapping
+		);
+	}
+	else if (header.data_width == 2) {
+		return decompress_range<uint16_t,WINDOW>(
+			buffer, num_bytes, z_start, z_end, 
+			reinterpret_cast<uint16_t*>(output), num_threads, mapping
+		);
+	}
+	else if (header.data_width == 4) {
+		return decompress_range<uint32_t,WINDOW>(
+			buffer, num_bytes, z_start, z_end, 
+			reinterpret_cast<uint32_t*>(output), num_threads, mapping
+		);
+	}
+	else if (header.data_width == 8) {
+		return decompress_range<uint64_t,WINDOW>(
+			buffer, num_bytes, z_start, z_end, 
+			reinterpret_cast<uint64_t*>(output), num_threads, mapping
+		);
+	}
+	else {
+		return 13;
+	}
+}
+
+template <>
+int decompress_range<void,void>(
+	unsigned char* buffer, size_t num_bytes, 
+	const size_t z_start, const size_t z_end, void* output,
+	const size_t num_threads, const LabelMapping &mapping
+) {
+	if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	else if (!CompressoHeader::valid_header(buffer)) {
+		return 12;
+	}
+
+	CompressoHeader header(buffer);
+
+	bool window8 = (
+		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 8
+	);
+	bool window16 = (
+		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 16
+	);
+	bool window32 = (
+		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep) <= 32
+	);
+
+	if (window8) {
+		return decompress_helper<uint8_t>(
+			buffer, num_bytes, z_start, z_end, output, header, num_threads, mapping
+		);
+	}
+	else if (window16) {
+		return decompress_helper<uint16_t>(
+			buffer, num_bytes, z_start, z_end, output, header, num_threads, mapping
+		);
 	}
 	else if (window32) {
 		return decompress_helper<uint32_t>(
-			buffer, num_bytes, 
-			reinterpret_cast<uint8_t*>(output),
-			header
+			buffer, num_bytes, z_start, z_end, output, header, num_threads, mapping
 		);
 	}
 	else {
 		return decompress_helper<uint64_t>(
-			buffer, num_bytes, 
-			reinterpret_cast<uint8_t*>(output),
-			header
+			buffer, num_bytes, z_start, z_end, output, header, num_threads, mapping
 		);	
 	}
 }
 
+template <>
+int decompress<void,void>(unsigned char* buffer, size_t num_bytes, void* output) {
+	if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	return decompress_range<void,void>(
+		buffer, num_bytes, 0, ctoi<uint16_t>(buffer, 10), output
+	);
+}
+
+/* Decodes a stream a batch of consecutive slices at a time, in 
+ * increasing z, for consumers that do not need the whole volume.
+ * 4-connected slices are decoded into a window that also holds 
+ * the slices before and after the batch, as location codes refer 
+ * at most one slice away. 6-connected components span slices, so 
+ * those streams are decoded in full by the first call.
+ */
+template <typename LABEL, typename WINDOW>
+class SliceBatchDecoder {
+public:
+	SliceBatchDecoder(
+		const CompressoHeader &header, const CompressoTables<LABEL, WINDOW> &tables,
+		const size_t batch, const LabelMapping &mapping
+	) :
+		header(header), tables(tables), 
+		batch(std::max(batch, static_cast<size_t>(1))),
+		mapping(mapping), labeler(header, tables, 0, this->mapping),
+		sxy(static_cast<size_t>(header.sx) * header.sy),
+		location_index(0), z_next(0)
+	{}
+
+	// Sets slices to the labels of slices [z_begin, z_end), which 
+	// remain valid until the next call, with z_begin == z_end once
+	// all slices have been decoded.
+	int next(const LABEL* &slices, size_t &z_begin, size_t &z_end) {
+		const size_t sx = header.sx;
+		const size_t sy = header.sy;
+		const size_t sz = header.sz;
+		z_begin = z_next;
+		z_end = std::min(z_begin + batch, sz);
+		slices = nullptr;
+		if (z_begin >= z_end) {
+			z_end = z_begin;
+			return 0;
+		}
+
+		if (header.connectivity == 6) {
+			if (z_begin == 0) {
+				window.resize(sxy * sz);
+				int err = decode_slices<LABEL, WINDOW>(
+					header, tables, 0, sz, 0, tables.locations, window.data(), mapping
+				);
+				if (err) {
+					return err;
+				}
+			}
+			slices = window.data() + sxy * z_begin;
+			z_next = z_end;
+			return 0;
+		}
+
+		const size_t words = labeler.slice_words();
+		int err = 0;
+		if (z_begin == 0) {
+			boundaries.reset(new uint64_t[2 * words]);
+			window.resize((batch + 2) * sxy);
+			err = labeler.label(0, boundaries.get(), window.data() + sxy);
+			if (err) {
+				return err;
+			}
+		}
+		else {
+			// keep the last slice of the previous batch and the one after it
+			std::copy(
+				window.begin() + sxy * batch, 
+				window.begin() + sxy * (batch + 2), 
+				window.begin()
+			);
+		}
+
+		// The window seen as a volume that starts at its first slice 
+		// that exists, with slice z in position z - z_begin + 1.
+		const size_t first = (z_begin > 0) ? 0 : 1;
+		LABEL* local = window.data() + sxy * first;
+		const size_t local_sz = std::min(z_end + 1, sz) - z_begin + 1 - first;
+
+		for (size_t z = z_begin; z < z_end; z++) {
+			if (z + 1 < sz) {
+				err = labeler.label(
+					z + 1, boundaries.get() + words * ((z + 1) % 2), 
+					window.data() + sxy * (z - z_begin + 2)
+				);
+				if (err) {
+					return err;
+				}
+			}
+			const size_t local_z = z - z_begin + 1 - first;
+			err = decode_indeterminate_locations<LABEL>(
+				boundaries.get() + words * (z % 2), local,
+				tables.locations, location_index,
+				sx, sy, local_sz, local_z, local_z + 1,
+				header.connectivity, mapping
+			);
+			if (err) {
+				return err;
+			}
+		}
+
+		slices = window.data() + sxy;
+		z_next = z_end;
+		return 0;
+	}
+
+private:
+	const CompressoHeader &header;
+	const CompressoTables<LABEL, WINDOW> &tables;
+	const size_t batch;
+	const LabelMapping mapping;
+	SliceLabeler<LABEL, WINDOW> labeler;
+	const size_t sxy;
+	// packed boundaries of slices z and z + 1, alternating halves
+	std::unique_ptr<uint64_t[]> boundaries;
+	std::vector<LABEL> window;
+	size_t location_index;
+	size_t z_next;
+};
+
+/* LABEL QUERIES START HERE */
+
+template <typename WINDOW, typename F>
+int dispatch_label_type(const CompressoHeader &header, F &fn) {
+	if (header.data_width == 1) {
+		return fn.template run<uint8_t, WINDOW>();
+	}
+	else if (header.data_width == 2) {
+		return fn.template run<uint16_t, WINDOW>();
+	}
+	else if (header.data_width == 4) {
+		return fn.template run<uint32_t, WINDOW>();
+	}
+	return fn.template run<uint64_t, WINDOW>();
+}
+
+/* Calls fn.template run<LABEL, WINDOW>() with the label and 
+ * window types of the stream described by header.
+ */
+template <typename F>
+int dispatch_types(const CompressoHeader &header, F &fn) {
+	const int window_size = (
+		static_cast<int>(header.xstep) * static_cast<int>(header.ystep) * static_cast<int>(header.zstep)
+	);
+	if (window_size <= 8) {
+		return dispatch_label_type<uint8_t>(header, fn);
+	}
+	else if (window_size <= 16) {
+		return dispatch_label_type<uint16_t>(header, fn);
+	}
+	else if (window_size <= 32) {
+		return dispatch_label_type<uint32_t>(header, fn);
+	}
+	return dispatch_label_type<uint64_t>(header, fn);
+}
+
+/* Appends the distinct labels of the stream to labels, in 
+ * increasing order. A label is either the id of a component
+ * or stored in the locations, as the other location codes 
+ * copy the label of a neighbor, so only those two tables are
+ * read and no boundaries are decoded.
+ */
+template <typename LABEL, typename WINDOW>
+int unique_labels(
+	unsigned char* buffer, const size_t num_bytes, 
+	const CompressoHeader &header, std::vector<uint64_t> &labels
+) {
+	CompressoTables<LABEL, WINDOW> tables;
+	int err = read_tables<LABEL, WINDOW>(buffer, num_bytes, header, tables);
+	if (err) {
+		return err;
+	}
+
+	std::unordered_set<uint64_t> seen;
+	for (size_t i = 0; i < tables.ids.size(); i++) {
+		seen.insert(tables.ids[i]);
+	}
+	for (size_t i = 0; i < tables.locations.size(); i++) {
+		const LABEL code = tables.locations[i];
+		if (code == 6) {
+			if (i + 1 >= tables.locations.size()) {
+				return 1;
+			}
+			seen.insert(tables.locations[++i]);
+		}
+		else if (code > 6) {
+			seen.insert(code - 7);
+		}
+	}
+	const size_t begin = labels.size();
+	labels.insert(labels.end(), seen.begin(), seen.end());
+	std::sort(labels.begin() + begin, labels.end());
+	return 0;
+}
+
+template <typename LABEL>
+void count_runs(
+	const LABEL* labels, const size_t voxels, 
+	std::unordered_map<uint64_t, uint64_t> &counts
+) {
+	size_t i = 0;
+	while (i < voxels) {
+		size_t run_end = i + 1;
+		while (run_end < voxels && labels[run_end] == labels[i]) {
+			run_end++;
+		}
+		counts[labels[i]] += run_end - i;
+		i = run_end;
+	}
+}
+
+/* Counts the voxels of each label by decoding the stream without
+ * an output volume, a batch of slices at a time.
+ */
+template <typename LABEL, typename WINDOW>
+int count_labels(
+	unsigned char* buffer, const size_t num_bytes, 
+	const CompressoHeader &header, std::unordered_map<uint64_t, uint64_t> &counts
+) {
+	const size_t sxy = static_cast<size_t>(header.sx) * header.sy;
+
+	CompressoTables<LABEL, WINDOW> tables;
+	int err = read_tables<LABEL, WINDOW>(buffer, num_bytes, header, tables);
+	if (err) {
+		return err;
+	}
+
+	SliceBatchDecoder<LABEL, WINDOW> decoder(header, tables, 16, LabelMapping());
+	while (true) {
+		const LABEL* slices = nullptr;
+		size_t z_begin = 0;
+		size_t z_end = 0;
+		err = decoder.next(slices, z_begin, z_end);
+		if (err || z_begin == z_end) {
+			return err;
+		}
+		count_runs<LABEL>(slices, sxy * (z_end - z_begin), counts);
+	}
+}
+
+struct UniqueLabelsFn {
+	unsigned char* buffer;
+	size_t num_bytes;
+	const CompressoHeader &header;
+	std::vector<uint64_t> &labels;
+
+	template <typename LABEL, typename WINDOW>
+	int run() {
+		return unique_labels<LABEL, WINDOW>(buffer, num_bytes, header, labels);
+	}
+};
+
+struct CountLabelsFn {
+	unsigned char* buffer;
+	size_t num_bytes;
+	const CompressoHeader &header;
+	std::unordered_map<uint64_t, uint64_t> &counts;
+
+	template <typename LABEL, typename WINDOW>
+	int run() {
+		return count_labels<LABEL, WINDOW>(buffer, num_bytes, header, counts);
+	}
+};
+
+/* Sets labels to the distinct labels of the stream, in 
+ * increasing order, without decoding it.
+ */
+inline int labels(
+	unsigned char* buffer, const size_t num_bytes, std::vector<uint64_t> &labels
+) {
+	if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	else if (!CompressoHeader::valid_header(buffer)) {
+		return 12;
+	}
+
+	CompressoHeader header(buffer);
+	labels.clear();
+	UniqueLabelsFn fn = { buffer, num_bytes, header, labels };
+	return dispatch_types(header, fn);
+}
+
+/* Sets labels to the distinct labels of the stream, in 
+ * increasing order, and counts to the number of voxels
+ * of each. This decodes the stream, but only a few slices 
+ * at a time when it is 4-connected.
+ */
+inline int label_counts(
+	unsigned char* buffer, const size_t num_bytes, 
+	std::vector<uint64_t> &labels, std::vector<uint64_t> &counts
+) {
+	if (num_bytes < CompressoHeader::header_size) {
+		return 9;
+	}
+	else if (!CompressoHeader::valid_header(buffer)) {
+		return 12;
+	}
+
+	CompressoHeader header(buffer);
+	std::unordered_map<uint64_t, uint64_t> label_counts;
+	CountLabelsFn fn = { buffer, num_bytes, header, label_counts };
+	int err = dispatch_types(header, fn);
+	if (err) {
+		return err;
+	}
+
+	labels.clear();
+	for (const auto &entry : label_counts) {
+		labels.push_back(entry.first);
+	}
+	std::sort(labels.begin(), labels.end());
+	counts.resize(labels.size());
+	for (size_t i = 0; i < labels.size(); i++) {
+		counts[i] = label_counts[labels[i]];
+	}
+	return 0;
+}
+
 };
 
-#endif
\ No newline at end of file
+#endif
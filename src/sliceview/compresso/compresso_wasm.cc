@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cstdlib>
+
 #include "./compresso.hpp"
 
 extern "C" {
@@ -30,4 +33,62 @@ int compresso_decompress(
 	return 0;
 }
 
+// Decodes slices [z_start, z_end) into out, which must hold
+// sx * sy * (z_end - z_start) labels.
+int compresso_decompress_range(
+	unsigned char* buf, unsigned int num_bytes, 
+	unsigned int z_start, unsigned int z_end, void* out
+) {
+	return compresso::decompress_range<void,void>(
+		buf, num_bytes, z_start, z_end, out
+	);
+}
+
+// Like compresso_decompress_range, replacing each label found in
+// keys, which must be strictly increasing, with the corresponding
+// entry of values.
+int compresso_decompress_mapped(
+	unsigned char* buf, unsigned int num_bytes, 
+	unsigned int z_start, unsigned int z_end,
+	const uint64_t* keys, const uint64_t* values, unsigned int mapping_size,
+	void* out
+) {
+	return compresso::decompress_range<void,void>(
+		buf, num_bytes, z_start, z_end, out,
+		/*num_threads=*/1, compresso::LabelMapping(keys, values, mapping_size)
+	);
+}
+
+// Returns the distinct labels of the stream in increasing order, 
+// followed by the number of voxels of each if count is nonzero, as
+// uint64 values in a buffer allocated with malloc, which the caller
+// must free. The number of labels is stored in *num_labels. Returns 
+// null if the stream is invalid or allocation fails.
+//
+// Without count, only the ids and locations are read.
+uint64_t* compresso_labels(
+	unsigned char* buf, unsigned int num_bytes, int count, 
+	unsigned int* num_labels
+) {
+	std::vector<uint64_t> labels, counts;
+	int err = count
+		? compresso::label_counts(buf, num_bytes, labels, counts)
+		: compresso::labels(buf, num_bytes, labels);
+	if (err != 0) {
+		return nullptr;
+	}
+	const size_t size = labels.size() + counts.size();
+	// at least one entry, so that no labels is not mistaken for failure
+	uint64_t* output = static_cast<uint64_t*>(
+		std::malloc(std::max<size_t>(size, 1) * sizeof(uint64_t))
+	);
+	if (output == nullptr) {
+		return nullptr;
+	}
+	std::copy(labels.begin(), labels.end(), output);
+	std::copy(counts.begin(), counts.end(), output + labels.size());
+	*num_labels = labels.size();
+	return output;
+}
+
 }
\ No newline at end of file
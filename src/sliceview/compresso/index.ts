@@ -73,15 +73,305 @@ function readHeader(buffer: Uint8Array): {
   return { sx, sy, sz, dataWidth };
 }
 
+/**
+ * Mapping from labels to labels applied while decoding.  Labels that are not keys are left
+ * unchanged.
+ */
+export interface LabelMapping {
+  // Keys in strictly increasing order.
+  keys: BigUint64Array;
+  // Value corresponding to each key.
+  values: BigUint64Array;
+}
+
+function lookupLabel<T extends number | bigint>(
+  keys: ArrayLike<T>,
+  values: ArrayLike<T>,
+  label: T,
+): T {
+  let lower = 0;
+  let upper = keys.length;
+  while (lower < upper) {
+    const mid = (lower + upper) >>> 1;
+    if (keys[mid] < label) {
+      lower = mid + 1;
+    } else {
+      upper = mid;
+    }
+  }
+  return lower < keys.length && keys[lower] === label ? values[lower] : label;
+}
+
+function mapLabels<T extends number | bigint>(
+  labels: { length: number; [index: number]: T },
+  keys: ArrayLike<T>,
+  values: ArrayLike<T>,
+) {
+  // Labels mostly occur in runs, so the previous lookup is reused.
+  let previousLabel: T | undefined;
+  let previousValue: T | undefined;
+  for (let i = 0, length = labels.length; i < length; ++i) {
+    const label = labels[i];
+    if (label !== previousLabel) {
+      previousLabel = label;
+      previousValue = lookupLabel(keys, values, label);
+    }
+    labels[i] = previousValue!;
+  }
+}
+
+/**
+ * Applies `mapping` in place to `image`, which holds little-endian labels of `dataWidth` bytes.
+ * With labels narrower than 8 bytes, keys that do not fit are ignored and values are truncated.
+ *
+ * This is used when the module was built without decode-time mapping, in which case the mapping
+ * is applied to every voxel rather than only to the stored labels.
+ */
+function applyLabelMapping(
+  image: Uint8Array,
+  dataWidth: number,
+  mapping: LabelMapping,
+) {
+  const { keys, values } = mapping;
+  if (keys.length === 0) return;
+  const length = image.byteLength / dataWidth;
+  if (dataWidth === 8) {
+    mapLabels(
+      new BigUint64Array(image.buffer, image.byteOffset, length),
+      keys,
+      values,
+    );
+    return;
+  }
+  const bits = dataWidth * 8;
+  const limit = BigInt(2 ** bits);
+  let numKeys = 0;
+  while (numKeys < keys.length && keys[numKeys] < limit) {
+    ++numKeys;
+  }
+  const narrowKeys = new Float64Array(numKeys);
+  const narrowValues = new Float64Array(numKeys);
+  for (let i = 0; i < numKeys; ++i) {
+    narrowKeys[i] = Number(keys[i]);
+    narrowValues[i] = Number(BigInt.asUintN(bits, values[i]));
+  }
+  const labels =
+    dataWidth === 1
+      ? image
+      : dataWidth === 2
+        ? new Uint16Array(image.buffer, image.byteOffset, length)
+        : new Uint32Array(image.buffer, image.byteOffset, length);
+  mapLabels(labels, narrowKeys, narrowValues);
+}
+
+/**
+ * Decodes slices [zStart, zEnd) of a compresso stream.  Streams written with the z index
+ * (format version 1) decode only the requested slices; otherwise the whole volume is decoded.
+ *
+ * If `mapping` is specified, it is applied to the labels as they are decoded.
+ */
+export async function decompressCompressoRange(
+  buffer: Uint8Array,
+  zStart: number,
+  zEnd: number,
+  mapping?: LabelMapping,
+): Promise<Uint8Array> {
+  const m = await getCompressoModulePromise();
+  const { sx, sy, sz, dataWidth } = readHeader(buffer);
+  if (!(zStart >= 0 && zStart < zEnd && zEnd <= sz)) {
+    throw new Error(
+      `compresso: invalid z range [${zStart}, ${zEnd}) for ${sz} slices`,
+    );
+  }
+  const nbytes = sx * sy * (zEnd - zStart) * dataWidth;
+  if (mapping !== undefined) {
+    if (m.exports.compresso_decompress_mapped === undefined) {
+      // The module was built without decode-time mapping.
+      const image = await decompressCompressoRange(buffer, zStart, zEnd);
+      applyLabelMapping(image, dataWidth, mapping);
+      return image;
+    }
+    return decode(m, buffer, nbytes, (bufPtr, imagePtr) =>
+      withLabelMapping(m, mapping, (keysPtr, valuesPtr) =>
+        (m.exports.compresso_decompress_mapped as Function)(
+          bufPtr,
+          buffer.byteLength,
+          zStart,
+          zEnd,
+          keysPtr,
+          valuesPtr,
+          mapping.keys.length,
+          imagePtr,
+        ),
+      ),
+    );
+  }
+  if (m.exports.compresso_decompress_range === undefined) {
+    // The module was built without range decoding.
+    const sliceBytes = sx * sy * dataWidth;
+    return (await decompressCompresso(buffer)).slice(
+      zStart * sliceBytes,
+      zEnd * sliceBytes,
+    );
+  }
+  return decode(
+    m,
+    buffer,
+    nbytes,
+    (bufPtr, imagePtr) =>
+      (m.exports.compresso_decompress_range as Function)(
+        bufPtr,
+        buffer.byteLength,
+        zStart,
+        zEnd,
+        imagePtr,
+      ),
+  );
+}
+
 export async function decompressCompresso(
   buffer: Uint8Array,
+  mapping?: LabelMapping,
 ): Promise<Uint8Array> {
   const m = await getCompressoModulePromise();
 
   const { sx, sy, sz, dataWidth } = readHeader(buffer);
+  if (mapping !== undefined) {
+    return decompressCompressoRange(buffer, 0, sz, mapping);
+  }
   const voxels = sx * sy * sz;
-  const nbytes = voxels * dataWidth;
+  return decode(m, buffer, voxels * dataWidth, (bufPtr, imagePtr) =>
+    (m.exports.compresso_decompress as Function)(
+      bufPtr,
+      buffer.byteLength,
+      imagePtr,
+    ),
+  );
+}
 
+/**
+ * Returns the sorted distinct labels of a compresso stream, which are read from its tables
+ * without decoding it.  If `counts` is true, also returns the number of voxels of each label,
+ * which requires decoding, though not into a full volume.
+ */
+export async function getCompressoLabels(
+  buffer: Uint8Array,
+  counts = false,
+): Promise<{ labels: BigUint64Array; counts?: BigUint64Array }> {
+  const m = await getCompressoModulePromise();
+  const getLabels = m.exports.compresso_labels as Function | undefined;
+  if (getLabels === undefined) {
+    // The module was built without label queries.
+    return countLabels(buffer, counts);
+  }
+  const bufPtr = (m.exports.malloc as Function)(buffer.byteLength);
+  const numLabelsPtr = (m.exports.malloc as Function)(4);
+  let outPtr = 0;
+  try {
+    new Uint8Array((m.exports.memory as WebAssembly.Memory).buffer).set(
+      buffer,
+      bufPtr,
+    );
+    outPtr = getLabels(
+      bufPtr,
+      buffer.byteLength,
+      counts ? 1 : 0,
+      numLabelsPtr,
+    );
+    if (outPtr === 0) {
+      throw new Error("Failed to read compresso labels.");
+    }
+    // Memory growth during the call could have detached any earlier view.
+    const heap = (m.exports.memory as WebAssembly.Memory).buffer;
+    const numLabels = new Uint32Array(heap, numLabelsPtr, 1)[0];
+    const result = new BigUint64Array(
+      heap,
+      outPtr,
+      numLabels * (counts ? 2 : 1),
+    ).slice();
+    return counts
+      ? {
+          labels: result.subarray(0, numLabels),
+          counts: result.subarray(numLabels),
+        }
+      : { labels: result };
+  } finally {
+    (m.exports.free as Function)(bufPtr);
+    (m.exports.free as Function)(numLabelsPtr);
+    (m.exports.free as Function)(outPtr);
+  }
+}
+
+async function countLabels(
+  buffer: Uint8Array,
+  counts: boolean,
+): Promise<{ labels: BigUint64Array; counts?: BigUint64Array }> {
+  const { dataWidth } = readHeader(buffer);
+  const image = await decompressCompresso(buffer);
+  const length = image.byteLength / dataWidth;
+  const values =
+    dataWidth === 1
+      ? image
+      : dataWidth === 2
+        ? new Uint16Array(image.buffer, image.byteOffset, length)
+        : dataWidth === 4
+          ? new Uint32Array(image.buffer, image.byteOffset, length)
+          : new BigUint64Array(image.buffer, image.byteOffset, length);
+  const labelCounts = new Map<number | bigint, number>();
+  for (let i = 0; i < length; ++i) {
+    const label = values[i];
+    labelCounts.set(label, (labelCounts.get(label) ?? 0) + 1);
+  }
+  const labels = BigUint64Array.from(labelCounts.keys(), BigInt).sort();
+  if (!counts) return { labels };
+  return {
+    labels,
+    counts: BigUint64Array.from(labels, (label) =>
+      BigInt(
+        labelCounts.get(dataWidth === 8 ? label : Number(label)) as number,
+      ),
+    ),
+  };
+}
+
+/**
+ * Copies `mapping` into the heap of `m` for the duration of `fn`.
+ */
+function withLabelMapping(
+  m: WebAssembly.Instance,
+  mapping: LabelMapping,
+  fn: (keysPtr: number, valuesPtr: number) => number,
+): number {
+  const nbytes = mapping.keys.byteLength;
+  const keysPtr = (m.exports.malloc as Function)(nbytes);
+  const valuesPtr = (m.exports.malloc as Function)(nbytes);
+  try {
+    // The heap must be referenced after the allocations, because memory
+    // growth detaches the buffer.
+    const heap = new Uint8Array(
+      (m.exports.memory as WebAssembly.Memory).buffer,
+    );
+    heap.set(
+      new Uint8Array(mapping.keys.buffer, mapping.keys.byteOffset, nbytes),
+      keysPtr,
+    );
+    heap.set(
+      new Uint8Array(mapping.values.buffer, mapping.values.byteOffset, nbytes),
+      valuesPtr,
+    );
+    return fn(keysPtr, valuesPtr);
+  } finally {
+    (m.exports.free as Function)(keysPtr);
+    (m.exports.free as Function)(valuesPtr);
+  }
+}
+
+function decode(
+  m: WebAssembly.Instance,
+  buffer: Uint8Array,
+  nbytes: number,
+  decompress: (bufPtr: number, imagePtr: number) => number,
+): Uint8Array {
   if (nbytes < 0) {
     throw new Error(`Failed to decode compresso image. image size: ${nbytes}`);
   }
@@ -93,11 +383,7 @@ export async function decompressCompresso(
   const heap = new Uint8Array((m.exports.memory as WebAssembly.Memory).buffer);
   heap.set(buffer, bufPtr);
 
-  const code = (m.exports.compresso_decompress as Function)(
-    bufPtr,
-    buffer.byteLength,
-    imagePtr,
-  );
+  const code = decompress(bufPtr, imagePtr);
 
   try {
     if (code !== 0) {
@@ -112,7 +398,7 @@ export async function decompressCompresso(
     const image = new Uint8Array(
       (m.exports.memory as WebAssembly.Memory).buffer,
       imagePtr,
-      voxels * dataWidth,
+      nbytes,
     );
     // copy the array so it can be memory managed by JS
     // and we can free the emscripten buffer